@@ -0,0 +1,342 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <option_parser.h>
+
+#ifdef OPTIONS_BENCH_COUNT_ALLOCATIONS
+
+// The benchmark is linked with --wrap for each allocation function,
+// so every allocation made by the library passes through these.
+static long allocation_count = 0;
+
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t count, size_t size);
+void* __real_realloc(void* pointer, size_t size);
+
+void* __wrap_malloc(size_t size) {
+    allocation_count++;
+    return __real_malloc(size);
+}
+
+void* __wrap_calloc(size_t count, size_t size) {
+    allocation_count++;
+    return __real_calloc(count, size);
+}
+
+void* __wrap_realloc(void* pointer, size_t size) {
+    allocation_count++;
+    return __real_realloc(pointer, size);
+}
+
+#define ALLOCATIONS() allocation_count
+
+#else
+
+#define ALLOCATIONS() 0L
+
+#endif
+
+// Each case is repeated until roughly this many tokens have been parsed.
+#define TOKENS_PER_CASE 2000000
+
+static const char aliases[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789";
+
+typedef struct Arguments {
+    char** argv;
+    int argc;
+    // Every string in argv is owned by the arguments, except for the program name.
+    int owned;
+} Arguments;
+
+static volatile long handler_calls = 0;
+
+static void count_handler(char* name, int alias, char* value, void* data) {
+    handler_calls++;
+}
+
+static void count_list_handler(char* name, int alias, const OptionValue* values, int count, void* data) {
+    handler_calls += count;
+}
+
+static double now_ns() {
+    struct timespec time;
+    timespec_get(&time, TIME_UTC);
+    return time.tv_sec * 1e9 + time.tv_nsec;
+}
+
+static char* format_string(const char* format, int value) {
+    int length = snprintf(NULL, 0, format, value);
+    char* string = malloc(length + 1);
+    snprintf(string, length + 1, format, value);
+    return string;
+}
+
+static Arguments arguments_init(int argc) {
+    Arguments arguments = { malloc(argc * sizeof(char*)), argc, argc };
+    arguments.argv[0] = "options_bench";
+    return arguments;
+}
+
+static void arguments_free(Arguments* arguments) {
+    for(int i = 1; i < arguments->owned; i++)
+        free(arguments->argv[i]);
+    free(arguments->argv);
+}
+
+static OptionParser* bench_parser(int option_count, int sub_option_count, ParserFlags flags) {
+    OptionParser* parser = oparser_init(count_handler, flags, NULL);
+    for(int i = 0; i < option_count; i++) {
+        char* name = format_string("option-%d", i);
+        int alias = i < (int)sizeof(aliases) - 1 ? aliases[i] : 0;
+        Option* option = oparser_add_option(parser, name, alias, OF_DUPLICATES_ALLOWED, "Benchmark option");
+        if(sub_option_count > 0) {
+            OptionSubParser* subparser = osubparser_init(option, count_handler, PF_NONE, NULL);
+            for(int j = 0; j < sub_option_count; j++)
+                osubparser_add_option(subparser, format_string("sub-%d", j), 0, OF_DUPLICATES_ALLOWED, "Benchmark sub-option");
+        }
+    }
+    return parser;
+}
+
+static void free_parser_names(OptionParser* parser) {
+    // The parser doesn't own its names, so the ones made by bench_parser are freed here.
+    for(int i = 0; i < parser->option_count; i++) {
+        Option* option = parser->options + i;
+        if(option->sub_options != NULL) {
+            for(int j = 0; j < option->sub_options->option_count; j++)
+                free(option->sub_options->options[j].base.name);
+        }
+        free(option->base.name);
+    }
+    oparser_free(parser);
+}
+
+static void report(const char* group, const char* parameter, int tokens, int iterations, double elapsed, long allocations) {
+    double total_tokens = (double)tokens * iterations;
+    printf("%-12s %-18s %12.2f %14.2f %16.2f\n",
+           group,
+           parameter,
+           elapsed / total_tokens,
+           (double)allocations / iterations,
+           total_tokens / (elapsed / 1e9) / 1e6);
+}
+
+static void run_parse(const char* group, const char* parameter, const OptionParser* parser, Arguments* arguments) {
+    int tokens = arguments->argc - 1;
+    int iterations = TOKENS_PER_CASE / (tokens > 0 ? tokens : 1);
+    if(iterations < 1)
+        iterations = 1;
+
+    ParseResult result;
+    oparser_result_init(&result);
+
+    // Warms up the result so its buffers are already large enough, which is how a reused result behaves.
+    if(oparser_parse_into(parser, &result, arguments->argv, arguments->argc) != PE_NONE) {
+        char error[320];
+        oparser_format_error(&result, error, sizeof(error));
+        fprintf(stderr, "%s %s: %s\n", group, parameter, error);
+        exit(1);
+    }
+
+    long allocations = ALLOCATIONS();
+    double start = now_ns();
+    for(int i = 0; i < iterations; i++)
+        oparser_parse_into(parser, &result, arguments->argv, arguments->argc);
+    double elapsed = now_ns() - start;
+    allocations = ALLOCATIONS() - allocations;
+
+    report(group, parameter, tokens, iterations, elapsed, allocations);
+    oparser_result_destroy(&result);
+}
+
+static void bench_option_counts() {
+    // Every option is given once by name, so the cost of the name lookup dominates.
+    static const int counts[] = { 10, 100, 1000, 10000 };
+    for(int c = 0; c < (int)(sizeof(counts) / sizeof(counts[0])); c++) {
+        int count = counts[c];
+        OptionParser* parser = bench_parser(count, 0, PF_NONE);
+        Arguments arguments = arguments_init(count + 1);
+        for(int i = 0; i < count; i++)
+            arguments.argv[i + 1] = format_string("--option-%d", (i * 7919) % count);
+
+        char parameter[32];
+        snprintf(parameter, sizeof(parameter), "options=%d", count);
+        run_parse("names", parameter, parser, &arguments);
+
+        arguments_free(&arguments);
+        free_parser_names(parser);
+    }
+}
+
+static void bench_alias_bundles() {
+    // Tokens like -abcd, where each character is a separate option.
+    static const int lengths[] = { 1, 4, 16, 62 };
+    OptionParser* parser = bench_parser(sizeof(aliases) - 1, 0, PF_NONE);
+    for(int l = 0; l < (int)(sizeof(lengths) / sizeof(lengths[0])); l++) {
+        int length = lengths[l];
+        int token_count = 1000;
+        Arguments arguments = arguments_init(token_count + 1);
+        for(int i = 0; i < token_count; i++) {
+            char* token = malloc(length + 2);
+            token[0] = '-';
+            for(int j = 0; j < length; j++)
+                token[j + 1] = aliases[(i + j) % length];
+            token[length + 1] = '\0';
+            arguments.argv[i + 1] = token;
+        }
+
+        char parameter[32];
+        snprintf(parameter, sizeof(parameter), "bundle=%d", length);
+        run_parse("aliases", parameter, parser, &arguments);
+        arguments_free(&arguments);
+    }
+    oparser_free(parser);
+}
+
+static void bench_sub_options() {
+    // Each option is followed by all of its sub-options.
+    static const int counts[] = { 1, 4, 16, 64 };
+    for(int c = 0; c < (int)(sizeof(counts) / sizeof(counts[0])); c++) {
+        int count = counts[c];
+        int option_count = 32;
+        OptionParser* parser = bench_parser(option_count, count, PF_NONE);
+        Arguments arguments = arguments_init(option_count * (count + 1) + 1);
+        int index = 1;
+        for(int i = 0; i < option_count; i++) {
+            arguments.argv[index++] = format_string("--option-%d", i);
+            for(int j = 0; j < count; j++)
+                arguments.argv[index++] = format_string("sub-%d", j);
+        }
+
+        char parameter[32];
+        snprintf(parameter, sizeof(parameter), "sub-options=%d", count);
+        run_parse("sub-options", parameter, parser, &arguments);
+
+        arguments_free(&arguments);
+        free_parser_names(parser);
+    }
+}
+
+static void bench_remainder() {
+    // Mostly positional arguments with an option every so often.
+    static const int percentages[] = { 50, 90, 100 };
+    OptionParser* parser = bench_parser(10, 0, PF_ALLOW_REMAINDER);
+    for(int p = 0; p < (int)(sizeof(percentages) / sizeof(percentages[0])); p++) {
+        int percentage = percentages[p];
+        int token_count = 1000;
+        Arguments arguments = arguments_init(token_count + 1);
+        for(int i = 0; i < token_count; i++) {
+            if(i % 100 < percentage)
+                arguments.argv[i + 1] = format_string("input-file-%d.txt", i);
+            else
+                arguments.argv[i + 1] = format_string("--option-%d", i % 10);
+        }
+
+        char parameter[32];
+        snprintf(parameter, sizeof(parameter), "remainder=%d%%", percentage);
+        run_parse("remainder", parameter, parser, &arguments);
+        arguments_free(&arguments);
+    }
+    free_parser_names(parser);
+}
+
+static void bench_help() {
+    // Reports the cost per line of help text, with every option counting as one token.
+    static const int counts[] = { 10, 100, 1000, 10000 };
+    for(int c = 0; c < (int)(sizeof(counts) / sizeof(counts[0])); c++) {
+        int count = counts[c];
+        OptionParser* parser = bench_parser(count, 0, PF_NONE);
+        int iterations = TOKENS_PER_CASE / 20 / count;
+        if(iterations < 1)
+            iterations = 1;
+
+        long allocations = ALLOCATIONS();
+        double start = now_ns();
+        for(int i = 0; i < iterations; i++)
+            free(oparser_help(parser));
+        double elapsed = now_ns() - start;
+        allocations = ALLOCATIONS() - allocations;
+
+        char parameter[32];
+        snprintf(parameter, sizeof(parameter), "options=%d", count);
+        report("help", parameter, count, iterations, elapsed, allocations);
+        free_parser_names(parser);
+    }
+}
+
+static void bench_config_files() {
+    // Every option is set by one line of a config file, with each line counting as one token.
+    static const int counts[] = { 100, 1000, 10000 };
+    const char* path = "options_bench.conf";
+    for(int c = 0; c < (int)(sizeof(counts) / sizeof(counts[0])); c++) {
+        int count = counts[c];
+        OptionParser* parser = bench_parser(count, 0, PF_NONE);
+        FILE* file = fopen(path, "w");
+        if(!file) {
+            fprintf(stderr, "config: couldn't write %s\n", path);
+            exit(1);
+        }
+        fprintf(file, "# Generated by the benchmark\n");
+        for(int i = 0; i < count; i++)
+            fprintf(file, "option-%d = value-%d\n", (i * 7919) % count, i);
+        fclose(file);
+        oparser_add_config_file(parser, (char*)path);
+
+        char* argv[] = { "bench" };
+        ParseResult result;
+        oparser_result_init(&result);
+        if(oparser_parse_into(parser, &result, argv, 1) != PE_NONE) {
+            fprintf(stderr, "config: %s\n", oparser_get_error_string(&result));
+            exit(1);
+        }
+
+        int iterations = TOKENS_PER_CASE / count;
+        long allocations = ALLOCATIONS();
+        double start = now_ns();
+        for(int i = 0; i < iterations; i++)
+            oparser_parse_into(parser, &result, argv, 1);
+        double elapsed = now_ns() - start;
+        allocations = ALLOCATIONS() - allocations;
+
+        char parameter[32];
+        snprintf(parameter, sizeof(parameter), "lines=%d", count);
+        report("config", parameter, count, iterations, elapsed, allocations);
+        oparser_result_destroy(&result);
+        free_parser_names(parser);
+    }
+    remove(path);
+}
+
+static void bench_collected_values() {
+    // One option given over and over, either dispatched per occurrence or collected into a single list.
+    static const OptionFlags modes[] = { OF_NONE, OF_COLLECT_VALUES };
+    static const char* names[] = { "per-value", "collected" };
+    int token_count = 1000;
+    for(int m = 0; m < (int)(sizeof(modes) / sizeof(modes[0])); m++) {
+        OptionParser* parser = oparser_init(count_handler, PF_NONE, NULL);
+        oparser_set_list_handler(parser, count_list_handler);
+        oparser_add_option(parser, "echo", 'e', OF_DUPLICATES_ALLOWED | OF_VALUE_REQUIRED | modes[m], "Benchmark option");
+        Arguments arguments = arguments_init(token_count + 1);
+        for(int i = 0; i < token_count; i++)
+            arguments.argv[i + 1] = format_string("--echo=value-%d", i);
+
+        run_parse("values", names[m], parser, &arguments);
+        arguments_free(&arguments);
+        oparser_free(parser);
+    }
+}
+
+int main(int argc, char** argv) {
+    printf("%-12s %-18s %12s %14s %16s\n", "group", "parameter", "ns/token", "allocs/parse", "Mtokens/s");
+    bench_option_counts();
+    bench_alias_bundles();
+    bench_sub_options();
+    bench_remainder();
+    bench_help();
+    bench_config_files();
+    bench_collected_values();
+    return 0;
+}
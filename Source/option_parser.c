@@ -1,59 +1,456 @@
+#ifndef _WIN32
+#define _POSIX_C_SOURCE 200809L
+#endif
+
 #include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <locale.h>
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 #include "option_parser.h"
 
+#ifdef _WIN32
+#define process_environment() _environ
+#else
+extern char** environ;
+#define process_environment() environ
+#endif
+
+// <threads.h> is missing on some platforms, and older compilers on Windows don't have <stdatomic.h> either,
+// so threads and atomics go through the native APIs instead.
+#ifdef _WIN32
+typedef HANDLE NativeThread;
+typedef OptionParser* volatile AtomicParser;
+typedef volatile LONG AtomicCounter;
+#define atomic_parser_init(atomic, value) (*(atomic) = (value))
+#define atomic_parser_load(atomic) ((OptionParser*)InterlockedCompareExchangePointer((PVOID volatile*)(atomic), NULL, NULL))
+#define atomic_counter_init(atomic, value) (*(atomic) = (value))
+#define atomic_counter_add(atomic, value) ((int)InterlockedExchangeAdd((atomic), (value)))
+
+static OptionParser* atomic_parser_publish(AtomicParser* atomic, OptionParser* value) {
+    return InterlockedCompareExchangePointer((PVOID volatile*)atomic, value, NULL);
+}
+#else
+typedef pthread_t NativeThread;
+typedef _Atomic(OptionParser*) AtomicParser;
+typedef atomic_int AtomicCounter;
+#define atomic_parser_init(atomic, value) atomic_init((atomic), (value))
+#define atomic_parser_load(atomic) atomic_load_explicit((atomic), memory_order_acquire)
+#define atomic_counter_init(atomic, value) atomic_init((atomic), (value))
+#define atomic_counter_add(atomic, value) atomic_fetch_add((atomic), (value))
+
+static OptionParser* atomic_parser_publish(AtomicParser* atomic, OptionParser* value) {
+    OptionParser* expected = NULL;
+    atomic_compare_exchange_strong_explicit(atomic, &expected, value, memory_order_acq_rel, memory_order_acquire);
+    return expected;
+}
+#endif
+
 #define check_flag(flags, flag) (((flags) & (flag)) == (flag))
 #define ERROR_BUFFER_SIZE 256
+#define ENCOUNTERED_BITS ((int)(sizeof(unsigned int) * 8))
+#define BATCH_CHUNK_SIZE 16
+#define SCRATCH_BLOCK_SIZE 1024
+#define SNAPSHOT_MAGIC "OPSNAP\0\1"
+#define SNAPSHOT_VERSION 2
 
-OptionParser* oparser_init(OptionHandler handler, ParserFlags flags, void* data) {
-    OptionParser* parser = malloc(sizeof(OptionParser));
-    if(!parser)
+// A handler call recorded during a batch parse.
+typedef struct HandlerCall {
+    OptionHandler handler;
+    OptionValueHandler value_handler;
+    OptionListHandler list_handler;
+    char* name;
+    int alias;
+    char* value;
+    OptionValue span;
+    bool has_span;
+    const OptionValue* values;
+    int value_count;
+    void* data;
+} HandlerCall;
+
+struct HandlerLog {
+    HandlerCall* calls;
+    int count;
+    int capacity;
+};
+
+// A file that holds the tokens of a response file. Either mapped into memory or read into a heap buffer.
+struct MappedFile {
+    char* data;
+    size_t size;
+    bool mapped;
+};
+
+// An argument that is not necessarily null terminated.
+typedef struct Token {
+    char* start;
+    int length;
+
+    // Determines if the character after the token is a null terminator.
+    bool terminated;
+} Token;
+
+// The values of one option with OF_COLLECT_VALUES.
+typedef struct ValueGroup {
+    const struct OptionBase* option;
+    const char* parent_name;
+    OptionListHandler handler;
+    void* data;
+
+    // Where the values of the option start once they've been grouped, and how many there are.
+    int start;
+    int count;
+} ValueGroup;
+
+// Values are stored in the order they're given, and moved next to the other values of their option once the parse has finished.
+struct CollectedValues {
+    OptionValue* values;
+    OptionValue* grouped;
+
+    // The group of each value, in the order the values were given.
+    int* value_groups;
+    int count;
+    int capacity;
+
+    ValueGroup* groups;
+    int group_count;
+    int group_capacity;
+
+    // The group of the most recent value, which is usually the group of the next one as well.
+    int last_group;
+};
+
+// Storage for the tokens of a command string that had to be unescaped or terminated.
+struct ScratchBlock {
+    struct ScratchBlock* next;
+    int size;
+    int used;
+    char data[];
+};
+
+// A response file that is being split into tokens.
+typedef struct ResponseFile {
+    char* data;
+    size_t size;
+    size_t position;
+
+    // The path the file was opened with, which is used to report errors.
+    const char* path;
+
+    // Determines if there is room for a terminator after the last byte of the file.
+    bool padded;
+} ResponseFile;
+
+// Produces the tokens that are parsed, expanding response files as they are encountered.
+typedef struct TokenStream {
+    char** argv;
+    int argc;
+    int index;
+    const char* command;
+    int command_length;
+    int command_position;
+    ResponseFile files[OPARSER_RESPONSE_FILE_DEPTH];
+    int depth;
+    Token peeked;
+    bool has_peeked;
+} TokenStream;
+
+// A region of memory that parser allocations are carved out of.
+struct ArenaBlock {
+    struct ArenaBlock* next;
+    size_t size;
+    size_t used;
+    max_align_t data[];
+};
+
+// A subcommand whose parser is built when a parse first reaches it.
+// Starts with an OptionBase so that subcommands can be found with the same name index as options.
+struct Subcommand {
+    struct OptionBase base;
+    SubcommandBuilder builder;
+    void* data;
+
+    // Set once by whichever parse builds the subcommand first.
+    AtomicParser parser;
+};
+
+// Maps an environment variable to the option it sets.
+// Starts with an OptionBase so that variables can be found with the same name index as options.
+struct OptionEnvironment {
+    struct OptionBase base;
+    int option;
+};
+
+static void* default_allocate(size_t size, void* context) {
+    (void)context;
+    return malloc(size);
+}
+
+static void* default_reallocate(void* pointer, size_t size, void* context) {
+    (void)context;
+    return realloc(pointer, size);
+}
+
+static void default_release(void* pointer, void* context) {
+    (void)context;
+    free(pointer);
+}
+
+static size_t arena_align(size_t size) {
+    return (size + _Alignof(max_align_t) - 1) & ~(_Alignof(max_align_t) - 1);
+}
+
+static struct ArenaBlock* arena_block_create(const OptionAllocator* allocator, size_t size, struct ArenaBlock* next) {
+    if(size < allocator->arena_size)
+        size = allocator->arena_size;
+    struct ArenaBlock* block = allocator->allocate(sizeof(struct ArenaBlock) + size, allocator->context);
+    if(!block)
+        return NULL;
+    block->next = next;
+    block->size = size;
+    block->used = 0;
+    return block;
+}
+
+static void* arena_block_take(struct ArenaBlock* block, size_t size) {
+    size = arena_align(size);
+    if(block->size - block->used < size)
+        return NULL;
+    void* memory = (char*)block->data + block->used;
+    block->used += size;
+    return memory;
+}
+
+static const OptionAllocator default_allocator = { default_allocate, default_reallocate, default_release, NULL, 0 };
+
+static const OptionAllocator* parser_allocator(const OptionParser* parser) {
+    // Static parsers are declared without an allocator.
+    return parser->allocator.allocate != NULL ? &parser->allocator : &default_allocator;
+}
+
+static void* parser_allocate(OptionParser* parser, size_t size) {
+    if(parser->arena == NULL)
+        return parser_allocator(parser)->allocate(size, parser_allocator(parser)->context);
+
+    void* memory = arena_block_take(parser->arena, size);
+    if(memory != NULL)
+        return memory;
+
+    struct ArenaBlock* block = arena_block_create(&parser->allocator, arena_align(size), parser->arena);
+    if(!block)
+        return NULL;
+    parser->arena = block;
+    return arena_block_take(block, size);
+}
+
+static void* parser_reallocate(OptionParser* parser, void* pointer, size_t old_size, size_t size) {
+    if(parser->arena == NULL)
+        return parser_allocator(parser)->reallocate(pointer, size, parser_allocator(parser)->context);
+
+    // The most recent allocation can grow in place. Anything else is copied, and the old memory is reclaimed with the arena.
+    struct ArenaBlock* block = parser->arena;
+    char* top = (char*)block->data + block->used;
+    if((char*)pointer + arena_align(old_size) == top && block->size - block->used + arena_align(old_size) >= arena_align(size)) {
+        block->used += arena_align(size) - arena_align(old_size);
+        return pointer;
+    }
+
+    void* memory = parser_allocate(parser, size);
+    if(!memory)
         return NULL;
-    parser->options = malloc(sizeof(Option) * 2);
+    memcpy(memory, pointer, old_size);
+    return memory;
+}
+
+static void parser_release(OptionParser* parser, void* pointer) {
+    // Arena memory is only released when the whole parser is freed.
+    if(parser->arena == NULL)
+        parser_allocator(parser)->release(pointer, parser_allocator(parser)->context);
+}
+
+static void snapshot_unmap(char* data, size_t size) {
+#ifdef _WIN32
+    free(data);
+#else
+    munmap(data, size);
+#endif
+}
+
+static long page_size() {
+#ifdef _WIN32
+    return 4096;
+#else
+    return sysconf(_SC_PAGESIZE);
+#endif
+}
+
+OptionParser* oparser_init(OptionHandler handler, ParserFlags flags, void* data) {
+    return oparser_init_with_allocator(handler, flags, data, NULL);
+}
+
+OptionParser* oparser_init_with_allocator(OptionHandler handler, ParserFlags flags, void* data, const OptionAllocator* allocator) {
+    OptionAllocator settings = default_allocator;
+    if(allocator != NULL)
+        settings = *allocator;
+
+    OptionParser* parser;
+    struct ArenaBlock* arena = NULL;
+    if(settings.arena_size > 0) {
+        arena = arena_block_create(&settings, arena_align(sizeof(OptionParser)), NULL);
+        if(!arena)
+            return NULL;
+        parser = arena_block_take(arena, sizeof(OptionParser));
+    } else {
+        parser = settings.allocate(sizeof(OptionParser), settings.context);
+        if(!parser)
+            return NULL;
+    }
+    parser->allocator = settings;
+    parser->arena = arena;
+    parser->option_count = 0;
+    parser->option_capacity = 2;
+    parser->name_index.slots = NULL;
+    parser->name_index.capacity = 0;
+    parser->name_trie.nodes = NULL;
+    parser->name_trie.count = 0;
+    parser->name_trie.capacity = 0;
+    parser->subcommands = NULL;
+    parser->subcommand_count = 0;
+    parser->subcommand_capacity = 0;
+    parser->subcommand_index.slots = NULL;
+    parser->subcommand_index.capacity = 0;
+    parser->environment = NULL;
+    parser->environment_count = 0;
+    parser->environment_capacity = 0;
+    parser->environment_index.slots = NULL;
+    parser->environment_index.capacity = 0;
+    parser->config_files = NULL;
+    parser->config_file_count = 0;
+    parser->config_file_capacity = 0;
+    parser->remainder = NULL;
+    parser->remainder_capacity = 0;
+    parser->schema_version = 1;
+    parser->help = NULL;
+    parser->help_length = 0;
+    parser->help_version = 0;
+    parser->option_help = NULL;
+    parser->option_help_index = -1;
+    parser->snapshot = NULL;
+    parser->snapshot_size = 0;
+
+    parser->options = parser_allocate(parser, sizeof(Option) * 2);
     if(!parser->options) {
-        free(parser);
+        oparser_free(parser);
         return NULL;
     }
     if(check_flag(flags, PF_ALLOW_REMAINDER)) {
-        parser->remainder = malloc(sizeof(char*) * 2);
+        parser->remainder = parser_allocate(parser, sizeof(char*) * 2);
         if(!parser->remainder) {
-            free(parser->options);
-            free(parser);
+            oparser_free(parser);
             return NULL;
         }
-        parser->remainder_capacity = 2;
-    } else {
-        parser->remainder = NULL;
-        parser->remainder_capacity = 0;
+        parser->remainder_capacity = sizeof(char*) * 2;
     }
-    parser->option_count = 0;
-    parser->option_capacity = 2;
+    memset(parser->alias_index, -1, sizeof(parser->alias_index));
     parser->flags = flags;
     parser->remainder_count = 0;
     parser->handler = handler;
+    parser->value_handler = NULL;
+    parser->list_handler = NULL;
     parser->data = data;
     return parser;
 }
 
-static void option_free(Option* option) {
+static void option_free(OptionParser* parser, Option* option) {
     if(option->sub_options != NULL) {
-        free(option->sub_options->options);
-        free(option->sub_options);
+        parser_release(parser, option->sub_options->name_index.slots);
+        parser_release(parser, option->sub_options->name_trie.nodes);
+        parser_release(parser, option->sub_options->options);
+        parser_release(parser, option->sub_options);
     }
 }
 
 void oparser_free(OptionParser* parser) {
+    OptionAllocator allocator = *parser_allocator(parser);
+
+    // Cached help never lives in the arena, so it's released separately.
+    // A snapshot comes with its help, which is released with the snapshot itself.
+    if(parser->snapshot == NULL || parser->help < parser->snapshot || parser->help >= parser->snapshot + parser->snapshot_size)
+        allocator.release(parser->help, allocator.context);
+    allocator.release(parser->option_help, allocator.context);
+
+    // Static parsers only own their help and the remainder of 'oparser_parse'.
+    if(parser->option_capacity == 0) {
+        allocator.release(parser->remainder, allocator.context);
+        parser->remainder = NULL;
+        parser->remainder_count = 0;
+        parser->remainder_capacity = 0;
+        parser->help = NULL;
+        parser->option_help = NULL;
+        parser->option_help_index = -1;
+        if(parser->snapshot != NULL) {
+            snapshot_unmap(parser->snapshot, parser->snapshot_size);
+            free(parser);
+        }
+        return;
+    }
+
+    for(int i = 0; i < parser->option_count; i++)
+        allocator.release(parser->options[i].help, allocator.context);
+
+    // Subcommand parsers come from their builders, so they own their memory.
+    for(int i = 0; i < parser->subcommand_count; i++) {
+        OptionParser* subcommand = atomic_parser_load(&parser->subcommands[i].parser);
+        if(subcommand != NULL)
+            oparser_free(subcommand);
+    }
+
+    struct ArenaBlock* block = parser->arena;
+    if(block != NULL) {
+        // The parser lives in the arena, so everything goes at once.
+        while(block != NULL) {
+            struct ArenaBlock* next = block->next;
+            allocator.release(block, allocator.context);
+            block = next;
+        }
+        return;
+    }
+
     for(int i = 0; i < parser->option_count; i++)
-        option_free(parser->options + i);
+        option_free(parser, parser->options + i);
 
     if(parser->remainder != NULL)
-        free(parser->remainder);
+        parser_release(parser, parser->remainder);
 
-    free(parser->options);
-    free(parser);
+    parser_release(parser, parser->name_index.slots);
+    parser_release(parser, parser->name_trie.nodes);
+    parser_release(parser, parser->subcommand_index.slots);
+    parser_release(parser, parser->subcommands);
+    parser_release(parser, parser->environment_index.slots);
+    parser_release(parser, parser->environment);
+    parser_release(parser, parser->config_files);
+    parser_release(parser, parser->options);
+    allocator.release(parser, allocator.context);
 }
 
 static bool verify_flags(OptionFlags flags) {
@@ -69,567 +466,3800 @@ static bool is_option_char(char character) {
     return character != '=' && character != '\0';
 }
 
-Option* oparser_add_option(OptionParser* parser, char* option_name, int alias, OptionFlags flags, char* doc_string) {
-    if(!verify_flags(flags))
-        return NULL;
-
-    if(parser->option_count == parser->option_capacity) {
-        parser->option_capacity *= 2;
-        parser->options = realloc(parser->options, parser->option_capacity * sizeof(Option));
-    }
-    Option* option = parser->options + parser->option_count++;
-    option->sub_options = NULL;
-
-    struct OptionBase* base = (struct OptionBase*)option;
-    base->name = option_name;
-    base->alias = alias;
-    base->name_length = strlen(option_name);
-    base->flags = flags;
-    base->doc_string = doc_string;
+void oparser_set_value_handler(OptionParser* parser, OptionValueHandler handler) {
+    parser->value_handler = handler;
+}
 
-    return option;
+void osubparser_set_value_handler(OptionSubParser* parser, OptionValueHandler handler) {
+    parser->value_handler = handler;
 }
 
-OptionSubParser* osubparser_init(Option* option, OptionHandler handler, ParserFlags flags, void* data) {
-    OptionSubParser* parser = malloc(sizeof(OptionSubParser));
-    if(!parser)
-        return NULL;
-    parser->options = malloc(sizeof(SubOption) * 2);
-    if(!parser->options){
-        free(parser);
-        return NULL;
-    }
-    parser->option_capacity = 2;
-    parser->option_count = 0;
-    parser->handler = handler;
-    parser->flags = flags;
-    parser->data = data;
-    option->sub_options = parser;
-    return parser;
+void oparser_set_list_handler(OptionParser* parser, OptionListHandler handler) {
+    parser->list_handler = handler;
 }
 
-SubOption* osubparser_add_option(OptionSubParser* parser, char* option_name, int alias, OptionFlags flags, char* doc_string) {
-    if(!verify_flags(flags))
-        return NULL;
+void osubparser_set_list_handler(OptionSubParser* parser, OptionListHandler handler) {
+    parser->list_handler = handler;
+}
 
-    if(parser->option_count == parser->option_capacity) {
-        parser->option_capacity *= 2;
-        parser->options = realloc(parser->options, parser->option_capacity * sizeof(SubOption));
-        if(!parser->options)
-            return NULL;
+static unsigned int hash_name(const char* name, int length) {
+    // FNV-1a
+    unsigned int hash = 2166136261u;
+    for(int i = 0; i < length; i++) {
+        hash ^= (unsigned char)name[i];
+        hash *= 16777619u;
     }
-    SubOption* option = parser->options + parser->option_count++;
-
-    struct OptionBase* base = (struct OptionBase*)option;
-    base->name = option_name;
-    base->alias = alias;
-    base->name_length = strlen(option_name);
-    base->flags = flags;
-    base->doc_string = doc_string;
-
-    return option;
+    return hash;
 }
 
-static int scan_for_name(char* name, struct OptionBase* options, int option_size, int option_count) {
+static int find_name(const char* name, int length, const OptionNameIndex* index, const struct OptionBase* options, int option_size, int option_count) {
     // Needs the size of the option struct so the the pointer can be incremented correctly.
     // Without it, it would increment the memory address by the sizeof(OptionBase),
     // which would be incorrect for Option.
-    for(int i = 0; i < option_count; i++) {
-        if(strncmp(options->name, name, options->name_length) == 0)
-            return i;
-        options = (struct OptionBase*)((char*)options + option_size);
+    if(index->capacity == 0) {
+        // Static tables don't have an index, so they're searched directly.
+        for(int i = 0; i < option_count; i++) {
+            if(options->name_length == length && memcmp(options->name, name, length) == 0)
+                return i;
+            options = (const struct OptionBase*)((const char*)options + option_size);
+        }
+        return -1;
+    }
+
+    unsigned int hash = hash_name(name, length);
+    int mask = index->capacity - 1;
+    for(int slot = hash & mask; index->slots[slot] != -1; slot = (slot + 1) & mask) {
+        const struct OptionBase* option = (const struct OptionBase*)((const char*)options + index->slots[slot] * option_size);
+        if(option->name_hash == hash && option->name_length == length && memcmp(option->name, name, length) == 0)
+            return index->slots[slot];
     }
     return -1;
 }
 
-static int scan_for_alias(char alias, struct OptionBase* options, int option_size, int option_count) {
-    // Needs the size of the option struct so the the pointer can be incremented correctly.
-    // Without it, it would increment the memory address by the sizeof(OptionBase),
-    // which would be incorrect for Option.
-    for(int i = 0; i < option_count; i++) {
-        if(options->alias == alias)
+static int find_alias(const OptionParser* parser, unsigned char alias) {
+    if(parser->option_capacity != 0 || parser->snapshot != NULL)
+        return parser->alias_index[alias];
+
+    // Static tables don't have an alias index either.
+    for(int i = 0; i < parser->option_count; i++) {
+        if(parser->options[i].base.alias == alias)
             return i;
-        options = (struct OptionBase*)((char*)options + option_size);
     }
     return -1;
 }
 
-static bool option_encounter_is_valid(struct OptionBase* options) {
-    if(!check_flag(options->flags, OF_DUPLICATES_ALLOWED) && check_flag(options->flags, ___OF_ENCOUNTERED))
+static void name_index_insert(OptionNameIndex* index, struct OptionBase* option, int option_index) {
+    int mask = index->capacity - 1;
+    int slot = option->name_hash & mask;
+    while(index->slots[slot] != -1)
+        slot = (slot + 1) & mask;
+    index->slots[slot] = option_index;
+}
+
+static bool name_index_reserve(OptionParser* owner, OptionNameIndex* index, struct OptionBase* options, int option_size, int option_count) {
+    // Keeps the load factor at or below one half so probe sequences stay short.
+    if((option_count + 1) * 2 <= index->capacity)
+        return true;
+
+    int capacity = index->capacity == 0 ? 8 : index->capacity * 2;
+    int* slots = parser_allocate(owner, capacity * sizeof(int));
+    if(!slots)
         return false;
-    options->flags |= ___OF_ENCOUNTERED;
+
+    if(index->slots != NULL)
+        parser_release(owner, index->slots);
+    index->slots = slots;
+    index->capacity = capacity;
+    memset(slots, -1, capacity * sizeof(int));
+
+    for(int i = 0; i < option_count; i++) {
+        name_index_insert(index, options, i);
+        options = (struct OptionBase*)((char*)options + option_size);
+    }
     return true;
 }
 
-static struct OptionBase* verify_required_options(struct OptionBase* options, int option_size, int option_count) {
-    // Needs the size of the option struct so the the pointer can be incremented correctly.
-    // Without it, it would increment the memory address by the sizeof(OptionBase),
-    // which would be incorrect for Option.
-    for(int i = 0; i < option_count; i++) {
-        if((options->flags & (___OF_ENCOUNTERED | OF_REQUIRED)) == OF_REQUIRED)
-            return options;
-        else
-            options->flags &= ~___OF_ENCOUNTERED;
+// Returned by name lookups when a prefix belongs to more than one option.
+#define NAME_AMBIGUOUS -2
 
-        options = (struct OptionBase*)((char*)options + option_size);
+typedef struct NameTrieNode {
+    // The label of the edge leading to this node is the range [label_start, label_start + label_length) of this option's name.
+    int label_option;
+    int label_start;
+    int label_length;
+
+    // The first child of the node, or -1 if it's a leaf.
+    int first_child;
+
+    // The next child of the node's parent, or -1 if it's the last one.
+    int next_sibling;
+
+    // The option whose name ends at this node, or -1 if there isn't one.
+    int option;
+
+    // The only option whose name runs through this node, or NAME_AMBIGUOUS if there are several.
+    int unique;
+} NameTrieNode;
+
+static const struct OptionBase* option_base_at(const struct OptionBase* options, int option_size, int option_index) {
+    return (const struct OptionBase*)((const char*)options + option_index * option_size);
+}
+
+static const char* trie_label(const NameTrieNode* node, const struct OptionBase* options, int option_size) {
+    return option_base_at(options, option_size, node->label_option)->name + node->label_start;
+}
+
+static int trie_child(const OptionNameTrie* trie, int node, char character, const struct OptionBase* options, int option_size) {
+    // Siblings never share a first character, so at most one child can match.
+    for(int child = trie->nodes[node].first_child; child != -1; child = trie->nodes[child].next_sibling) {
+        if(trie_label(trie->nodes + child, options, option_size)[0] == character)
+            return child;
     }
-    return NULL;
+    return -1;
 }
 
-static void parse_sub_options(OptionSubParser* parser, char* parent_name, ParseResult* result, int* i, char** argv, int argc) {
-    while(*i + 1 < argc) {
-        char* option_string = argv[*i + 1];
-        int count = 0;
-        while(is_option_char(option_string[count]))
-            count++;
+static bool name_trie_reserve(OptionParser* owner, OptionNameTrie* trie) {
+    // An insertion adds at most a split node and a leaf, plus the root the first time.
+    if(trie->count + 3 <= trie->capacity)
+        return true;
 
-        if(count == 0) {
-            struct OptionBase* invalid = verify_required_options((struct OptionBase*)parser->options, sizeof(SubOption), parser->option_count);
-            if(invalid != NULL) {
-                result->error = PE_REQUIRED_MISSING;
-                snprintf(result->error_value, ERROR_BUFFER_SIZE, "%s.%s", parent_name, invalid->name);
-                return;
-            }
-            return;
-        }
+    int capacity = trie->capacity == 0 ? 8 : trie->capacity * 2;
+    NameTrieNode* nodes = trie->nodes == NULL
+        ? parser_allocate(owner, capacity * sizeof(NameTrieNode))
+        : parser_reallocate(owner, trie->nodes, trie->capacity * sizeof(NameTrieNode), capacity * sizeof(NameTrieNode));
+    if(!nodes)
+        return false;
 
-        int option_index = scan_for_name(option_string, (struct OptionBase*)parser->options, sizeof(SubOption), parser->option_count);
-        if(option_index == -1) {
-            struct OptionBase* invalid = verify_required_options((struct OptionBase*)parser->options, sizeof(SubOption), parser->option_count);
-            if(invalid != NULL) {
-                result->error = PE_REQUIRED_MISSING;
-                snprintf(result->error_value, ERROR_BUFFER_SIZE, "%s.%s", parent_name, invalid->name);
-                return;
-            }
+    trie->nodes = nodes;
+    trie->capacity = capacity;
+    return true;
+}
+
+static int name_trie_node(OptionNameTrie* trie, int label_option, int label_start, int label_length) {
+    NameTrieNode* node = trie->nodes + trie->count;
+    node->label_option = label_option;
+    node->label_start = label_start;
+    node->label_length = label_length;
+    node->first_child = -1;
+    node->next_sibling = -1;
+    node->option = -1;
+    node->unique = -1;
+    return trie->count++;
+}
+
+// Adds a name to the trie. Space must have been reserved with 'name_trie_reserve'.
+static void name_trie_insert(OptionNameTrie* trie, const struct OptionBase* options, int option_size, int option_index) {
+    const struct OptionBase* option = option_base_at(options, option_size, option_index);
+    if(trie->count == 0)
+        name_trie_node(trie, option_index, 0, 0);
+
+    int node = 0;
+    int position = 0;
+    while(true) {
+        NameTrieNode* current = trie->nodes + node;
+        current->unique = current->unique == -1 ? option_index : NAME_AMBIGUOUS;
+        if(position == option->name_length) {
+            current->option = option_index;
             return;
         }
-        (*i)++;
-        SubOption* option = parser->options + option_index;
-        if(!option_encounter_is_valid((struct OptionBase*)option)) {
-            result->error = PE_DUPLICATE;
-            snprintf(result->error_value, ERROR_BUFFER_SIZE, "%s.%s", parent_name, option->base.name);
+
+        int child = trie_child(trie, node, option->name[position], options, option_size);
+        if(child == -1) {
+            int leaf = name_trie_node(trie, option_index, position, option->name_length - position);
+            trie->nodes[leaf].option = option_index;
+            trie->nodes[leaf].unique = option_index;
+            trie->nodes[leaf].next_sibling = trie->nodes[node].first_child;
+            trie->nodes[node].first_child = leaf;
             return;
         }
 
-        switch(option_string[count]) {
-            case '\0':
-                if(check_flag(option->base.flags, OF_VALUE_REQUIRED)) {
-                    result->error = PE_VALUE_MISSING;
-                    snprintf(result->error_value, ERROR_BUFFER_SIZE, "%s.%s", parent_name, option->base.name);
-                    return;
-                }
-                parser->handler(option->base.name, option->base.alias, NULL, parser->data);
-                break;
-            case '=':
-                if(check_flag(option->base.flags, OF_VALUE_NOT_ALLOWED)) {
-                    result->error = PE_VALUE_GIVEN;
-                    snprintf(result->error_value, ERROR_BUFFER_SIZE, "%s.%s", parent_name, option->base.name);
-                    return;
-                }
-                int length = strlen(option_string + count + 1);
-                if(length == 0) {
-                    result->error = PE_VALUE_INVALID;
-                    snprintf(result->error_value, ERROR_BUFFER_SIZE, "%s.%s", parent_name, option->base.name);
-                    return;
-                }
-                parser->handler(option->base.name, option->base.alias, option_string + count + 1, parser->data);
-                break;
-            default:
-                result->error = PE_INVALID_NAME_TOKEN;
-                snprintf(result->error_value, ERROR_BUFFER_SIZE, "%s.%s", parent_name,  option_string);
-                return;
+        NameTrieNode* next = trie->nodes + child;
+        const char* label = trie_label(next, options, option_size);
+        int limit = next->label_length < option->name_length - position ? next->label_length : option->name_length - position;
+        int shared = 1;
+        while(shared < limit && label[shared] == option->name[position + shared])
+            shared++;
+
+        if(shared < next->label_length) {
+            // The name leaves the edge part way through, so the edge is split at that point.
+            int rest = name_trie_node(trie, next->label_option, next->label_start + shared, next->label_length - shared);
+            next = trie->nodes + child;
+            trie->nodes[rest].first_child = next->first_child;
+            trie->nodes[rest].option = next->option;
+            trie->nodes[rest].unique = next->unique;
+            next->label_length = shared;
+            next->first_child = rest;
+            next->option = -1;
         }
-    }
 
-    struct OptionBase* final = verify_required_options((struct OptionBase*)parser->options, sizeof(SubOption), parser->option_count);
-    if(final != NULL) {
-        result->error = PE_REQUIRED_MISSING;
-        snprintf(result->error_value, ERROR_BUFFER_SIZE, "%s.%s", parent_name, final->name);
-        return;
+        node = child;
+        position += shared;
     }
 }
 
-static void parse_name(OptionParser* parser, ParseResult* result, char* option_string, int start_index, int* i, char** argv, int argc) {
-    int count = 0;
-    while(is_option_char(option_string[start_index + count]))
-        count++;
+// Finds the node that a prefix leads to.
+// @arg exact: Set to whether the prefix ends exactly at the node rather than part way along the edge leading to it.
+// @return: The index of the node, or -1 if no name starts with the prefix.
+static int trie_walk(const OptionNameTrie* trie, const char* name, int length, const struct OptionBase* options, int option_size, bool* exact) {
+    int node = 0;
+    int position = 0;
+    *exact = true;
+    while(position < length) {
+        int child = trie_child(trie, node, name[position], options, option_size);
+        if(child == -1)
+            return -1;
 
-    int option_index = scan_for_name(option_string + start_index, (struct OptionBase*)parser->options, sizeof(Option), parser->option_count);
-
-    if(option_index == -1 && count == 1 && check_flag(parser->flags, PF_ALWAYS_CHECK_FOR_ALIAS))
-        option_index = scan_for_alias(option_string[start_index], (struct OptionBase*)parser->options, sizeof(Option), parser->option_count);
+        const NameTrieNode* next = trie->nodes + child;
+        const char* label = trie_label(next, options, option_size);
+        int limit = next->label_length < length - position ? next->label_length : length - position;
+        if(memcmp(label + 1, name + position + 1, limit - 1) != 0)
+            return -1;
 
-    if(option_index == -1) {
-        result->error = PE_INVALID_NAME;
-        snprintf(result->error_value, ERROR_BUFFER_SIZE, "%s", option_string + start_index);
-        return;
+        *exact = limit == next->label_length;
+        node = child;
+        position += limit;
     }
+    return node;
+}
 
-    Option* option = parser->options + option_index;
-    if(!option_encounter_is_valid((struct OptionBase*)option)) {
-        result->error = PE_DUPLICATE;
-        snprintf(result->error_value, ERROR_BUFFER_SIZE, "%s", option->base.name);
-        return;
+// Finds the option that a name or a prefix of a name belongs to. Exact names win over longer names that start with them.
+// @return: The option index, -1 if no name starts with the prefix, or NAME_AMBIGUOUS if more than one does.
+static int find_prefix(const char* name, int length, const OptionNameTrie* trie, const struct OptionBase* options, int option_size, int option_count) {
+    if(trie->count == 0) {
+        // Static tables don't have a trie, so they're searched directly.
+        int found = -1;
+        for(int i = 0; i < option_count; i++) {
+            const struct OptionBase* option = option_base_at(options, option_size, i);
+            if(option->name_length < length || memcmp(option->name, name, length) != 0)
+                continue;
+            if(option->name_length == length)
+                return i;
+            found = found == -1 ? i : NAME_AMBIGUOUS;
+        }
+        return found;
     }
 
-    switch(option_string[start_index + count]) {
-        case '\0':
-            if(check_flag(option->base.flags, OF_VALUE_REQUIRED)) {
-                result->error = PE_VALUE_MISSING;
-                snprintf(result->error_value, ERROR_BUFFER_SIZE, "%s", option->base.name);
-                return;
-            }
-            parser->handler(option->base.name, option->base.alias, NULL, parser->data);
-            break;
-        case '=':
-            if(check_flag(option->base.flags, OF_VALUE_NOT_ALLOWED)) {
-                result->error = PE_VALUE_GIVEN;
-                snprintf(result->error_value, ERROR_BUFFER_SIZE, "%s", option->base.name);
-                return;
-            }
-            start_index += count + 1;
-            int length = strlen(option_string + start_index);
-            if(length == 0) {
-                result->error = PE_VALUE_INVALID;
-                snprintf(result->error_value, ERROR_BUFFER_SIZE, "%s", option->base.name);
-                return;
-            }
-            parser->handler(option->base.name, option->base.alias, option_string + start_index, parser->data);
-            break;
-        default:
-            result->error = PE_INVALID_NAME_TOKEN;
-            snprintf(result->error_value, ERROR_BUFFER_SIZE, "%s", option_string + start_index);
-            return;
-    }
+    bool exact;
+    int node = trie_walk(trie, name, length, options, option_size, &exact);
+    if(node == -1)
+        return -1;
 
-    if(option->sub_options != NULL)
-        parse_sub_options(option->sub_options, option->base.name, result, i, argv, argc);
+    const NameTrieNode* found = trie->nodes + node;
+    if(exact && found->option != -1)
+        return found->option;
+    return found->unique;
 }
 
-static void parse_alias(OptionParser* parser, ParseResult* result, char* option_string, int start_index, int* i, char** argv, int argc) {
-    int count = 0;
-    while(isalnum(option_string[start_index + count])) {
-        int option_index = scan_for_alias(option_string[start_index + count], (struct OptionBase*)parser->options, sizeof(Option), parser->option_count);
-        if(option_index == -1) {
-            result->error = PE_INVALID_ALIAS;
-            sprintf(result->error_value, "%c", option_string[start_index + count]);
-            return;
-        }
+static bool is_alias_char(int alias) {
+    // Zero can never be typed as an alias, so it's left free to mean "no alias".
+    return alias > 0 && alias < 256;
+}
 
-        Option* option = parser->options + option_index;
+static void option_base_init(struct OptionBase* base, char* option_name, int alias, OptionFlags flags, char* doc_string, int name_length, unsigned int name_hash) {
+    base->name = option_name;
+    base->alias = alias;
+    base->name_length = name_length;
+    base->name_hash = name_hash;
+    base->flags = flags;
+    base->doc_string = doc_string;
+    base->type = OT_STRING;
+    base->binding = OB_NONE;
+}
 
-        if (!option_encounter_is_valid((struct OptionBase*)option)) {
+static OptionFlags typed_option_flags(OptionType type, OptionFlags flags) {
+    // Only booleans have a sensible meaning without a value.
+    if(type != OT_STRING && type != OT_BOOL)
+        flags |= OF_VALUE_REQUIRED;
+    return flags;
+}
+
+Option* oparser_add_option(OptionParser* parser, char* option_name, int alias, OptionFlags flags, char* doc_string) {
+    // Static tables can't grow.
+    if(parser->option_capacity == 0 || !verify_flags(flags))
+        return NULL;
+
+    int name_length = strlen(option_name);
+    if(find_name(option_name, name_length, &parser->name_index, (struct OptionBase*)parser->options, sizeof(Option), parser->option_count) != -1)
+        return NULL;
+
+    if(is_alias_char(alias) && parser->alias_index[alias] != -1)
+        return NULL;
+
+    if(parser->option_count == parser->option_capacity) {
+        Option* options = parser_reallocate(parser, parser->options, parser->option_capacity * sizeof(Option), parser->option_capacity * 2 * sizeof(Option));
+        if(!options)
+            return NULL;
+        parser->options = options;
+        parser->option_capacity *= 2;
+    }
+
+    if(!name_index_reserve(parser, &parser->name_index, (struct OptionBase*)parser->options, sizeof(Option), parser->option_count))
+        return NULL;
+
+    if(!name_trie_reserve(parser, &parser->name_trie))
+        return NULL;
+
+    Option* option = parser->options + parser->option_count;
+    option->sub_options = NULL;
+    option->parser = parser;
+    option->help = NULL;
+    option->help_version = 0;
+
+    struct OptionBase* base = (struct OptionBase*)option;
+    option_base_init(base, option_name, alias, flags, doc_string, name_length, hash_name(option_name, name_length));
+    name_index_insert(&parser->name_index, base, parser->option_count);
+    name_trie_insert(&parser->name_trie, (struct OptionBase*)parser->options, sizeof(Option), parser->option_count);
+    if(is_alias_char(alias))
+        parser->alias_index[alias] = parser->option_count;
+    parser->option_count++;
+    parser->schema_version++;
+
+    return option;
+}
+
+OptionSubParser* osubparser_init(Option* option, OptionHandler handler, ParserFlags flags, void* data) {
+    // Options in static tables don't know their parser, and can't be modified anyway.
+    if(option->parser == NULL)
+        return NULL;
+
+    OptionSubParser* parser = parser_allocate(option->parser, sizeof(OptionSubParser));
+    if(!parser)
+        return NULL;
+    parser->options = parser_allocate(option->parser, sizeof(SubOption) * 2);
+    if(!parser->options){
+        parser_release(option->parser, parser);
+        return NULL;
+    }
+    parser->parent = option->parser;
+    parser->option_capacity = 2;
+    parser->option_count = 0;
+    parser->name_index.slots = NULL;
+    parser->name_index.capacity = 0;
+    parser->name_trie.nodes = NULL;
+    parser->name_trie.count = 0;
+    parser->name_trie.capacity = 0;
+    parser->handler = handler;
+    parser->value_handler = NULL;
+    parser->list_handler = NULL;
+    parser->flags = flags;
+    parser->data = data;
+    option->sub_options = parser;
+    return parser;
+}
+
+SubOption* osubparser_add_option(OptionSubParser* parser, char* option_name, int alias, OptionFlags flags, char* doc_string) {
+    if(parser->option_capacity == 0 || !verify_flags(flags))
+        return NULL;
+
+    int name_length = strlen(option_name);
+    if(find_name(option_name, name_length, &parser->name_index, (struct OptionBase*)parser->options, sizeof(SubOption), parser->option_count) != -1)
+        return NULL;
+
+    if(parser->option_count == parser->option_capacity) {
+        SubOption* options = parser_reallocate(parser->parent, parser->options, parser->option_capacity * sizeof(SubOption), parser->option_capacity * 2 * sizeof(SubOption));
+        if(!options)
+            return NULL;
+        parser->options = options;
+        parser->option_capacity *= 2;
+    }
+
+    if(!name_index_reserve(parser->parent, &parser->name_index, (struct OptionBase*)parser->options, sizeof(SubOption), parser->option_count))
+        return NULL;
+
+    if(!name_trie_reserve(parser->parent, &parser->name_trie))
+        return NULL;
+
+    SubOption* option = parser->options + parser->option_count;
+
+    struct OptionBase* base = (struct OptionBase*)option;
+    option_base_init(base, option_name, alias, flags, doc_string, name_length, hash_name(option_name, name_length));
+    name_index_insert(&parser->name_index, base, parser->option_count);
+    name_trie_insert(&parser->name_trie, (struct OptionBase*)parser->options, sizeof(SubOption), parser->option_count);
+    parser->option_count++;
+    parser->parent->schema_version++;
+
+    return option;
+}
+
+Option* oparser_add_typed_option(OptionParser* parser, char* option_name, int alias, OptionType type, OptionFlags flags, char* doc_string) {
+    Option* option = oparser_add_option(parser, option_name, alias, typed_option_flags(type, flags), doc_string);
+    if(option != NULL)
+        option->base.type = type;
+    return option;
+}
+
+Option* oparser_add_int_option(OptionParser* parser, char* option_name, int alias, OptionFlags flags, char* doc_string) {
+    return oparser_add_typed_option(parser, option_name, alias, OT_INT, flags, doc_string);
+}
+
+Option* oparser_add_double_option(OptionParser* parser, char* option_name, int alias, OptionFlags flags, char* doc_string) {
+    return oparser_add_typed_option(parser, option_name, alias, OT_DOUBLE, flags, doc_string);
+}
+
+Option* oparser_add_bool_option(OptionParser* parser, char* option_name, int alias, OptionFlags flags, char* doc_string) {
+    return oparser_add_typed_option(parser, option_name, alias, OT_BOOL, flags, doc_string);
+}
+
+Option* oparser_add_size_option(OptionParser* parser, char* option_name, int alias, OptionFlags flags, char* doc_string) {
+    return oparser_add_typed_option(parser, option_name, alias, OT_SIZE, flags, doc_string);
+}
+
+Option* oparser_add_duration_option(OptionParser* parser, char* option_name, int alias, OptionFlags flags, char* doc_string) {
+    return oparser_add_typed_option(parser, option_name, alias, OT_DURATION, flags, doc_string);
+}
+
+SubOption* osubparser_add_typed_option(OptionSubParser* parser, char* option_name, int alias, OptionType type, OptionFlags flags, char* doc_string) {
+    SubOption* option = osubparser_add_option(parser, option_name, alias, typed_option_flags(type, flags), doc_string);
+    if(option != NULL)
+        option->base.type = type;
+    return option;
+}
+
+void oparser_bind_option(Option* option, void* address) {
+    option->base.binding = OB_ADDRESS;
+    option->base.destination.address = address;
+}
+
+void oparser_bind_option_offset(Option* option, size_t offset) {
+    option->base.binding = OB_OFFSET;
+    option->base.destination.offset = offset;
+}
+
+void osubparser_bind_option(SubOption* option, void* address) {
+    option->base.binding = OB_ADDRESS;
+    option->base.destination.address = address;
+}
+
+void osubparser_bind_option_offset(SubOption* option, size_t offset) {
+    option->base.binding = OB_OFFSET;
+    option->base.destination.offset = offset;
+}
+
+bool oparser_set_option_environment(Option* option, char* variable) {
+    OptionParser* parser = option->parser;
+    if(parser == NULL)
+        return false;
+
+    int length = strlen(variable);
+    if(find_name(variable, length, &parser->environment_index, (struct OptionBase*)parser->environment, sizeof(struct OptionEnvironment), parser->environment_count) != -1)
+        return false;
+
+    if(parser->environment_count == parser->environment_capacity) {
+        int capacity = parser->environment_capacity == 0 ? 2 : parser->environment_capacity * 2;
+        struct OptionEnvironment* environment = parser->environment == NULL
+            ? parser_allocate(parser, capacity * sizeof(struct OptionEnvironment))
+            : parser_reallocate(parser, parser->environment, parser->environment_capacity * sizeof(struct OptionEnvironment), capacity * sizeof(struct OptionEnvironment));
+        if(!environment)
+            return false;
+        parser->environment = environment;
+        parser->environment_capacity = capacity;
+    }
+
+    if(!name_index_reserve(parser, &parser->environment_index, (struct OptionBase*)parser->environment, sizeof(struct OptionEnvironment), parser->environment_count))
+        return false;
+
+    struct OptionEnvironment* environment = parser->environment + parser->environment_count;
+    option_base_init(&environment->base, variable, 0, OF_NONE, NULL, length, hash_name(variable, length));
+    environment->option = option - parser->options;
+    name_index_insert(&parser->environment_index, &environment->base, parser->environment_count++);
+    return true;
+}
+
+bool oparser_add_config_file(OptionParser* parser, char* path) {
+    if(parser->option_capacity == 0)
+        return false;
+
+    if(parser->config_file_count == parser->config_file_capacity) {
+        int capacity = parser->config_file_capacity == 0 ? 2 : parser->config_file_capacity * 2;
+        char** files = parser->config_files == NULL
+            ? parser_allocate(parser, capacity * sizeof(char*))
+            : parser_reallocate(parser, parser->config_files, parser->config_file_capacity * sizeof(char*), capacity * sizeof(char*));
+        if(!files)
+            return false;
+        parser->config_files = files;
+        parser->config_file_capacity = capacity;
+    }
+    parser->config_files[parser->config_file_count++] = path;
+    return true;
+}
+
+bool oparser_add_subcommand(OptionParser* parser, char* name, SubcommandBuilder builder, void* data, char* doc_string) {
+    if(parser->option_capacity == 0)
+        return false;
+
+    int name_length = strlen(name);
+    if(find_name(name, name_length, &parser->subcommand_index, (struct OptionBase*)parser->subcommands, sizeof(struct Subcommand), parser->subcommand_count) != -1)
+        return false;
+
+    if(parser->subcommand_count == parser->subcommand_capacity) {
+        int capacity = parser->subcommand_capacity == 0 ? 2 : parser->subcommand_capacity * 2;
+        struct Subcommand* subcommands = parser->subcommands == NULL
+            ? parser_allocate(parser, capacity * sizeof(struct Subcommand))
+            : parser_reallocate(parser, parser->subcommands, parser->subcommand_capacity * sizeof(struct Subcommand), capacity * sizeof(struct Subcommand));
+        if(!subcommands)
+            return false;
+        parser->subcommands = subcommands;
+        parser->subcommand_capacity = capacity;
+    }
+
+    if(!name_index_reserve(parser, &parser->subcommand_index, (struct OptionBase*)parser->subcommands, sizeof(struct Subcommand), parser->subcommand_count))
+        return false;
+
+    struct Subcommand* subcommand = parser->subcommands + parser->subcommand_count;
+    option_base_init(&subcommand->base, name, 0, OF_NONE, doc_string, name_length, hash_name(name, name_length));
+    subcommand->builder = builder;
+    subcommand->data = data;
+    atomic_parser_init(&subcommand->parser, NULL);
+    name_index_insert(&parser->subcommand_index, &subcommand->base, parser->subcommand_count++);
+    return true;
+}
+
+static int encountered_words(int option_count) {
+    return (option_count + ENCOUNTERED_BITS - 1) / ENCOUNTERED_BITS;
+}
+
+static void out_of_memory(ParseResult* result) {
+    result->error = PE_OUT_OF_MEMORY;
+    result->error_value[0] = '\0';
+}
+
+// Marks the part of the token being parsed that caused the current error, so that a collected error can point at it.
+static void mark_error_span(ParseResult* result, const char* start, int length) {
+    result->error_span = start;
+    result->error_span_length = length;
+}
+
+static bool result_buffer_grow(ParseResult* result, void** buffer, void* inline_buffer, int* capacity, int required, int element_size) {
+    // Buffers start out pointing at storage inside of the result, which can't be passed to realloc.
+    int new_capacity = *capacity * 2;
+    if(new_capacity < required)
+        new_capacity = required;
+
+    void* grown;
+    if(*buffer == inline_buffer) {
+        grown = malloc(new_capacity * element_size);
+        if(grown)
+            memcpy(grown, inline_buffer, *capacity * element_size);
+    } else {
+        grown = realloc(*buffer, new_capacity * element_size);
+    }
+
+    if(!grown) {
+        out_of_memory(result);
+        return false;
+    }
+    *buffer = grown;
+    *capacity = new_capacity;
+    return true;
+}
+
+static bool encountered_reserve(ParseResult* result, int words) {
+    if(words <= result->encountered_capacity)
+        return true;
+
+    return result_buffer_grow(result, (void**)&result->encountered, result->encountered_buffer, &result->encountered_capacity, words, sizeof(unsigned int));
+}
+
+static char* scratch_alloc(ParseResult* result, int size) {
+    // Blocks are never moved, so strings handed out by the arena stay valid until the result is reused.
+    struct ScratchBlock* block = result->scratch;
+    if(block == NULL || block->size - block->used < size) {
+        int block_size = size > SCRATCH_BLOCK_SIZE ? size : SCRATCH_BLOCK_SIZE;
+        struct ScratchBlock* next = malloc(sizeof(struct ScratchBlock) + block_size);
+        if(!next) {
+            out_of_memory(result);
+            return NULL;
+        }
+        next->next = block;
+        next->size = block_size;
+        next->used = 0;
+        result->scratch = block = next;
+    }
+    char* memory = block->data + block->used;
+    block->used += size;
+    return memory;
+}
+
+static void scratch_reset(ParseResult* result) {
+    // Keeps the newest block around so that the next parse can use it without allocating.
+    struct ScratchBlock* block = result->scratch;
+    if(block == NULL)
+        return;
+
+    struct ScratchBlock* next = block->next;
+    while(next != NULL) {
+        struct ScratchBlock* old = next;
+        next = next->next;
+        free(old);
+    }
+    block->next = NULL;
+    block->used = 0;
+}
+
+static char* token_string(ParseResult* result, const Token* token) {
+    if(token->terminated)
+        return token->start;
+
+    char* copy = scratch_alloc(result, token->length + 1);
+    if(!copy)
+        return NULL;
+    memcpy(copy, token->start, token->length);
+    copy[token->length] = '\0';
+    return copy;
+}
+
+static bool convert_integer(const char* text, int length, long long* value) {
+    int index = 0;
+    bool negative = false;
+    if(index < length && (text[index] == '-' || text[index] == '+'))
+        negative = text[index++] == '-';
+    if(index == length)
+        return false;
+
+    unsigned long long limit = negative ? (unsigned long long)LLONG_MAX + 1 : (unsigned long long)LLONG_MAX;
+    unsigned long long total = 0;
+    for(; index < length; index++) {
+        unsigned int digit = (unsigned char)text[index] - '0';
+        if(digit > 9 || total > (limit - digit) / 10)
+            return false;
+        total = total * 10 + digit;
+    }
+
+    if(negative)
+        *value = total == limit ? LLONG_MIN : -(long long)total;
+    else
+        *value = (long long)total;
+    return true;
+}
+
+// Numbers are always written with a '.', whatever the locale of the program is, so strtod is given the "C" locale.
+#ifdef _WIN32
+static _locale_t c_locale(void) {
+    static _locale_t volatile cached = NULL;
+    _locale_t locale = InterlockedCompareExchangePointer((PVOID volatile*)&cached, NULL, NULL);
+    if(locale == NULL) {
+        locale = _create_locale(LC_ALL, "C");
+        if(!locale)
+            return NULL;
+
+        _locale_t existing = InterlockedCompareExchangePointer((PVOID volatile*)&cached, locale, NULL);
+        if(existing != NULL) {
+            _free_locale(locale);
+            locale = existing;
+        }
+    }
+    return locale;
+}
+
+static bool strtod_c(const char* text, double* value) {
+    _locale_t locale = c_locale();
+    if(!locale)
+        return false;
+    *value = _strtod_l(text, NULL, locale);
+    return true;
+}
+#else
+static locale_t cached_c_locale = (locale_t)0;
+
+static void create_c_locale(void) {
+    cached_c_locale = newlocale(LC_ALL_MASK, "C", (locale_t)0);
+}
+
+static bool strtod_c(const char* text, double* value) {
+    static pthread_once_t once = PTHREAD_ONCE_INIT;
+    pthread_once(&once, create_c_locale);
+    if(cached_c_locale == (locale_t)0)
+        return false;
+
+    // The locale is only changed for the calling thread.
+    locale_t previous = uselocale(cached_c_locale);
+    *value = strtod(text, NULL);
+    uselocale(previous);
+    return true;
+}
+#endif
+
+static bool convert_double(ParseResult* result, const Token* token, double* value) {
+    const char* text = token->start;
+    int length = token->length;
+
+    // Powers of ten that are exactly representable as a double.
+    static const double powers[] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+    };
+
+    int index = 0;
+    bool negative = false;
+    if(index < length && (text[index] == '-' || text[index] == '+'))
+        negative = text[index++] == '-';
+
+    unsigned long long mantissa = 0;
+    int exponent = 0;
+    int digits = 0;
+    bool truncated = false;
+    for(; index < length && isdigit((unsigned char)text[index]); index++, digits++) {
+        if(mantissa < 100000000000000000ull)
+            mantissa = mantissa * 10 + (text[index] - '0');
+        else {
+            truncated |= text[index] != '0';
+            exponent++;
+        }
+    }
+    if(index < length && text[index] == '.') {
+        for(index++; index < length && isdigit((unsigned char)text[index]); index++, digits++) {
+            if(mantissa < 100000000000000000ull) {
+                mantissa = mantissa * 10 + (text[index] - '0');
+                exponent--;
+            } else {
+                truncated |= text[index] != '0';
+            }
+        }
+    }
+    if(digits == 0)
+        return false;
+
+    if(index < length && (text[index] == 'e' || text[index] == 'E')) {
+        index++;
+        bool negative_exponent = false;
+        if(index < length && (text[index] == '-' || text[index] == '+'))
+            negative_exponent = text[index++] == '-';
+        if(index == length)
+            return false;
+
+        int written = 0;
+        for(; index < length && isdigit((unsigned char)text[index]); index++) {
+            if(written < 100000)
+                written = written * 10 + (text[index] - '0');
+        }
+        exponent += negative_exponent ? -written : written;
+    }
+    if(index != length)
+        return false;
+
+    // Small mantissas with small exponents can be converted exactly with a single multiplication or division.
+    if(!truncated && mantissa <= (1ull << 53) && exponent >= -22 && exponent <= 22) {
+        double result = (double)mantissa;
+        result = exponent < 0 ? result / powers[-exponent] : result * powers[exponent];
+        *value = negative ? -result : result;
+        return true;
+    }
+
+    // Everything else needs correct rounding, so it's left to strtod. The text has already been validated,
+    // so it only needs to be terminated.
+    char* copy = token_string(result, token);
+    if(!copy)
+        return false;
+    if(!strtod_c(copy, value)) {
+        out_of_memory(result);
+        return false;
+    }
+
+    // The text can't be infinite, so an infinite value means it overflowed, which integers don't allow either.
+    return !isinf(*value);
+}
+
+static bool text_equals(const char* text, int length, const char* word) {
+    int index = 0;
+    for(; index < length && word[index] != '\0'; index++) {
+        if(tolower((unsigned char)text[index]) != word[index])
+            return false;
+    }
+    return index == length && word[index] == '\0';
+}
+
+static bool convert_bool(const char* text, int length, bool* value) {
+    static const char* true_words[] = { "true", "yes", "on", "1" };
+    static const char* false_words[] = { "false", "no", "off", "0" };
+    for(int i = 0; i < 4; i++) {
+        if(text_equals(text, length, true_words[i])) {
+            *value = true;
+            return true;
+        }
+        if(text_equals(text, length, false_words[i])) {
+            *value = false;
+            return true;
+        }
+    }
+    return false;
+}
+
+static int read_digits(const char* text, int length, int index, unsigned long long* value) {
+    // Returns the index after the digits, or -1 if there weren't any or they overflowed.
+    int start = index;
+    unsigned long long total = 0;
+    for(; index < length && isdigit((unsigned char)text[index]); index++) {
+        unsigned int digit = text[index] - '0';
+        if(total > (ULLONG_MAX - digit) / 10)
+            return -1;
+        total = total * 10 + digit;
+    }
+    *value = total;
+    return index == start ? -1 : index;
+}
+
+static bool convert_size(const char* text, int length, unsigned long long* value) {
+    unsigned long long count;
+    int index = read_digits(text, length, 0, &count);
+    if(index == -1)
+        return false;
+
+    int shift = 0;
+    if(index < length) {
+        switch(text[index]) {
+            case 'k': case 'K': shift = 10; break;
+            case 'm': case 'M': shift = 20; break;
+            case 'g': case 'G': shift = 30; break;
+            case 't': case 'T': shift = 40; break;
+            default: break;
+        }
+        if(shift != 0)
+            index++;
+    }
+
+    if(index < length) {
+        if(shift != 0 && index + 2 == length && text[index] == 'i' && text[index + 1] == 'B')
+            index += 2;
+        else if(index + 1 == length && text[index] == 'B')
+            index++;
+        else
+            return false;
+    }
+
+    if(count > ULLONG_MAX >> shift)
+        return false;
+    *value = count << shift;
+    return true;
+}
+
+static bool convert_duration(const char* text, int length, long long* value) {
+    static const struct { const char* name; long long nanoseconds; } units[] = {
+        { "ns", 1LL },
+        { "us", 1000LL },
+        { "ms", 1000000LL },
+        { "s", 1000000000LL },
+        { "m", 60000000000LL },
+        { "h", 3600000000000LL }
+    };
+
+    long long total = 0;
+    int index = 0;
+    int components = 0;
+    while(index < length) {
+        unsigned long long whole;
+        index = read_digits(text, length, index, &whole);
+        if(index == -1)
+            return false;
+
+        double fraction = 0;
+        if(index < length && text[index] == '.') {
+            double scale = 0.1;
+            int start = ++index;
+            for(; index < length && isdigit((unsigned char)text[index]); index++, scale /= 10)
+                fraction += (text[index] - '0') * scale;
+            if(index == start)
+                return false;
+        }
+
+        int unit_start = index;
+        while(index < length && isalpha((unsigned char)text[index]))
+            index++;
+
+        long long unit = -1;
+        if(unit_start == index) {
+            // A lone number without a unit is taken to be in seconds.
+            if(components > 0 || index != length)
+                return false;
+            unit = 1000000000LL;
+        } else {
+            for(int i = 0; i < (int)(sizeof(units) / sizeof(units[0])); i++) {
+                if(text_equals(text + unit_start, index - unit_start, units[i].name)) {
+                    unit = units[i].nanoseconds;
+                    break;
+                }
+            }
+            if(unit == -1)
+                return false;
+        }
+
+        // The fraction is less than one unit, but it can still push the whole part past the limit.
+        long long part = (long long)(fraction * unit);
+        if(whole > (unsigned long long)((LLONG_MAX - total) / unit))
+            return false;
+        long long amount = (long long)whole * unit;
+        if(part > LLONG_MAX - total - amount)
+            return false;
+        total += amount + part;
+        components++;
+    }
+
+    if(components == 0)
+        return false;
+    *value = total;
+    return true;
+}
+
+static bool convert_value(ParseResult* result, const char* parent_name, const struct OptionBase* option, const Token* value, OptionValue* converted) {
+    converted->type = option->type;
+    if(value == NULL) {
+        // Booleans are the only typed options that can be given without a value.
+        if(option->type == OT_BOOL)
+            converted->boolean = true;
+        return true;
+    }
+
+    bool valid = true;
+    switch(option->type) {
+        case OT_INT:
+            valid = convert_integer(value->start, value->length, &converted->integer);
+            break;
+        case OT_DOUBLE:
+            valid = convert_double(result, value, &converted->number);
+            break;
+        case OT_BOOL:
+            valid = convert_bool(value->start, value->length, &converted->boolean);
+            break;
+        case OT_SIZE:
+            valid = convert_size(value->start, value->length, &converted->size);
+            break;
+        case OT_DURATION:
+            valid = convert_duration(value->start, value->length, &converted->duration);
+            break;
+        default:
+            break;
+    }
+
+    // Conversions can run out of memory, which is reported instead.
+    if(!valid && result->error != PE_OUT_OF_MEMORY) {
+        result->error = PE_VALUE_CONVERSION;
+        mark_error_span(result, value->start, value->length);
+        if(parent_name != NULL)
+            snprintf(result->error_value, ERROR_BUFFER_SIZE, "%s.%s=%.*s", parent_name, option->name, value->length, value->start);
+        else
+            snprintf(result->error_value, ERROR_BUFFER_SIZE, "%s=%.*s", option->name, value->length, value->start);
+    }
+    return valid;
+}
+
+static void store_value(ParseResult* result, void* data, const struct OptionBase* option, const Token* value, const OptionValue* converted) {
+    char* destination;
+    if(option->binding == OB_ADDRESS)
+        destination = option->destination.address;
+    else
+        destination = (char*)(result->target != NULL ? result->target : data) + option->destination.offset;
+
+    switch(option->type) {
+        case OT_STRING:
+            if(value != NULL) {
+                char* string = token_string(result, value);
+                if(string != NULL)
+                    memcpy(destination, &string, sizeof(char*));
+            }
+            break;
+        case OT_INT:
+            memcpy(destination, &converted->integer, sizeof(long long));
+            break;
+        case OT_DOUBLE:
+            memcpy(destination, &converted->number, sizeof(double));
+            break;
+        case OT_BOOL:
+            memcpy(destination, &converted->boolean, sizeof(bool));
+            break;
+        case OT_SIZE:
+            memcpy(destination, &converted->size, sizeof(unsigned long long));
+            break;
+        case OT_DURATION:
+            memcpy(destination, &converted->duration, sizeof(long long));
+            break;
+    }
+}
+
+static void log_handler_call(ParseResult* result, HandlerCall call) {
+    struct HandlerLog* log = result->handler_log;
+    if(log->count == log->capacity) {
+        int capacity = log->capacity == 0 ? 8 : log->capacity * 2;
+        HandlerCall* calls = realloc(log->calls, capacity * sizeof(HandlerCall));
+        if(!calls) {
+            out_of_memory(result);
+            return;
+        }
+        log->calls = calls;
+        log->capacity = capacity;
+    }
+    log->calls[log->count++] = call;
+}
+
+static bool collected_reserve(ParseResult* result, struct CollectedValues* collected) {
+    if(collected->count < collected->capacity)
+        return true;
+
+    // The three arrays always have the same capacity, so values can be grouped without checking for room.
+    int capacity = collected->capacity == 0 ? 16 : collected->capacity * 2;
+    OptionValue* values = realloc(collected->values, capacity * sizeof(OptionValue));
+    if(values)
+        collected->values = values;
+    OptionValue* grouped = realloc(collected->grouped, capacity * sizeof(OptionValue));
+    if(grouped)
+        collected->grouped = grouped;
+    int* value_groups = realloc(collected->value_groups, capacity * sizeof(int));
+    if(value_groups)
+        collected->value_groups = value_groups;
+    if(!values || !grouped || !value_groups) {
+        out_of_memory(result);
+        return false;
+    }
+    collected->capacity = capacity;
+    return true;
+}
+
+static int collected_group(ParseResult* result, struct CollectedValues* collected, OptionListHandler handler, void* data, const char* parent_name, const struct OptionBase* option) {
+    int group = collected->last_group;
+    if(group < collected->group_count && collected->groups[group].option == option)
+        return group;
+
+    for(group = 0; group < collected->group_count; group++) {
+        if(collected->groups[group].option == option)
+            return collected->last_group = group;
+    }
+
+    if(collected->group_count == collected->group_capacity) {
+        int capacity = collected->group_capacity == 0 ? 4 : collected->group_capacity * 2;
+        ValueGroup* groups = realloc(collected->groups, capacity * sizeof(ValueGroup));
+        if(!groups) {
+            out_of_memory(result);
+            return -1;
+        }
+        collected->groups = groups;
+        collected->group_capacity = capacity;
+    }
+    collected->groups[group] = (ValueGroup){ option, parent_name, handler, data, 0, 0 };
+    collected->group_count++;
+    return collected->last_group = group;
+}
+
+static void collect_value(ParseResult* result, OptionListHandler handler, void* data, const char* parent_name, const struct OptionBase* option, const Token* value, const OptionValue* span) {
+    struct CollectedValues* collected = result->collected;
+    if(collected == NULL) {
+        collected = calloc(1, sizeof(struct CollectedValues));
+        if(!collected) {
+            out_of_memory(result);
+            return;
+        }
+        result->collected = collected;
+    }
+
+    int group = collected_group(result, collected, handler, data, parent_name, option);
+    if(group == -1 || !collected_reserve(result, collected))
+        return;
+
+    OptionValue* slot = collected->values + collected->count;
+    *slot = *span;
+    slot->text = NULL;
+    slot->length = 0;
+    if(value != NULL) {
+        // Tokens that aren't terminated may not outlive the parse, like the ones given to 'oparser_feed', so they're copied.
+        slot->text = token_string(result, value);
+        if(!slot->text)
+            return;
+        slot->length = value->length;
+    }
+    collected->value_groups[collected->count] = group;
+    collected->count++;
+    collected->groups[group].count++;
+}
+
+static void finish_values(ParseResult* result) {
+    struct CollectedValues* collected = result->collected;
+    if(collected == NULL || collected->count == 0)
+        return;
+
+    // Values are moved next to the others of their option with a counting sort, which keeps them in the order they were given.
+    if(collected->group_count > 1) {
+        int start = 0;
+        for(int i = 0; i < collected->group_count; i++) {
+            collected->groups[i].start = start;
+            start += collected->groups[i].count;
+            collected->groups[i].count = 0;
+        }
+        for(int i = 0; i < collected->count; i++) {
+            ValueGroup* group = collected->groups + collected->value_groups[i];
+            collected->grouped[group->start + group->count++] = collected->values[i];
+        }
+        OptionValue* grouped = collected->values;
+        collected->values = collected->grouped;
+        collected->grouped = grouped;
+    }
+
+    if(result->error != PE_NONE)
+        return;
+
+    for(int i = 0; i < collected->group_count; i++) {
+        const ValueGroup* group = collected->groups + i;
+        if(group->handler == NULL)
+            continue;
+
+        const OptionValue* values = collected->values + group->start;
+        if(result->handler_log == NULL)
+            group->handler(group->option->name, group->option->alias, values, group->count, group->data);
+        else
+            log_handler_call(result, (HandlerCall){ .list_handler = group->handler, .name = group->option->name, .alias = group->option->alias, .values = values, .value_count = group->count, .data = group->data });
+    }
+}
+
+static void invoke_handler(ParseResult* result, OptionHandler handler, OptionValueHandler value_handler, OptionListHandler list_handler, void* data,
+                           const char* parent_name, const struct OptionBase* option, const Token* value) {
+    // Handlers that take a plain string need a null terminated value,
+    // but value handlers can be given the token directly.
+    OptionValue span = { .text = NULL, .length = 0 };
+    if(option->type != OT_STRING && !convert_value(result, parent_name, option, value, &span))
+        return;
+
+    // Collecting errors only checks the arguments, so nothing is handed to the program.
+    if(result->collect_errors)
+        return;
+
+    // Collected values are handed over together once the parse has finished.
+    if(check_flag(option->flags, OF_COLLECT_VALUES)) {
+        collect_value(result, list_handler, data, parent_name, option, value, &span);
+        return;
+    }
+
+    // Bound options are stored straight away without going through a handler.
+    if(option->binding != OB_NONE) {
+        store_value(result, data, option, value, &span);
+        return;
+    }
+    if(handler == NULL && value_handler == NULL)
+        return;
+
+    char* string = NULL;
+    if(value != NULL) {
+        if(value_handler != NULL) {
+            span.text = value->start;
+            span.length = value->length;
+        } else {
+            string = token_string(result, value);
+            if(!string)
+                return;
+        }
+    }
+    bool has_span = value != NULL || option->type == OT_BOOL;
+
+    if(result->handler_log == NULL) {
+        if(value_handler != NULL)
+            value_handler(option->name, option->alias, has_span ? &span : NULL, data);
+        else
+            handler(option->name, option->alias, string, data);
+        return;
+    }
+
+    log_handler_call(result, (HandlerCall){ .handler = value_handler != NULL ? NULL : handler, .value_handler = value_handler, .name = option->name, .alias = option->alias, .value = string, .span = span, .has_span = has_span, .data = data });
+}
+
+static bool option_encounter_is_valid(ParseResult* result, int bit, const struct OptionBase* option) {
+    unsigned int* word = result->encountered + bit / ENCOUNTERED_BITS;
+    unsigned int mask = 1u << (bit % ENCOUNTERED_BITS);
+    if(!check_flag(option->flags, OF_DUPLICATES_ALLOWED) && (*word & mask))
+        return false;
+    *word |= mask;
+    return true;
+}
+
+static bool encountered_bit(const ParseResult* result, int bit) {
+    return (result->encountered[bit / ENCOUNTERED_BITS] & (1u << (bit % ENCOUNTERED_BITS))) != 0;
+}
+
+static bool record_error(ParseResult* result, const Token* token, int argument) {
+    if(result->error_count == result->error_capacity) {
+        int capacity = result->error_capacity == 0 ? 8 : result->error_capacity * 2;
+        ParseErrorEntry* errors = realloc(result->errors, capacity * sizeof(ParseErrorEntry));
+        if(!errors) {
+            out_of_memory(result);
+            return false;
+        }
+        result->errors = errors;
+        result->error_capacity = capacity;
+    }
+
+    ParseError error = result->error;
+    int length = strlen(result->error_value);
+    char* value = scratch_alloc(result, length + 1);
+    if(!value)
+        return false;
+    memcpy(value, result->error_value, length + 1);
+
+    ParseErrorEntry* entry = result->errors + result->error_count++;
+    entry->error = error;
+    entry->argument = argument;
+    entry->start = 0;
+    entry->length = token != NULL ? token->length : 0;
+    entry->value = value;
+
+    // Errors that aren't about a part of the token cover all of it.
+    const char* span = result->error_span;
+    if(token != NULL && span != NULL && span >= token->start && span + result->error_span_length <= token->start + token->length) {
+        entry->start = span - token->start;
+        entry->length = result->error_span_length;
+    }
+    result->error_span = NULL;
+    return true;
+}
+
+// Records the current error if the parse is collecting errors.
+// @arg token: The token that caused the error, or NULL if it wasn't caused by one.
+// @return: true if the error was recorded and cleared so that the parse can carry on, otherwise false.
+static bool collect_error(ParseResult* result, const Token* token) {
+    // Errors that leave the input in an unknown state end the parse, and are recorded once it has finished.
+    ParseError error = result->error;
+    if(!result->collect_errors || error == PE_OUT_OF_MEMORY || error == PE_SUBCOMMAND_FAILED || error == PE_UNMATCHED_QUOTE)
+        return false;
+
+    if(!record_error(result, token, token != NULL ? result->argument : -1))
+        return false;
+    result->error = PE_NONE;
+    return true;
+}
+
+static void finish_errors(ParseResult* result) {
+    if(!result->collect_errors)
+        return;
+
+    // An error that ended the parse early hasn't been recorded yet.
+    if(result->error != PE_NONE)
+        record_error(result, NULL, result->argument);
+
+    // The first error is the one reported by the result itself.
+    if(result->error_count > 0) {
+        result->error = result->errors[0].error;
+        snprintf(result->error_value, ERROR_BUFFER_SIZE, "%s", result->errors[0].value);
+    }
+}
+
+// Reports the required options that weren't encountered, stopping at the first unless errors are being collected.
+// @return: true if no errors are left, otherwise false.
+static bool report_missing_options(ParseResult* result, int bit, const struct OptionBase* options, int option_size, int option_count, const char* parent_name) {
+    for(int i = 0; i < option_count; i++) {
+        const struct OptionBase* option = option_base_at(options, option_size, i);
+        if(!check_flag(option->flags, OF_REQUIRED) || encountered_bit(result, bit + i))
+            continue;
+
+        result->error = PE_REQUIRED_MISSING;
+        if(parent_name != NULL)
+            snprintf(result->error_value, ERROR_BUFFER_SIZE, "%s.%s", parent_name, option->name);
+        else
+            snprintf(result->error_value, ERROR_BUFFER_SIZE, "%s", option->name);
+        if(!collect_error(result, NULL))
+            return false;
+    }
+    return true;
+}
+
+static int sub_options_bit(const OptionParser* parser) {
+    // Sub-options are tracked in the words directly after the options of the main parser.
+    // Only one set of sub-options is being parsed at a time, so they can all share the same words.
+    return encountered_words(parser->option_count) * ENCOUNTERED_BITS;
+}
+
+static void release_mapped_files(ParseResult* result) {
+    for(int i = 0; i < result->mapped_file_count; i++) {
+        struct MappedFile* file = result->mapped_files + i;
+#ifndef _WIN32
+        if(file->mapped) {
+            munmap(file->data, file->size);
+            continue;
+        }
+#endif
+        free(file->data);
+    }
+    result->mapped_file_count = 0;
+}
+
+static bool track_mapped_file(ParseResult* result, char* data, size_t size, bool mapped) {
+    if(result->mapped_file_count == result->mapped_file_capacity) {
+        int capacity = result->mapped_file_capacity == 0 ? 4 : result->mapped_file_capacity * 2;
+        struct MappedFile* files = realloc(result->mapped_files, capacity * sizeof(struct MappedFile));
+        if(!files) {
+            out_of_memory(result);
+            return false;
+        }
+        result->mapped_files = files;
+        result->mapped_file_capacity = capacity;
+    }
+    result->mapped_files[result->mapped_file_count++] = (struct MappedFile){ data, size, mapped };
+    return true;
+}
+
+// Maps a file that is split into tokens in place. If the file can't be read, sets the result to error and leaves errno as it was.
+static bool open_mapped_file(ParseResult* result, Token token, ResponseFile* file, ParseError error) {
+    Token path = token;
+    path.start = token_string(result, &token);
+    if(!path.start)
+        return false;
+
+    file->position = 0;
+    file->size = 0;
+    file->data = NULL;
+    file->path = path.start;
+    file->padded = false;
+
+#ifdef _WIN32
+    FILE* stream = fopen(path.start, "rb");
+    if(!stream)
+        goto failed;
+    if(fseek(stream, 0, SEEK_END) != 0) {
+        fclose(stream);
+        goto failed;
+    }
+    long size = ftell(stream);
+    rewind(stream);
+    if(size < 0) {
+        fclose(stream);
+        goto failed;
+    }
+    char* data = malloc(size + 1);
+    if(!data) {
+        fclose(stream);
+        out_of_memory(result);
+        return false;
+    }
+    size_t read = fread(data, 1, size, stream);
+    fclose(stream);
+    if(read != (size_t)size || !track_mapped_file(result, data, size + 1, false)) {
+        free(data);
+        if(result->error != PE_NONE)
+            return false;
+        goto failed;
+    }
+    file->data = data;
+    file->size = size;
+    file->padded = true;
+    return true;
+#else
+    int descriptor = open(path.start, O_RDONLY);
+    if(descriptor == -1)
+        goto failed;
+
+    struct stat info;
+    if(fstat(descriptor, &info) == -1) {
+        close(descriptor);
+        goto failed;
+    }
+
+    // Empty files can't be mapped, but they also don't contain any arguments.
+    if(info.st_size == 0) {
+        close(descriptor);
+        return true;
+    }
+
+    // The mapping is private and writable so tokens can be unescaped and terminated in place.
+    // Only the pages that are written to are copied, and the file itself is never modified.
+    char* data = mmap(NULL, info.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, descriptor, 0);
+    close(descriptor);
+    if(data == MAP_FAILED)
+        goto failed;
+
+    if(!track_mapped_file(result, data, info.st_size, true)) {
+        munmap(data, info.st_size);
+        return false;
+    }
+    file->data = data;
+    file->size = info.st_size;
+
+    // The rest of the last page is zero filled, so a token at the very end of the file
+    // can be terminated in place unless the file fills the page exactly.
+    file->padded = info.st_size % sysconf(_SC_PAGESIZE) != 0;
+    return true;
+#endif
+
+failed:
+    // Callers check errno to tell a missing file from one that couldn't be read.
+    {
+        int failure = errno;
+        result->error = error;
+        snprintf(result->error_value, ERROR_BUFFER_SIZE, "%.*s", path.length, path.start);
+        errno = failure;
+    }
+    return false;
+}
+
+static bool response_file_next(ParseResult* result, ResponseFile* file, Token* token) {
+    // Splits the next token out of the file in place.
+    // Tokens are separated by whitespace and can be quoted with single or double quotes.
+    // A backslash escapes the next character, except inside of single quotes.
+    char* data = file->data;
+    size_t size = file->size;
+    size_t position = file->position;
+
+    while(position < size && isspace((unsigned char)data[position]))
+        position++;
+
+    if(position == size) {
+        file->position = position;
+        return false;
+    }
+
+    char* start = data + position;
+    char* write = start;
+    char quote = '\0';
+    for(; position < size; position++) {
+        char character = data[position];
+        if(quote != '\0') {
+            if(character == quote) {
+                quote = '\0';
+                continue;
+            }
+            if(character == '\\' && quote == '"' && position + 1 < size)
+                character = data[++position];
+        } else {
+            if(isspace((unsigned char)character))
+                break;
+            if(character == '"' || character == '\'') {
+                quote = character;
+                continue;
+            }
+            if(character == '\\' && position + 1 < size)
+                character = data[++position];
+        }
+        *write++ = character;
+    }
+
+    // Like a command string, a quote can't be left open, otherwise it would take the rest of the file.
+    if(quote != '\0') {
+        result->error = PE_UNMATCHED_QUOTE;
+        snprintf(result->error_value, ERROR_BUFFER_SIZE, "%s", file->path);
+        return false;
+    }
+
+    token->start = start;
+    token->length = write - start;
+    token->terminated = false;
+
+    if(write < data + size || file->padded) {
+        *write = '\0';
+        token->terminated = true;
+    } else {
+        // The token ends exactly at the end of a file that fills its last page,
+        // so there's no room for the terminator. This is the only time a token is copied.
+        token->start = token_string(result, token);
+        if(!token->start)
+            return false;
+        token->terminated = true;
+    }
+
+    // Skips the separator, which may have been overwritten by the terminator.
+    file->position = position < size ? position + 1 : position;
+    return true;
+}
+
+static int command_unquote(const char* command, int length, int* position, char* output, ParseResult* result) {
+    // Follows the quoting rules of a POSIX shell. Single quotes preserve every character,
+    // double quotes only allow \, ", $, ` and newlines to be escaped, and outside of quotes
+    // a backslash escapes any character. An escaped newline is removed entirely.
+    // Writes the unquoted token to output if it isn't NULL, and returns its length.
+    int written = 0;
+    char quote = '\0';
+    int index = *position;
+    for(; index < length; index++) {
+        char character = command[index];
+        if(quote == '\'') {
+            if(character == '\'') {
+                quote = '\0';
+                continue;
+            }
+        } else if(character == '\\' && index + 1 < length) {
+            char next = command[index + 1];
+            if(quote == '"' && strchr("\\\"$`\n", next) == NULL) {
+                // The backslash is kept as a literal character.
+            } else {
+                index++;
+                if(next == '\n')
+                    continue;
+                character = next;
+            }
+        } else if(quote == '"') {
+            if(character == '"') {
+                quote = '\0';
+                continue;
+            }
+        } else if(isspace((unsigned char)character)) {
+            break;
+        } else if(character == '"' || character == '\'') {
+            quote = character;
+            continue;
+        }
+
+        if(output != NULL)
+            output[written] = character;
+        written++;
+    }
+
+    if(quote != '\0') {
+        result->error = PE_UNMATCHED_QUOTE;
+        snprintf(result->error_value, ERROR_BUFFER_SIZE, "%.*s", length - *position, command + *position);
+        return -1;
+    }
+    *position = index;
+    return written;
+}
+
+static bool command_next(TokenStream* stream, ParseResult* result, Token* token) {
+    const char* command = stream->command;
+    int length = stream->command_length;
+    int position = stream->command_position;
+
+    while(position < length && isspace((unsigned char)command[position]))
+        position++;
+
+    if(position == length) {
+        stream->command_position = position;
+        return false;
+    }
+
+    // Most tokens don't contain any quotes or escapes, so they can point straight into the command.
+    int end = position;
+    while(end < length && !isspace((unsigned char)command[end]) && command[end] != '"' && command[end] != '\'' && command[end] != '\\')
+        end++;
+
+    if(end == length || isspace((unsigned char)command[end])) {
+        token->start = (char*)command + position;
+        token->length = end - position;
+        token->terminated = false;
+        stream->command_position = end;
+        return true;
+    }
+
+    // Otherwise the token is measured, then unquoted into the scratch arena.
+    int measured = position;
+    int unquoted_length = command_unquote(command, length, &measured, NULL, result);
+    if(unquoted_length == -1)
+        return false;
+
+    char* unquoted = scratch_alloc(result, unquoted_length + 1);
+    if(!unquoted)
+        return false;
+    command_unquote(command, length, &position, unquoted, result);
+    unquoted[unquoted_length] = '\0';
+
+    token->start = unquoted;
+    token->length = unquoted_length;
+    token->terminated = true;
+    stream->command_position = position;
+    return true;
+}
+
+static bool stream_read(TokenStream* stream, ParseResult* result, Token* token) {
+    for(;;) {
+        if(stream->depth > 0) {
+            if(!response_file_next(result, stream->files + stream->depth - 1, token)) {
+                if(result->error != PE_NONE)
+                    return false;
+                stream->depth--;
+                continue;
+            }
+        } else if(stream->command != NULL) {
+            if(!command_next(stream, result, token))
+                return false;
+            // The index counts the words of the command, which are only used to tell where errors are.
+            result->argument = stream->index++;
+        } else {
+            if(stream->index >= stream->argc)
+                return false;
+            result->argument = stream->index;
+            token->start = stream->argv[stream->index++];
+            token->length = strlen(token->start);
+            token->terminated = true;
+        }
+
+        if(!result->expand_response_files || token->length < 2 || token->start[0] != '@')
+            return true;
+
+        if(stream->depth == OPARSER_RESPONSE_FILE_DEPTH) {
+            result->error = PE_RESPONSE_FILE_NESTING;
+            mark_error_span(result, token->start + 1, token->length - 1);
+            snprintf(result->error_value, ERROR_BUFFER_SIZE, "%.*s", token->length - 1, token->start + 1);
+            return false;
+        }
+
+        Token path = { token->start + 1, token->length - 1, token->terminated };
+        if(!open_mapped_file(result, path, stream->files + stream->depth, PE_RESPONSE_FILE)) {
+            mark_error_span(result, path.start, path.length);
+            return false;
+        }
+        stream->depth++;
+    }
+}
+
+static bool stream_peek(TokenStream* stream, ParseResult* result, Token* token) {
+    if(!stream->has_peeked) {
+        if(!stream_read(stream, result, &stream->peeked))
+            return false;
+        stream->has_peeked = true;
+    }
+    *token = stream->peeked;
+    return true;
+}
+
+static bool stream_next(TokenStream* stream, ParseResult* result, Token* token) {
+    if(stream->has_peeked) {
+        *token = stream->peeked;
+        stream->has_peeked = false;
+        return true;
+    }
+    return stream_read(stream, result, token);
+}
+
+static bool sub_options_begin(const OptionSubParser* parser, ParseResult* result, int bit) {
+    int words = encountered_words(parser->option_count);
+    if(!encountered_reserve(result, bit / ENCOUNTERED_BITS + words))
+        return false;
+    memset(result->encountered + bit / ENCOUNTERED_BITS, 0, words * sizeof(unsigned int));
+    return true;
+}
+
+// Parses a token as one of the sub-options.
+// @return: false if the token isn't a sub-option, which ends the sub-options, otherwise true even if there was an error.
+static bool parse_sub_option(const OptionSubParser* parser, char* parent_name, ParseResult* result, int bit, Token token) {
+    int count = 0;
+    while(count < token.length && is_option_char(token.start[count]))
+        count++;
+
+    if(count == 0)
+        return false;
+
+    int option_index = find_name(token.start, count, &parser->name_index, (struct OptionBase*)parser->options, sizeof(SubOption), parser->option_count);
+    if(option_index == -1 && check_flag(parser->flags, PF_ALLOW_ABBREVIATIONS))
+        option_index = find_prefix(token.start, count, &parser->name_trie, (struct OptionBase*)parser->options, sizeof(SubOption), parser->option_count);
+
+    if(option_index == NAME_AMBIGUOUS) {
+        result->error = PE_AMBIGUOUS_NAME;
+        mark_error_span(result, token.start, count);
+        snprintf(result->error_value, ERROR_BUFFER_SIZE, "%s.%.*s", parent_name, count, token.start);
+        return true;
+    }
+    if(option_index == -1)
+        return false;
+
+    SubOption* option = parser->options + option_index;
+    if(!option_encounter_is_valid(result, bit + option_index, (struct OptionBase*)option)) {
+        result->error = PE_DUPLICATE;
+        mark_error_span(result, token.start, count);
+        snprintf(result->error_value, ERROR_BUFFER_SIZE, "%s.%s", parent_name, option->base.name);
+        return true;
+    }
+
+    if(count == token.length) {
+        if(check_flag(option->base.flags, OF_VALUE_REQUIRED)) {
+            result->error = PE_VALUE_MISSING;
+            mark_error_span(result, token.start, count);
+            snprintf(result->error_value, ERROR_BUFFER_SIZE, "%s.%s", parent_name, option->base.name);
+            return true;
+        }
+        invoke_handler(result, parser->handler, parser->value_handler, parser->list_handler, parser->data, parent_name, &option->base, NULL);
+    } else {
+        if(check_flag(option->base.flags, OF_VALUE_NOT_ALLOWED)) {
+            result->error = PE_VALUE_GIVEN;
+            mark_error_span(result, token.start, count);
+            snprintf(result->error_value, ERROR_BUFFER_SIZE, "%s.%s", parent_name, option->base.name);
+            return true;
+        }
+        if(count + 1 == token.length) {
+            result->error = PE_VALUE_INVALID;
+            mark_error_span(result, token.start, count);
+            snprintf(result->error_value, ERROR_BUFFER_SIZE, "%s.%s", parent_name, option->base.name);
+            return true;
+        }
+        Token value = { token.start + count + 1, token.length - count - 1, token.terminated };
+        invoke_handler(result, parser->handler, parser->value_handler, parser->list_handler, parser->data, parent_name, &option->base, &value);
+    }
+    return true;
+}
+
+static void sub_options_end(const OptionSubParser* parser, char* parent_name, ParseResult* result, int bit) {
+    report_missing_options(result, bit, (const struct OptionBase*)parser->options, sizeof(SubOption), parser->option_count, parent_name);
+}
+
+static void parse_sub_options(const OptionSubParser* parser, char* parent_name, ParseResult* result, int bit, TokenStream* stream) {
+    if(!sub_options_begin(parser, result, bit))
+        return;
+
+    Token token;
+    for(;;) {
+        if(!stream_peek(stream, result, &token)) {
+            // A response file that couldn't be read is skipped when errors are being collected.
+            if(result->error != PE_NONE && collect_error(result, &stream->peeked))
+                continue;
+            break;
+        }
+        if(!parse_sub_option(parser, parent_name, result, bit, token))
+            break;
+        stream_next(stream, result, &token);
+        if(result->error != PE_NONE && !collect_error(result, &token))
+            return;
+    }
+
+    if(result->error != PE_NONE)
+        return;
+
+    sub_options_end(parser, parent_name, result, bit);
+}
+
+static void start_sub_options(const OptionParser* parser, const Option* option, ParseResult* result, TokenStream* stream) {
+    // Without a stream, the tokens are pushed one at a time, so the parse only remembers which sub-options come next.
+    if(stream != NULL)
+        parse_sub_options(option->sub_options, option->base.name, result, sub_options_bit(parser), stream);
+    else if(sub_options_begin(option->sub_options, result, sub_options_bit(parser)))
+        result->push_option = option;
+}
+
+static void invalid_name(ParseResult* result, const struct OptionBase* options, int option_size, int option_count, int name_start, int name_length) {
+    // Similar names are only searched for if the message is formatted, so the parse just remembers where to look.
+    // Once errors have been collected, the first one is reported, so its lookup is kept.
+    int value_length = strlen(result->error_value);
+    result->error = PE_INVALID_NAME;
+    if(result->error_count > 0)
+        return;
+    result->error_options = options;
+    result->error_option_size = option_size;
+    result->error_option_count = option_count;
+    result->error_name_start = name_start < value_length ? name_start : value_length;
+    result->error_name_length = name_length < value_length - result->error_name_start ? name_length : value_length - result->error_name_start;
+}
+
+static void parse_name(const OptionParser* parser, ParseResult* result, Token token, int start, TokenStream* stream) {
+    char* name = token.start + start;
+    int count = 0;
+    while(start + count < token.length && is_option_char(name[count]))
+        count++;
+
+    int option_index = find_name(name, count, &parser->name_index, (struct OptionBase*)parser->options, sizeof(Option), parser->option_count);
+
+    if(option_index == -1 && count == 1 && check_flag(parser->flags, PF_ALWAYS_CHECK_FOR_ALIAS))
+        option_index = find_alias(parser, name[0]);
+
+    if(option_index == -1 && count > 0 && check_flag(parser->flags, PF_ALLOW_ABBREVIATIONS))
+        option_index = find_prefix(name, count, &parser->name_trie, (struct OptionBase*)parser->options, sizeof(Option), parser->option_count);
+
+    if(option_index == NAME_AMBIGUOUS) {
+        result->error = PE_AMBIGUOUS_NAME;
+        mark_error_span(result, name, count);
+        snprintf(result->error_value, ERROR_BUFFER_SIZE, "%.*s", count, name);
+        return;
+    }
+
+    if(option_index == -1) {
+        mark_error_span(result, name, count);
+        snprintf(result->error_value, ERROR_BUFFER_SIZE, "%.*s", token.length - start, name);
+        invalid_name(result, (struct OptionBase*)parser->options, sizeof(Option), parser->option_count, 0, count);
+        return;
+    }
+
+    Option* option = parser->options + option_index;
+    if(!option_encounter_is_valid(result, option_index, (struct OptionBase*)option)) {
+        result->error = PE_DUPLICATE;
+        mark_error_span(result, name, count);
+        snprintf(result->error_value, ERROR_BUFFER_SIZE, "%s", option->base.name);
+        return;
+    }
+
+    if(start + count == token.length) {
+        if(check_flag(option->base.flags, OF_VALUE_REQUIRED)) {
+            result->error = PE_VALUE_MISSING;
+            mark_error_span(result, name, count);
+            snprintf(result->error_value, ERROR_BUFFER_SIZE, "%s", option->base.name);
+            return;
+        }
+        invoke_handler(result, parser->handler, parser->value_handler, parser->list_handler, parser->data, NULL, &option->base, NULL);
+    } else {
+        if(check_flag(option->base.flags, OF_VALUE_NOT_ALLOWED)) {
+            result->error = PE_VALUE_GIVEN;
+            mark_error_span(result, name, count);
+            snprintf(result->error_value, ERROR_BUFFER_SIZE, "%s", option->base.name);
+            return;
+        }
+        if(start + count + 1 == token.length) {
+            result->error = PE_VALUE_INVALID;
+            mark_error_span(result, name, count);
+            snprintf(result->error_value, ERROR_BUFFER_SIZE, "%s", option->base.name);
+            return;
+        }
+        Token value = { name + count + 1, token.length - start - count - 1, token.terminated };
+        invoke_handler(result, parser->handler, parser->value_handler, parser->list_handler, parser->data, NULL, &option->base, &value);
+    }
+    if(result->error != PE_NONE)
+        return;
+    result->options_parsed++;
+
+    if(option->sub_options != NULL)
+        start_sub_options(parser, option, result, stream);
+}
+
+static void parse_alias(const OptionParser* parser, ParseResult* result, Token token, int start, TokenStream* stream) {
+    int count = start;
+    while(count < token.length && isalnum((unsigned char)token.start[count])) {
+        int option_index = find_alias(parser, token.start[count]);
+        if(option_index == -1) {
+            result->error = PE_INVALID_ALIAS;
+            mark_error_span(result, token.start + count, 1);
+            snprintf(result->error_value, ERROR_BUFFER_SIZE, "%c", token.start[count]);
+            return;
+        }
+
+        Option* option = parser->options + option_index;
+
+        if(!option_encounter_is_valid(result, option_index, (struct OptionBase*)option)) {
             result->error = PE_DUPLICATE;
+            mark_error_span(result, token.start + count, 1);
             snprintf(result->error_value, ERROR_BUFFER_SIZE, "%s", option->base.name);
             return;
         }
 
-        if(check_flag(option->base.flags, OF_VALUE_REQUIRED)) {
-            result->error = PE_VALUE_MISSING;
-            snprintf(result->error_value, ERROR_BUFFER_SIZE, "%s", option->base.name);
-            return;
-        }
+        bool has_value = count == start && check_flag(parser->flags, PF_SETTABLE_FLAGS) && count + 1 < token.length && token.start[count + 1] == '=';
+        if(has_value) {
+            if(check_flag(option->base.flags, OF_VALUE_NOT_ALLOWED)) {
+                result->error = PE_VALUE_GIVEN;
+                mark_error_span(result, token.start + count, 1);
+                snprintf(result->error_value, ERROR_BUFFER_SIZE, "%s", option->base.name);
+                return;
+            }
+            if(count + 2 == token.length) {
+                result->error = PE_VALUE_INVALID;
+                mark_error_span(result, token.start + count, 1);
+                snprintf(result->error_value, ERROR_BUFFER_SIZE, "%s", option->base.name);
+                return;
+            }
+            Token value = { token.start + count + 2, token.length - count - 2, token.terminated };
+            invoke_handler(result, parser->handler, parser->value_handler, parser->list_handler, parser->data, NULL, &option->base, &value);
+            // The value uses up the rest of the token.
+            count = token.length;
+        } else {
+            if(check_flag(option->base.flags, OF_VALUE_REQUIRED)) {
+                result->error = PE_VALUE_MISSING;
+                mark_error_span(result, token.start + count, 1);
+                snprintf(result->error_value, ERROR_BUFFER_SIZE, "%s", option->base.name);
+                return;
+            }
+            invoke_handler(result, parser->handler, parser->value_handler, parser->list_handler, parser->data, NULL, &option->base, NULL);
+            count++;
+        }
+        if(result->error != PE_NONE)
+            return;
+        result->options_parsed++;
+
+        if(option->sub_options != NULL)
+            start_sub_options(parser, option, result, stream);
+
+        if(result->error != PE_NONE)
+            return;
+    }
+
+    if(count != token.length) {
+        result->error = PE_INVALID_ALIAS_TOKEN;
+        mark_error_span(result, token.start + count, token.length - count);
+        snprintf(result->error_value, ERROR_BUFFER_SIZE, "%.*s", token.length, token.start);
+        return;
+    }
+}
+
+static void parse_string(const OptionParser* parser, ParseResult* result, Token token, TokenStream* stream) {
+    switch(token.length > 0 ? token.start[0] : '\0') {
+        case '-':
+            if(token.length > 1 && token.start[1] == '-') {
+                parse_name(parser, result, token, 2, stream);
+            } else {
+                if(check_flag(parser->flags, PF_TREAT_DASH_AS_FULL_OPTION))
+                    parse_name(parser, result, token, 1, stream);
+                else
+                    parse_alias(parser, result, token, 1, stream);
+            }
+            break;
+        case '/':
+            parse_name(parser, result, token, 1, stream);
+            break;
+        default:
+            if(!check_flag(parser->flags, PF_ALLOW_REMAINDER)) {
+                result->error = PE_REMAINDER;
+                snprintf(result->error_value, ERROR_BUFFER_SIZE, "%.*s", token.length, token.start);
+                return;
+            }
+
+            if(result->remainder_count == result->remainder_capacity) {
+                if(!result_buffer_grow(result, (void**)&result->remainder, result->remainder_buffer, &result->remainder_capacity, result->remainder_count + 1, sizeof(char*)))
+                    return;
+            }
+            char* remainder = token_string(result, &token);
+            if(!remainder)
+                return;
+            result->remainder[result->remainder_count++] = remainder;
+            break;
+    }
+}
+
+static void stream_init(TokenStream* stream) {
+    stream->argv = NULL;
+    stream->argc = 0;
+    stream->index = 0;
+    stream->command = NULL;
+    stream->command_length = 0;
+    stream->command_position = 0;
+    stream->depth = 0;
+    stream->has_peeked = false;
+}
+
+static bool is_option_token(Token token) {
+    return token.length > 0 && (token.start[0] == '-' || token.start[0] == '/');
+}
+
+static const OptionParser* find_subcommand(const OptionParser* parser, ParseResult* result, Token token) {
+    int index = find_name(token.start, token.length, &parser->subcommand_index, (struct OptionBase*)parser->subcommands, sizeof(struct Subcommand), parser->subcommand_count);
+    if(index == -1)
+        return NULL;
+
+    struct Subcommand* subcommand = parser->subcommands + index;
+    OptionParser* built = atomic_parser_load(&subcommand->parser);
+    if(built == NULL) {
+        built = subcommand->builder(subcommand->base.name, subcommand->data);
+        if(!built) {
+            result->error = PE_SUBCOMMAND_FAILED;
+            snprintf(result->error_value, ERROR_BUFFER_SIZE, "%s", subcommand->base.name);
+            return NULL;
+        }
+
+        // Another thread may have built the same subcommand in the meantime, in which case its parser is used instead.
+        OptionParser* existing = atomic_parser_publish(&subcommand->parser, built);
+        if(existing != NULL) {
+            oparser_free(built);
+            built = existing;
+        }
+    }
+
+    result->subcommand = built;
+    result->subcommand_name = subcommand->base.name;
+    return built;
+}
+
+static void parse_environment(const OptionParser* parser, ParseResult* result) {
+    char** variables = result->environment != NULL ? result->environment : process_environment();
+    if(parser->environment_count == 0 || variables == NULL)
+        return;
+
+    // Each variable is hashed once, no matter how many options can be set from the environment.
+    for(; *variables != NULL; variables++) {
+        char* equals = strchr(*variables, '=');
+        if(equals == NULL || equals[1] == '\0')
+            continue;
+
+        int index = find_name(*variables, equals - *variables, &parser->environment_index, (struct OptionBase*)parser->environment, sizeof(struct OptionEnvironment), parser->environment_count);
+        if(index == -1)
+            continue;
+
+        // Arguments take precedence over the environment.
+        int option_index = parser->environment[index].option;
+        unsigned int* word = result->encountered + option_index / ENCOUNTERED_BITS;
+        unsigned int mask = 1u << (option_index % ENCOUNTERED_BITS);
+        if(*word & mask)
+            continue;
+        *word |= mask;
+
+        Option* option = parser->options + option_index;
+        Token value = { equals + 1, strlen(equals + 1), true };
+        invoke_handler(result, parser->handler, parser->value_handler, parser->list_handler, parser->data, NULL, &option->base, check_flag(option->base.flags, OF_VALUE_NOT_ALLOWED) ? NULL : &value);
+        if(result->error != PE_NONE) {
+            if(collect_error(result, NULL))
+                continue;
+            return;
+        }
+        result->options_parsed++;
+    }
+}
+
+static void config_error(ParseResult* result, ParseError error, const char* path, int line, const char* text, int length) {
+    result->error = error;
+    snprintf(result->error_value, ERROR_BUFFER_SIZE, "%s:%d: %.*s", path, line, length, text);
+}
+
+static void config_invalid_name(ParseResult* result, const char* path, int line, const char* name, int length,
+                                const struct OptionBase* options, int option_size, int option_count) {
+    config_error(result, PE_INVALID_NAME, path, line, name, length);
+    invalid_name(result, options, option_size, option_count, snprintf(NULL, 0, "%s:%d: ", path, line), length);
+}
+
+static void config_dispatch(ParseResult* result, OptionHandler handler, OptionValueHandler value_handler, OptionListHandler list_handler, void* data, const char* parent_name,
+                            const struct OptionBase* option, const Token* value, const char* path, int line) {
+    if(value == NULL && check_flag(option->flags, OF_VALUE_REQUIRED)) {
+        config_error(result, PE_VALUE_MISSING, path, line, option->name, option->name_length);
+        return;
+    }
+    if(value != NULL && check_flag(option->flags, OF_VALUE_NOT_ALLOWED)) {
+        config_error(result, PE_VALUE_GIVEN, path, line, option->name, option->name_length);
+        return;
+    }
+    invoke_handler(result, handler, value_handler, list_handler, data, parent_name, option, value);
+}
+
+static bool config_section_end(ParseResult* result, const Option* section, int bit) {
+    if(section == NULL)
+        return true;
+
+    return report_missing_options(result, bit, (const struct OptionBase*)section->sub_options->options, sizeof(SubOption), section->sub_options->option_count, section->base.name);
+}
+
+static void parse_config_file(const OptionParser* parser, ParseResult* result, char* path) {
+    ResponseFile file;
+    Token path_token = { path, strlen(path), true };
+    if(!open_mapped_file(result, path_token, &file, PE_CONFIG_FILE)) {
+        // Layers that don't exist are skipped, so the same files can be listed everywhere.
+        if(result->error == PE_CONFIG_FILE && errno == ENOENT)
+            result->error = PE_NONE;
+        return;
+    }
+
+    // The options given before this file are copied into the words after the options,
+    // so that values from higher layers can be told apart from values repeated in this file.
+    // Sections track their sub-options in the words after that.
+    int words = encountered_words(parser->option_count);
+    int layer_bit = words * ENCOUNTERED_BITS;
+    int section_bit = 2 * words * ENCOUNTERED_BITS;
+    if(!encountered_reserve(result, 2 * words))
+        return;
+    if(words > 0)
+        memcpy(result->encountered + words, result->encountered, words * sizeof(unsigned int));
+
+    const Option* section = NULL;
+    bool skipped = false;
+    char* end = file.data + file.size;
+    int line = 0;
+    for(char* position = file.data; position < end;) {
+        line++;
+        char* start = position;
+        char* stop = memchr(position, '\n', end - position);
+        if(stop == NULL)
+            stop = end;
+        position = stop < end ? stop + 1 : stop;
+
+        while(start < stop && isspace((unsigned char)*start))
+            start++;
+        while(stop > start && isspace((unsigned char)stop[-1]))
+            stop--;
+        if(start == stop || *start == '#' || *start == ';')
+            continue;
+
+        if(*start == '[') {
+            if(!skipped && !config_section_end(result, section, section_bit))
+                return;
+
+            char* name = start + 1;
+            char* name_end = stop - 1;
+            while(name < name_end && isspace((unsigned char)*name))
+                name++;
+            while(name_end > name && isspace((unsigned char)name_end[-1]))
+                name_end--;
+            if(stop[-1] != ']' || name == name_end) {
+                config_error(result, PE_CONFIG_SYNTAX, path, line, start, stop - start);
+                return;
+            }
+
+            int index = find_name(name, name_end - name, &parser->name_index, (struct OptionBase*)parser->options, sizeof(Option), parser->option_count);
+            if(index == -1) {
+                config_invalid_name(result, path, line, name, name_end - name, (struct OptionBase*)parser->options, sizeof(Option), parser->option_count);
+                return;
+            }
+            section = parser->options + index;
+            if(section->sub_options == NULL) {
+                config_error(result, PE_CONFIG_SYNTAX, path, line, start, stop - start);
+                return;
+            }
+
+            // Everything in the section is left out if a higher layer already gave the option.
+            skipped = encountered_bit(result, layer_bit + index);
+            if(skipped)
+                continue;
+            if(!option_encounter_is_valid(result, index, &section->base)) {
+                config_error(result, PE_DUPLICATE, path, line, section->base.name, section->base.name_length);
+                return;
+            }
+            config_dispatch(result, parser->handler, parser->value_handler, parser->list_handler, parser->data, NULL, &section->base, NULL, path, line);
+            if(result->error != PE_NONE)
+                return;
+            result->options_parsed++;
+
+            int section_words = encountered_words(section->sub_options->option_count);
+            if(!encountered_reserve(result, 2 * words + section_words))
+                return;
+            memset(result->encountered + 2 * words, 0, section_words * sizeof(unsigned int));
+            continue;
+        }
+
+        char* key_end = memchr(start, '=', stop - start);
+        Token value;
+        Token* value_pointer = NULL;
+        bool empty = false;
+        if(key_end != NULL) {
+            char* value_start = key_end + 1;
+            char* value_stop = stop;
+            while(value_start < value_stop && isspace((unsigned char)*value_start))
+                value_start++;
+
+            // Like an equals sign with nothing after it on the command line. An empty value has to be quoted.
+            empty = value_start == value_stop;
+            if(value_stop - value_start >= 2 && (*value_start == '"' || *value_start == '\'') && value_stop[-1] == *value_start) {
+                value_start++;
+                value_stop--;
+            }
+            value.start = value_start;
+            value.length = value_stop - value_start;
+
+            // The mapping is private, so values can be terminated in place without modifying the file.
+            value.terminated = value_stop < end || file.padded;
+            if(value.terminated)
+                *value_stop = '\0';
+            value_pointer = &value;
+        } else {
+            key_end = stop;
+        }
+        while(key_end > start && isspace((unsigned char)key_end[-1]))
+            key_end--;
+        if(key_end == start) {
+            config_error(result, PE_CONFIG_SYNTAX, path, line, start, stop - start);
+            return;
+        }
+
+        if(section != NULL) {
+            if(skipped)
+                continue;
+            const OptionSubParser* subparser = section->sub_options;
+            int index = find_name(start, key_end - start, &subparser->name_index, (struct OptionBase*)subparser->options, sizeof(SubOption), subparser->option_count);
+            if(index == -1) {
+                config_invalid_name(result, path, line, start, key_end - start, (struct OptionBase*)subparser->options, sizeof(SubOption), subparser->option_count);
+                return;
+            }
+            const SubOption* option = subparser->options + index;
+            if(!option_encounter_is_valid(result, section_bit + index, &option->base)) {
+                config_error(result, PE_DUPLICATE, path, line, option->base.name, option->base.name_length);
+                return;
+            }
+            if(empty && !check_flag(option->base.flags, OF_VALUE_NOT_ALLOWED)) {
+                config_error(result, PE_VALUE_INVALID, path, line, option->base.name, option->base.name_length);
+                return;
+            }
+            config_dispatch(result, subparser->handler, subparser->value_handler, subparser->list_handler, subparser->data, section->base.name, &option->base, value_pointer, path, line);
+        } else {
+            int index = find_name(start, key_end - start, &parser->name_index, (struct OptionBase*)parser->options, sizeof(Option), parser->option_count);
+            if(index == -1) {
+                config_invalid_name(result, path, line, start, key_end - start, (struct OptionBase*)parser->options, sizeof(Option), parser->option_count);
+                return;
+            }
+            if(encountered_bit(result, layer_bit + index))
+                continue;
+            const Option* option = parser->options + index;
+            if(!option_encounter_is_valid(result, index, &option->base)) {
+                config_error(result, PE_DUPLICATE, path, line, option->base.name, option->base.name_length);
+                return;
+            }
+            if(empty && !check_flag(option->base.flags, OF_VALUE_NOT_ALLOWED)) {
+                config_error(result, PE_VALUE_INVALID, path, line, option->base.name, option->base.name_length);
+                return;
+            }
+            config_dispatch(result, parser->handler, parser->value_handler, parser->list_handler, parser->data, NULL, &option->base, value_pointer, path, line);
+            if(result->error == PE_NONE)
+                result->options_parsed++;
+        }
+        if(result->error != PE_NONE)
+            return;
+    }
+
+    if(!skipped)
+        config_section_end(result, section, section_bit);
+}
+
+static void parse_config_files(const OptionParser* parser, ParseResult* result) {
+    // Later files take precedence, so they're read first and earlier files only fill in what's left.
+    // When errors are being collected, a file stops at its first error and the next file is read.
+    for(int i = parser->config_file_count - 1; i >= 0; i--) {
+        parse_config_file(parser, result, parser->config_files[i]);
+        if(result->error != PE_NONE && !collect_error(result, NULL))
+            return;
+    }
+}
+
+static bool verify_parser_options(const OptionParser* parser, ParseResult* result) {
+    // The environment and then the config files fill in whatever the arguments left out before anything is known to be missing.
+    parse_environment(parser, result);
+    if(result->error == PE_NONE)
+        parse_config_files(parser, result);
+    if(result->error != PE_NONE)
+        return false;
+
+    return report_missing_options(result, 0, (const struct OptionBase*)parser->options, sizeof(Option), parser->option_count, NULL);
+}
+
+static bool begin_parser(const OptionParser* parser, ParseResult* result) {
+    int words = encountered_words(parser->option_count);
+    if(!encountered_reserve(result, words))
+        return false;
+    if(words > 0)
+        memset(result->encountered, 0, words * sizeof(unsigned int));
+    return true;
+}
+
+static bool parse_start(const OptionParser* parser, ParseResult* result) {
+    result->error = PE_NONE;
+    result->options_parsed = 0;
+    result->remainder_count = 0;
+    result->subcommand = NULL;
+    result->subcommand_name = NULL;
+    result->push_parser = NULL;
+    result->push_option = NULL;
+    result->error_options = NULL;
+    result->error_count = 0;
+    result->collect_errors = check_flag(parser->flags, PF_COLLECT_ERRORS);
+    result->error_span = NULL;
+    result->expand_response_files = check_flag(parser->flags, PF_RESPONSE_FILES);
+    result->argument = -1;
+    if(result->collected != NULL) {
+        result->collected->count = 0;
+        result->collected->group_count = 0;
+        result->collected->last_group = 0;
+    }
+    release_mapped_files(result);
+    scratch_reset(result);
+
+    return begin_parser(parser, result);
+}
+
+// Parses a token with the current parser, which is switched over to a subcommand if the token names one.
+static void parse_token(const OptionParser** parser, ParseResult* result, Token token, TokenStream* stream) {
+    if((*parser)->subcommand_count > 0 && !is_option_token(token)) {
+        const OptionParser* subcommand = find_subcommand(*parser, result, token);
+        if(result->error != PE_NONE)
+            return;
+        if(subcommand != NULL) {
+            // The options of a parser are finished once one of its subcommands is reached,
+            // so the encountered bits can be handed over to the subcommand.
+            if(verify_parser_options(*parser, result) && begin_parser(subcommand, result))
+                *parser = subcommand;
+            return;
+        }
+    }
+
+    parse_string(*parser, result, token, stream);
+}
+
+static void parse_stream(const OptionParser* parser, ParseResult* result, TokenStream* stream) {
+    if(!parse_start(parser, result))
+        return;
+
+    Token token;
+    for(;;) {
+        if(!stream_next(stream, result, &token)) {
+            // A response file that couldn't be read is skipped when errors are being collected.
+            if(result->error != PE_NONE && collect_error(result, &token))
+                continue;
+            break;
+        }
+        parse_token(&parser, result, token, stream);
+        if(result->error != PE_NONE && !collect_error(result, &token))
+            break;
+    }
+
+    if(result->error == PE_NONE) {
+        result->argument = -1;
+        verify_parser_options(parser, result);
+    }
+    finish_errors(result);
+    finish_values(result);
+}
+
+static void parse_arguments(const OptionParser* parser, ParseResult* result, char** argv, int argc) {
+    TokenStream stream;
+    stream_init(&stream);
+    stream.argv = argv;
+    stream.argc = argc;
+    stream.index = 1;
+    parse_stream(parser, result, &stream);
+}
+
+static void push_token(ParseResult* result, Token token, int depth) {
+    const OptionParser* parser = result->push_parser;
+
+    // Response files are expanded first, since their tokens may continue the current sub-options.
+    if(result->expand_response_files && token.length > 1 && token.start[0] == '@') {
+        if(depth == OPARSER_RESPONSE_FILE_DEPTH) {
+            result->error = PE_RESPONSE_FILE_NESTING;
+            mark_error_span(result, token.start + 1, token.length - 1);
+            snprintf(result->error_value, ERROR_BUFFER_SIZE, "%.*s", token.length - 1, token.start + 1);
+            return;
+        }
+
+        ResponseFile file;
+        Token path = { token.start + 1, token.length - 1, token.terminated };
+        if(!open_mapped_file(result, path, &file, PE_RESPONSE_FILE)) {
+            mark_error_span(result, path.start, path.length);
+            return;
+        }
+        Token inner;
+        while(response_file_next(result, &file, &inner)) {
+            push_token(result, inner, depth + 1);
+            if(result->error != PE_NONE && !collect_error(result, &inner))
+                return;
+        }
+        return;
+    }
+
+    const Option* option = result->push_option;
+    if(option != NULL) {
+        if(parse_sub_option(option->sub_options, option->base.name, result, sub_options_bit(parser), token))
+            return;
+
+        // Anything that isn't a sub-option ends them, and is then parsed as usual.
+        result->push_option = NULL;
+        sub_options_end(option->sub_options, option->base.name, result, sub_options_bit(parser));
+        if(result->error != PE_NONE)
+            return;
+    }
+
+    parse_token(&result->push_parser, result, token, NULL);
+}
+
+ParseError oparser_begin(const OptionParser* parser, ParseResult* result) {
+    if(parse_start(parser, result))
+        result->push_parser = parser;
+    return result->error;
+}
+
+ParseError oparser_feed(ParseResult* result, const char* token, int length) {
+    if(result->error != PE_NONE || result->push_parser == NULL)
+        return result->error;
+
+    // The token isn't terminated, so anything that outlives the call is copied out of it.
+    Token value = { (char*)token, length, false };
+    result->argument++;
+    push_token(result, value, 0);
+
+    // A collected error is cleared so that the following tokens are still parsed.
+    ParseError error = result->error;
+    if(error != PE_NONE)
+        collect_error(result, &value);
+    return error;
+}
+
+ParseError oparser_finish(ParseResult* result) {
+    const Option* option = result->push_option;
+    result->push_option = NULL;
+    if(result->push_parser == NULL)
+        return result->error;
+
+    if(result->error == PE_NONE) {
+        result->argument = -1;
+        if(option != NULL)
+            sub_options_end(option->sub_options, option->base.name, result, sub_options_bit(result->push_parser));
+        if(result->error == PE_NONE)
+            verify_parser_options(result->push_parser, result);
+    }
+    finish_errors(result);
+    finish_values(result);
+
+    // Any further tokens are ignored until the next parse begins.
+    result->push_parser = NULL;
+    return result->error;
+}
+
+void oparser_result_init(ParseResult* result) {
+    result->error = PE_NONE;
+    result->error_value[0] = '\0';
+    result->error_options = NULL;
+    result->error_option_size = 0;
+    result->error_option_count = 0;
+    result->error_name_start = 0;
+    result->error_name_length = 0;
+    result->options_parsed = 0;
+    result->remainder = result->remainder_buffer;
+    result->remainder_count = 0;
+    result->remainder_capacity = OPARSER_RESULT_INLINE_REMAINDER;
+    result->encountered = result->encountered_buffer;
+    result->encountered_capacity = OPARSER_RESULT_INLINE_WORDS;
+    result->handler_log = NULL;
+    result->mapped_files = NULL;
+    result->mapped_file_count = 0;
+    result->mapped_file_capacity = 0;
+    result->scratch = NULL;
+    result->target = NULL;
+    result->subcommand = NULL;
+    result->subcommand_name = NULL;
+    result->environment = NULL;
+    result->push_parser = NULL;
+    result->push_option = NULL;
+    result->errors = NULL;
+    result->error_count = 0;
+    result->error_capacity = 0;
+    result->collect_errors = false;
+    result->error_span = NULL;
+    result->error_span_length = 0;
+    result->expand_response_files = false;
+    result->argument = -1;
+    result->collected = NULL;
+}
+
+ParseError oparser_parse_into(const OptionParser* parser, ParseResult* result, char** argv, int argc) {
+    parse_arguments(parser, result, argv, argc);
+    return result->error;
+}
+
+ParseError oparser_parse_command(const OptionParser* parser, ParseResult* result, const char* command, int length) {
+    TokenStream stream;
+    stream_init(&stream);
+    stream.command = command;
+    stream.command_length = length;
+    parse_stream(parser, result, &stream);
+    return result->error;
+}
+
+ParseResult* oparser_parse_reentrant(const OptionParser* parser, char** argv, int argc) {
+    ParseResult* result = malloc(sizeof(ParseResult));
+    if(!result)
+        return NULL;
+
+    oparser_result_init(result);
+    parse_arguments(parser, result, argv, argc);
+    return result;
+}
+
+ParseResult* oparser_parse(OptionParser* parser, char** argv, int argc) {
+    ParseResult* result = oparser_parse_reentrant(parser, argv, argc);
+    if(!result)
+        return NULL;
+
+    // Keeps oparser_remainder working for callers that own their parser.
+    // The values can live in the result, such as a response file or a command string, so they're copied
+    // into one block that holds the pointers followed by the strings, and that is reused by later parses.
+    parser->remainder_count = 0;
+    if(check_flag(parser->flags, PF_ALLOW_REMAINDER) && result->remainder_count > 0) {
+        int size = result->remainder_count * sizeof(char*);
+        for(int i = 0; i < result->remainder_count; i++)
+            size += strlen(result->remainder[i]) + 1;
+
+        if(size > parser->remainder_capacity) {
+            char** remainder = parser_reallocate(parser, parser->remainder, parser->remainder_capacity, size);
+            if(!remainder) {
+                out_of_memory(result);
+                return result;
+            }
+            parser->remainder = remainder;
+            parser->remainder_capacity = size;
+        }
+
+        char* strings = (char*)(parser->remainder + result->remainder_count);
+        for(int i = 0; i < result->remainder_count; i++) {
+            size_t length = strlen(result->remainder[i]) + 1;
+            memcpy(strings, result->remainder[i], length);
+            parser->remainder[i] = strings;
+            strings += length;
+        }
+        parser->remainder_count = result->remainder_count;
+    }
+    return result;
+}
+
+typedef struct BatchWork {
+    const OptionParser* parser;
+    const ParseBatchItem* items;
+    ParseResult* results;
+    struct HandlerLog* logs;
+    int count;
+    AtomicCounter next;
+} BatchWork;
+
+static void batch_worker(BatchWork* work) {
+    for(;;) {
+        // Items are claimed a few at a time so the workers don't fight over the counter.
+        int start = atomic_counter_add(&work->next, BATCH_CHUNK_SIZE);
+        if(start >= work->count)
+            return;
+
+        int end = start + BATCH_CHUNK_SIZE < work->count ? start + BATCH_CHUNK_SIZE : work->count;
+        for(int i = start; i < end; i++) {
+            ParseResult* result = work->results + i;
+            result->handler_log = work->logs != NULL ? work->logs + i : NULL;
+            parse_arguments(work->parser, result, work->items[i].argv, work->items[i].argc);
+            result->handler_log = NULL;
+        }
+    }
+}
+
+#ifdef _WIN32
+static DWORD WINAPI batch_thread(LPVOID data) {
+    batch_worker(data);
+    return 0;
+}
+
+static bool thread_start(NativeThread* thread, BatchWork* work) {
+    *thread = CreateThread(NULL, 0, batch_thread, work, 0, NULL);
+    return *thread != NULL;
+}
+
+static void thread_join(NativeThread thread) {
+    WaitForSingleObject(thread, INFINITE);
+    CloseHandle(thread);
+}
+#else
+static void* batch_thread(void* data) {
+    batch_worker(data);
+    return NULL;
+}
+
+static bool thread_start(NativeThread* thread, BatchWork* work) {
+    return pthread_create(thread, NULL, batch_thread, work) == 0;
+}
+
+static void thread_join(NativeThread thread) {
+    pthread_join(thread, NULL);
+}
+#endif
+
+bool oparser_parse_batch(const OptionParser* parser, const ParseBatchItem* items, ParseResult* results, int count, int thread_count, BatchDispatch dispatch) {
+    BatchWork work;
+    work.parser = parser;
+    work.items = items;
+    work.results = results;
+    work.count = count;
+    work.logs = NULL;
+    atomic_counter_init(&work.next, 0);
+
+    if(dispatch == BD_DEFERRED && count > 0) {
+        work.logs = calloc(count, sizeof(struct HandlerLog));
+        if(!work.logs) {
+            for(int i = 0; i < count; i++) {
+                out_of_memory(results + i);
+            }
+            return false;
+        }
+    }
+
+    // The calling thread works on the batch as well, so only thread_count - 1 threads are started.
+    // If a thread can't be started, the remaining threads pick up its share of the work.
+    int workers = 0;
+    NativeThread* threads = NULL;
+    if(thread_count > 1 && count > BATCH_CHUNK_SIZE) {
+        threads = malloc((thread_count - 1) * sizeof(NativeThread));
+        if(threads) {
+            while(workers < thread_count - 1 && thread_start(threads + workers, &work))
+                workers++;
+        }
+    }
+
+    batch_worker(&work);
+
+    for(int i = 0; i < workers; i++)
+        thread_join(threads[i]);
+    free(threads);
+
+    bool success = true;
+    for(int i = 0; i < count; i++) {
+        if(work.logs != NULL) {
+            struct HandlerLog* log = work.logs + i;
+            for(int j = 0; j < log->count; j++) {
+                HandlerCall* call = log->calls + j;
+                if(call->list_handler != NULL)
+                    call->list_handler(call->name, call->alias, call->values, call->value_count, call->data);
+                else if(call->value_handler != NULL)
+                    call->value_handler(call->name, call->alias, call->has_span ? &call->span : NULL, call->data);
+                else
+                    call->handler(call->name, call->alias, call->value, call->data);
+            }
+            free(log->calls);
+        }
+        if(results[i].error != PE_NONE)
+            success = false;
+    }
+    free(work.logs);
+
+    return success;
+}
+
+// The most names suggested for an invalid name.
+#define MAX_SUGGESTIONS 3
+
+// Names longer than this can't be held in one word by bounded_edit_distance, so nothing is suggested for them.
+#define MAX_SUGGESTION_PATTERN 64
+
+// Computes the edit distance between the pattern and a name with the bit-parallel algorithm of Myers, as formulated by Hyyrö.
+// A column of the distance matrix is held as two words of vertical deltas, so each character of the name is a few word operations.
+// Returns limit + 1 as soon as the distance must be greater than limit.
+static int bounded_edit_distance(const uint64_t* peq, int pattern_length, const char* name, int length, int limit) {
+    if(abs(length - pattern_length) > limit)
+        return limit + 1;
+
+    uint64_t positive = ~(uint64_t)0;
+    uint64_t negative = 0;
+    uint64_t last = (uint64_t)1 << (pattern_length - 1);
+    int distance = pattern_length;
+    for(int i = 0; i < length; i++) {
+        uint64_t equal = peq[(unsigned char)name[i]];
+        uint64_t vertical = equal | negative;
+        uint64_t horizontal = (((equal & positive) + positive) ^ positive) | equal;
+        uint64_t horizontal_positive = negative | ~(horizontal | positive);
+        uint64_t horizontal_negative = positive & horizontal;
+        if(horizontal_positive & last)
+            distance++;
+        else if(horizontal_negative & last)
+            distance--;
+
+        // Each remaining character can lower the distance by at most one.
+        if(distance - (length - i - 1) > limit)
+            return limit + 1;
+
+        horizontal_positive = (horizontal_positive << 1) | 1;
+        horizontal_negative <<= 1;
+        positive = horizontal_negative | ~(vertical | horizontal_positive);
+        negative = horizontal_positive & vertical;
+    }
+    return distance;
+}
+
+static int suggest_names(const ParseResult* result, const struct OptionBase** suggestions) {
+    const char* pattern = result->error_value + result->error_name_start;
+    int pattern_length = result->error_name_length;
+    if(result->error_options == NULL || pattern_length == 0 || pattern_length > MAX_SUGGESTION_PATTERN)
+        return 0;
+
+    // Short names allow fewer edits, so that a suggestion still resembles what was typed.
+    int limit = pattern_length <= 4 ? 1 : pattern_length <= 8 ? 2 : 3;
+    if(limit >= pattern_length)
+        limit = pattern_length - 1;
+    if(limit == 0)
+        return 0;
+
+    uint64_t peq[256] = { 0 };
+    for(int i = 0; i < pattern_length; i++)
+        peq[(unsigned char)pattern[i]] |= (uint64_t)1 << i;
+
+    int distances[MAX_SUGGESTIONS];
+    int count = 0;
+    for(int i = 0; i < result->error_option_count; i++) {
+        const struct OptionBase* option = option_base_at(result->error_options, result->error_option_size, i);
+        int distance = bounded_edit_distance(peq, pattern_length, option->name, option->name_length, limit);
+        if(distance > limit)
+            continue;
+
+        // Keeps the closest names, with earlier options first when they are equally close.
+        int position = count < MAX_SUGGESTIONS ? count++ : MAX_SUGGESTIONS;
+        while(position > 0 && distances[position - 1] > distance) {
+            if(position < MAX_SUGGESTIONS) {
+                distances[position] = distances[position - 1];
+                suggestions[position] = suggestions[position - 1];
+            }
+            position--;
+        }
+        if(position < MAX_SUGGESTIONS) {
+            distances[position] = distance;
+            suggestions[position] = option;
+        }
+
+        // Nothing can replace names that are a single edit away.
+        if(count == MAX_SUGGESTIONS && distances[MAX_SUGGESTIONS - 1] == 1)
+            break;
+    }
+    return count;
+}
+
+static int append_suggestions(const ParseResult* result, char* buffer, int size, int length) {
+    const struct OptionBase* suggestions[MAX_SUGGESTIONS];
+    int count = suggest_names(result, suggestions);
+    for(int i = 0; i < count; i++) {
+        int offset = length < size ? length : size;
+        length += snprintf(size > offset ? buffer + offset : NULL, size > offset ? size - offset : 0, "%s%s", i == 0 ? " (did you mean " : ", ", suggestions[i]->name);
+    }
+    if(count > 0) {
+        int offset = length < size ? length : size;
+        length += snprintf(size > offset ? buffer + offset : NULL, size > offset ? size - offset : 0, "?)");
+    }
+    return length;
+}
+
+static int format_message(ParseError error, const char* value, char* buffer, int size) {
+    switch(error) {
+        case PE_INVALID_NAME:
+            return snprintf(buffer, size, "Encountered invalid option: %s", value);
+        case PE_INVALID_ALIAS:
+            return snprintf(buffer, size, "Encountered invalid option alias: %s", value);
+        case PE_INVALID_NAME_TOKEN:
+            return snprintf(buffer, size, "Encountered invalid token in option: %s", value);
+        case PE_INVALID_ALIAS_TOKEN:
+            return snprintf(buffer, size, "Encountered invalid token in alias list: %s", value);
+        case PE_DUPLICATE:
+            return snprintf(buffer, size, "Encountered an invalid duplicate option: %s", value);
+        case PE_REQUIRED_MISSING:
+            return snprintf(buffer, size, "Missing required option: %s", value);
+        case PE_VALUE_INVALID:
+            return snprintf(buffer, size, "Missing value after equals sign for option: %s", value);
+        case PE_VALUE_MISSING:
+            return snprintf(buffer, size, "Expected value for option: %s", value);
+        case PE_VALUE_GIVEN:
+            return snprintf(buffer, size, "Cannot set option: %s", value);
+        case PE_REMAINDER:
+            return snprintf(buffer, size, "Cannot accept non-option value: %s", value);
+        case PE_RESPONSE_FILE:
+            return snprintf(buffer, size, "Couldn't read response file: %s", value);
+        case PE_RESPONSE_FILE_NESTING:
+            return snprintf(buffer, size, "Response files nested too deeply: %s", value);
+        case PE_UNMATCHED_QUOTE:
+            return snprintf(buffer, size, "Missing closing quote in: %s", value);
+        case PE_VALUE_CONVERSION:
+            return snprintf(buffer, size, "Invalid value for option: %s", value);
+        case PE_AMBIGUOUS_NAME:
+            return snprintf(buffer, size, "Ambiguous abbreviated option: %s", value);
+        case PE_SUBCOMMAND_FAILED:
+            return snprintf(buffer, size, "Couldn't set up subcommand: %s", value);
+        case PE_CONFIG_FILE:
+            return snprintf(buffer, size, "Couldn't read config file: %s", value);
+        case PE_CONFIG_SYNTAX:
+            return snprintf(buffer, size, "Invalid line in config file: %s", value);
+        case PE_OUT_OF_MEMORY:
+            return snprintf(buffer, size, "Ran out of memory while parsing");
+        default:
+            return snprintf(buffer, size, "Encountered unknown error: %d", error);
+    }
+}
+
+int oparser_format_error(const ParseResult* result, char* buffer, int size) {
+    if(result->error == PE_NONE) {
+        if(size > 0)
+            buffer[0] = '\0';
+        return 0;
+    }
+
+    int length = format_message(result->error, result->error_value, buffer, size);
+    return result->error == PE_INVALID_NAME ? append_suggestions(result, buffer, size, length) : length;
+}
+
+int oparser_format_error_entry(const ParseResult* result, int index, char* buffer, int size) {
+    if(index < 0 || index >= result->error_count) {
+        if(size > 0)
+            buffer[0] = '\0';
+        return 0;
+    }
+
+    const ParseErrorEntry* entry = result->errors + index;
+    return format_message(entry->error, entry->value, buffer, size);
+}
+
+char* oparser_get_error_string(ParseResult* result) {
+    if(result->error == PE_NONE)
+        return NULL;
+
+    oparser_format_error(result, result->error_string, sizeof(result->error_string));
+    return result->error_string;
+}
+
+void oparser_result_destroy(ParseResult* result) {
+    free(result->errors);
+    if(result->collected != NULL) {
+        free(result->collected->values);
+        free(result->collected->grouped);
+        free(result->collected->value_groups);
+        free(result->collected->groups);
+        free(result->collected);
+    }
+    release_mapped_files(result);
+    free(result->mapped_files);
+    scratch_reset(result);
+    free(result->scratch);
+    if(result->remainder != result->remainder_buffer)
+        free(result->remainder);
+    if(result->encountered != result->encountered_buffer)
+        free(result->encountered);
+    oparser_result_init(result);
+}
+
+void oparser_result_free(ParseResult* result) {
+    oparser_result_destroy(result);
+    free(result);
+}
+
+// Receives rendered help text. Only counts the characters if neither buffer nor writer is set.
+typedef struct HelpSink {
+    char* buffer;
+    OptionHelpWriter writer;
+    void* context;
+    int length;
+    bool failed;
+} HelpSink;
+
+static void sink_write(HelpSink* sink, const char* text, int length) {
+    if(sink->failed || length <= 0)
+        return;
+    if(sink->buffer != NULL)
+        memcpy(sink->buffer + sink->length, text, length);
+    else if(sink->writer != NULL && !sink->writer(text, length, sink->context))
+        sink->failed = true;
+    sink->length += length;
+}
+
+static void sink_string(HelpSink* sink, const char* text) {
+    if(text != NULL)
+        sink_write(sink, text, strlen(text));
+}
+
+static void sink_pad(HelpSink* sink, int count) {
+    static const char spaces[] = "                                ";
+    while(count > 0) {
+        int length = count < (int)sizeof(spaces) - 1 ? count : (int)sizeof(spaces) - 1;
+        sink_write(sink, spaces, length);
+        count -= length;
+    }
+}
+
+static void render_suboption(HelpSink* sink, SubOption* option, int doc_start) {
+    int line_start = sink->length;
+    sink_write(sink, "  ", 2);
+
+    if(check_flag(option->base.flags, OF_REQUIRED)) {
+        sink_write(sink, "[", 1);
+        sink_write(sink, option->base.name, option->base.name_length);
+        sink_write(sink, "]", 1);
+    } else {
+        sink_write(sink, option->base.name, option->base.name_length);
+    }
+
+    sink_pad(sink, doc_start - (sink->length - line_start));
+    sink_write(sink, " ", 1);
+    sink_string(sink, option->base.doc_string);
+    sink_write(sink, "\n", 1);
+}
+
+static void render_option(HelpSink* sink, Option* option, int doc_start) {
+    int line_start = sink->length;
+    bool required = check_flag(option->base.flags, OF_REQUIRED);
+
+    sink_write(sink, "  ", 2);
+
+    if(!required)
+        sink_write(sink, "[", 1);
+
+    sink_write(sink, "--", 2);
+    sink_write(sink, option->base.name, option->base.name_length);
+
+    if(is_alias_char(option->base.alias) && isgraph(option->base.alias)) {
+        char alias[3] = { '|', '-', (char)option->base.alias };
+        sink_write(sink, alias, 3);
+    }
+
+    if(!required)
+        sink_write(sink, "]", 1);
+
+    sink_pad(sink, doc_start - (sink->length - line_start));
+    sink_write(sink, " ", 1);
+    sink_string(sink, option->base.doc_string);
+    sink_write(sink, "\n", 1);
+
+    if(option->sub_options != NULL) {
+        for(int i = 0; i < option->sub_options->option_count; i++) {
+            sink_write(sink, "  ", 2);
+            render_suboption(sink, option->sub_options->options + i, doc_start - 2);
+        }
+    }
+}
+
+static int help_column(OptionParser* parser) {
+    // The column that documentation starts at, which leaves room for the longest option or sub-option.
+    int doc_start = 0;
+    for(int i = 0; i < parser->option_count; i++) {
+        if(parser->options[i].base.name_length + 10 > doc_start)
+            doc_start = parser->options[i].base.name_length + 10;
+
+        if(parser->options[i].sub_options != NULL) {
+            OptionSubParser* subparser = parser->options[i].sub_options;
+            for(int j = 0; j < subparser->option_count; j++) {
+                if(subparser->options[j].base.name_length + 6 > doc_start)
+                    doc_start = subparser->options[j].base.name_length + 6;
+            }
+        }
+    }
+    return doc_start;
+}
+
+static int option_help_column(Option* option) {
+    int doc_start = option->base.name_length + 10;
+    if(option->sub_options != NULL) {
+        OptionSubParser* subparser = option->sub_options;
+        for(int i = 0; i < subparser->option_count; i++) {
+            if(subparser->options[i].base.name_length + 6 > doc_start)
+                doc_start = subparser->options[i].base.name_length + 6;
+        }
+    }
+    return doc_start;
+}
+
+static void render_help(HelpSink* sink, OptionParser* parser, int doc_start) {
+    for(int i = 0; i < parser->option_count; i++)
+        render_option(sink, parser->options + i, doc_start);
+}
+
+static char* help_buffer(OptionParser* parser, int size) {
+    // Help strings are handed to the caller, so they never come from the arena.
+    return parser_allocator(parser)->allocate(size, parser_allocator(parser)->context);
+}
+
+void oparser_free_help(OptionParser* parser, char* help) {
+    parser_allocator(parser)->release(help, parser_allocator(parser)->context);
+}
+
+static char* copy_help(OptionParser* parser, const char* help) {
+    if(!help)
+        return NULL;
+
+    int length = strlen(help);
+    char* copy = help_buffer(parser, length + 1);
+    if(!copy)
+        return NULL;
+    memcpy(copy, help, length + 1);
+    return copy;
+}
+
+const char* oparser_cached_help(OptionParser* parser) {
+    if(parser->help != NULL && parser->help_version == parser->schema_version)
+        return parser->help;
+
+    int doc_start = help_column(parser);
+
+    // Measures the help first so that it can be written straight into a buffer of the exact size.
+    HelpSink sink = { NULL, NULL, NULL, 0, false };
+    render_help(&sink, parser, doc_start);
+
+    char* buffer = help_buffer(parser, sink.length + 1);
+    if(!buffer)
+        return NULL;
+
+    sink = (HelpSink){ buffer, NULL, NULL, 0, false };
+    render_help(&sink, parser, doc_start);
+    buffer[sink.length] = '\0';
+
+    oparser_free_help(parser, parser->help);
+    parser->help = buffer;
+    parser->help_length = sink.length;
+    parser->help_version = parser->schema_version;
+    return buffer;
+}
+
+char* oparser_help(OptionParser* parser) {
+    return copy_help(parser, oparser_cached_help(parser));
+}
+
+int oparser_write_help(OptionParser* parser, OptionHelpWriter writer, void* context) {
+    // Large help is streamed rather than cached, but a help string that is already cached can be written at once.
+    if(parser->help != NULL && parser->help_version == parser->schema_version)
+        return writer(parser->help, parser->help_length, context) ? parser->help_length : -1;
+
+    HelpSink sink = { NULL, writer, context, 0, false };
+    render_help(&sink, parser, help_column(parser));
+    return sink.failed ? -1 : sink.length;
+}
+
+static bool file_writer(const char* text, int length, void* context) {
+    return fwrite(text, 1, length, (FILE*)context) == (size_t)length;
+}
+
+int oparser_print_help(OptionParser* parser, FILE* file) {
+    return oparser_write_help(parser, file_writer, file);
+}
+
+const char* oparser_cached_option_help(OptionParser* parser, char* option_name) {
+    int option_index = find_name(option_name, strlen(option_name), &parser->name_index, (struct OptionBase*)parser->options, sizeof(Option), parser->option_count);
+    if(option_index == -1)
+        return NULL;
+
+    // Options in static tables are read only, so their parser only caches the most recent option.
+    Option* option = parser->options + option_index;
+    bool is_static = parser->option_capacity == 0;
+    if(is_static && parser->option_help != NULL && parser->option_help_index == option_index)
+        return parser->option_help;
+    if(!is_static && option->help != NULL && option->help_version == parser->schema_version)
+        return option->help;
+
+    int doc_start = option_help_column(option);
+
+    HelpSink sink = { NULL, NULL, NULL, 0, false };
+    render_option(&sink, option, doc_start);
+
+    char* buffer = help_buffer(parser, sink.length + 1);
+    if(!buffer)
+        return NULL;
+
+    sink = (HelpSink){ buffer, NULL, NULL, 0, false };
+    render_option(&sink, option, doc_start);
+    buffer[sink.length] = '\0';
+
+    if(is_static) {
+        oparser_free_help(parser, parser->option_help);
+        parser->option_help = buffer;
+        parser->option_help_index = option_index;
+    } else {
+        oparser_free_help(parser, option->help);
+        option->help = buffer;
+        option->help_version = parser->schema_version;
+    }
+    return buffer;
+}
+
+char* oparser_option_help(OptionParser* parser, char* option_name) {
+    return copy_help(parser, oparser_cached_option_help(parser, option_name));
+}
+
+char* oparser_suboption_help(OptionParser* parser, char* option_name, char* suboption_name) {
+    int option_index = find_name(option_name, strlen(option_name), &parser->name_index, (struct OptionBase*)parser->options, sizeof(Option), parser->option_count);
+    if(option_index == -1)
+        return NULL;
+
+    Option* option = parser->options + option_index;
+    if(option->sub_options == NULL)
+        return NULL;
+
+    option_index = find_name(suboption_name, strlen(suboption_name), &option->sub_options->name_index, (struct OptionBase*)option->sub_options->options, sizeof(SubOption), option->sub_options->option_count);
+    if(option_index == -1)
+        return NULL;
+
+    SubOption* suboption = option->sub_options->options + option_index;
+    int doc_start = suboption->base.name_length + 4;
+
+    HelpSink sink = { NULL, NULL, NULL, 0, false };
+    render_suboption(&sink, suboption, doc_start);
+
+    char* buffer = help_buffer(parser, sink.length + 1);
+    if(!buffer)
+        return NULL;
+
+    sink = (HelpSink){ buffer, NULL, NULL, 0, false };
+    render_suboption(&sink, suboption, doc_start);
+    buffer[sink.length] = '\0';
+    return buffer;
+}
+
+char* oparser_option_docstring(OptionParser* parser, char* option_name) {
+    int option_index = find_name(option_name, strlen(option_name), &parser->name_index, (struct OptionBase*)parser->options, sizeof(Option), parser->option_count);
+    if(option_index == -1)
+        return NULL;
+
+    return parser->options[option_index].base.doc_string;
+}
+
+char* oparser_suboption_docstring(OptionParser* parser, char* option_name, char* suboption_name) {
+    int option_index = find_name(option_name, strlen(option_name), &parser->name_index, (struct OptionBase*)parser->options, sizeof(Option), parser->option_count);
+    if(option_index == -1)
+        return NULL;
+
+    OptionSubParser* subparser = parser->options[option_index].sub_options;
+    if(subparser == NULL)
+        return NULL;
+
+    option_index = find_name(suboption_name, strlen(suboption_name), &subparser->name_index, (struct OptionBase*)subparser->options, sizeof(SubOption), subparser->option_count);
+    if(option_index == -1)
+        return NULL;
+
+    return subparser->options[option_index].base.doc_string;
+}
+
+typedef struct Completion {
+    OptionCompletionWriter writer;
+    void* context;
+    int count;
+    bool stopped;
+} Completion;
+
+static void complete_candidate(Completion* completion, const char* prefix, const char* name, int length) {
+    if(completion->stopped)
+        return;
+
+    // Candidates are written in one piece, so the prefix is joined onto the name.
+    char buffer[128];
+    int prefix_length = strlen(prefix);
+    char* candidate = prefix_length + length <= (int)sizeof(buffer) ? buffer : malloc(prefix_length + length);
+    if(!candidate) {
+        completion->stopped = true;
+        return;
+    }
+    memcpy(candidate, prefix, prefix_length);
+    memcpy(candidate + prefix_length, name, length);
+    if(completion->writer(candidate, prefix_length + length, completion->context))
+        completion->count++;
+    else
+        completion->stopped = true;
+    if(candidate != buffer)
+        free(candidate);
+}
+
+static void complete_option(Completion* completion, const char* prefix, const struct OptionBase* option, const ParseResult* used, int bit) {
+    // Options that can't be given again aren't offered.
+    if(!check_flag(option->flags, OF_DUPLICATES_ALLOWED) && encountered_bit(used, bit))
+        return;
+    complete_candidate(completion, prefix, option->name, option->name_length);
+}
 
-        if(count == 0 && check_flag(parser->flags, PF_SETTABLE_FLAGS) && option_string[start_index + 1] == '=') {
-            if(check_flag(option->base.flags, OF_VALUE_NOT_ALLOWED)) {
-                result->error = PE_VALUE_GIVEN;
-                snprintf(result->error_value, ERROR_BUFFER_SIZE, "%s", option->base.name);
-                return;
-            }
-            start_index += count + 1;
-            int length = strlen(option_string + start_index);
-            if(length == 0) {
-                result->error = PE_VALUE_INVALID;
-                snprintf(result->error_value, ERROR_BUFFER_SIZE, "%s", option->base.name);
-                return;
-            }
-            parser->handler(option->base.name, option->base.alias, option_string + start_index, parser->data);
-            if(option->sub_options != NULL)
-                parse_sub_options(option->sub_options, option->base.name, result, i, argv, argc);
-        } else {
-            parser->handler(option->base.name, option->base.alias, NULL, parser->data);
-            result->options_parsed++;
-            if(option->sub_options != NULL)
-                parse_sub_options(option->sub_options, option->base.name, result, i, argv, argc);
-            count++;
+static void complete_trie_node(Completion* completion, const char* prefix, const OptionNameTrie* trie, int node,
+                               const struct OptionBase* options, int option_size, const ParseResult* used, int bit) {
+    const NameTrieNode* current = trie->nodes + node;
+    if(current->option != -1)
+        complete_option(completion, prefix, option_base_at(options, option_size, current->option), used, bit + current->option);
+    for(int child = current->first_child; child != -1 && !completion->stopped; child = trie->nodes[child].next_sibling)
+        complete_trie_node(completion, prefix, trie, child, options, option_size, used, bit);
+}
+
+static void complete_names(Completion* completion, const char* prefix, const char* name, int length, const OptionNameTrie* trie,
+                           const struct OptionBase* options, int option_size, int option_count, const ParseResult* used, int bit) {
+    if(trie->count == 0) {
+        // Static tables don't have a trie, so they're searched directly.
+        for(int i = 0; i < option_count && !completion->stopped; i++) {
+            const struct OptionBase* option = option_base_at(options, option_size, i);
+            if(option->name_length >= length && memcmp(option->name, name, length) == 0)
+                complete_option(completion, prefix, option, used, bit + i);
         }
+        return;
     }
 
-    switch(option_string[start_index + count]) {
-        case '\0':
-            return;
-        default:
-            result->error = PE_INVALID_ALIAS_TOKEN;
-            snprintf(result->error_value, ERROR_BUFFER_SIZE, "%s", option_string);
-            return;
-    }
+    // Every name below the node the prefix leads to starts with the prefix.
+    bool exact;
+    int node = trie_walk(trie, name, length, options, option_size, &exact);
+    if(node != -1)
+        complete_trie_node(completion, prefix, trie, node, options, option_size, used, bit);
 }
 
-static void parse_string(OptionParser* parser, ParseResult* result, char* option_string, int start_index, int* i, char** argv, int argc) {
-    switch(option_string[start_index]) {
-        case '-':
-            if(option_string[start_index + 1] == '-') {
-                parse_name(parser, result, option_string, start_index + 2, i, argv, argc);
-            } else {
-                if(check_flag(parser->flags, PF_TREAT_DASH_AS_FULL_OPTION))
-                    parse_name(parser, result, option_string, start_index + 1, i, argv, argc);
-                else
-                    parse_alias(parser, result, option_string, 1, i, argv, argc);
-            }
-            break;
-        case '/':
-            parse_name(parser, result, option_string, start_index + 1, i, argv, argc);
-            break;
-        default:
-            if(!check_flag(parser->flags, PF_ALLOW_REMAINDER)) {
-                result->error = PE_REMAINDER;
-                snprintf(result->error_value, ERROR_BUFFER_SIZE, "%s", option_string);
-                return;
+static void mark_encountered(ParseResult* result, int bit) {
+    result->encountered[bit / ENCOUNTERED_BITS] |= 1u << (bit % ENCOUNTERED_BITS);
+}
+
+static int complete_name_index(const OptionParser* parser, const char* name, int count) {
+    int index = find_name(name, count, &parser->name_index, (struct OptionBase*)parser->options, sizeof(Option), parser->option_count);
+    if(index == -1 && count == 1 && check_flag(parser->flags, PF_ALWAYS_CHECK_FOR_ALIAS))
+        index = find_alias(parser, name[0]);
+    if(index == -1 && count > 0 && check_flag(parser->flags, PF_ALLOW_ABBREVIATIONS))
+        index = find_prefix(name, count, &parser->name_trie, (struct OptionBase*)parser->options, sizeof(Option), parser->option_count);
+    return index < 0 ? -1 : index;
+}
+
+int oparser_complete(const OptionParser* parser, char** argv, int argc, int cursor, OptionCompletionWriter writer, void* context) {
+    Completion completion = { writer, context, 0, false };
+    if(cursor < 1 || cursor > argc)
+        return 0;
+
+    // The words before the cursor are only matched, which is enough to know which options were used and where the cursor is.
+    ParseResult used;
+    oparser_result_init(&used);
+    if(!begin_parser(parser, &used)) {
+        oparser_result_destroy(&used);
+        return -1;
+    }
+
+    const Option* sub_context = NULL;
+    for(int i = 1; i < cursor; i++) {
+        char* word = argv[i];
+        int length = strlen(word);
+        int count = 0;
+        while(count < length && is_option_char(word[count]))
+            count++;
+
+        if(sub_context != NULL) {
+            const OptionSubParser* subparser = sub_context->sub_options;
+            int index = find_name(word, count, &subparser->name_index, (struct OptionBase*)subparser->options, sizeof(SubOption), subparser->option_count);
+            if(index == -1 && count > 0 && check_flag(subparser->flags, PF_ALLOW_ABBREVIATIONS))
+                index = find_prefix(word, count, &subparser->name_trie, (struct OptionBase*)subparser->options, sizeof(SubOption), subparser->option_count);
+            if(index >= 0) {
+                mark_encountered(&used, sub_options_bit(parser) + index);
+                continue;
             }
+            sub_context = NULL;
+        }
+
+        Token token = { word, length, true };
+        if(!is_option_token(token)) {
+            const OptionParser* subcommand = parser->subcommand_count > 0 ? find_subcommand(parser, &used, token) : NULL;
+            used.error = PE_NONE;
+            if(subcommand != NULL && begin_parser(subcommand, &used))
+                parser = subcommand;
+            continue;
+        }
 
-            if(parser->remainder_count == parser->remainder_capacity) {
-                parser->remainder_capacity *= 2;
-                parser->remainder = realloc(parser->remainder, parser->remainder_capacity * sizeof(char*));
+        const Option* option = NULL;
+        if(word[0] == '/' || word[1] == '-' || check_flag(parser->flags, PF_TREAT_DASH_AS_FULL_OPTION)) {
+            int start = word[0] == '-' && word[1] == '-' ? 2 : 1;
+            int index = complete_name_index(parser, word + start, count - start);
+            if(index != -1)
+                option = parser->options + index;
+        } else {
+            for(int j = 1; j < length && isalnum((unsigned char)word[j]); j++) {
+                int index = find_alias(parser, word[j]);
+                if(index == -1)
+                    break;
+                mark_encountered(&used, index);
+                option = parser->options + index;
             }
-            parser->remainder[parser->remainder_count++] = argv[*i];
-            break;
+        }
+        if(option == NULL)
+            continue;
+
+        mark_encountered(&used, option - parser->options);
+        if(option->sub_options != NULL && sub_options_begin(option->sub_options, &used, sub_options_bit(parser)))
+            sub_context = option;
     }
-}
 
-ParseResult* oparser_parse(OptionParser* parser, char** argv, int argc) {
-    if(parser->remainder_count > 0)
-        parser->remainder_count = 0;
+    const char* word = cursor < argc ? argv[cursor] : "";
+    int length = strlen(word);
+    const struct OptionBase* options = (const struct OptionBase*)parser->options;
+    if(strchr(word, '=') != NULL) {
+        // Values aren't completed.
+    } else if(word[0] == '-' && word[1] == '-') {
+        complete_names(&completion, "--", word + 2, length - 2, &parser->name_trie, options, sizeof(Option), parser->option_count, &used, 0);
+    } else if(word[0] == '/') {
+        complete_names(&completion, "/", word + 1, length - 1, &parser->name_trie, options, sizeof(Option), parser->option_count, &used, 0);
+    } else if(word[0] == '-' && check_flag(parser->flags, PF_TREAT_DASH_AS_FULL_OPTION)) {
+        complete_names(&completion, "-", word + 1, length - 1, &parser->name_trie, options, sizeof(Option), parser->option_count, &used, 0);
+    } else if(word[0] == '-') {
+        // A lone dash could start either an alias or a full name.
+        for(int i = 0; i < parser->option_count && length == 1 && !completion.stopped; i++) {
+            const struct OptionBase* option = &parser->options[i].base;
+            char alias = (char)option->alias;
+            if(is_alias_char(option->alias) && isgraph((unsigned char)alias) && (check_flag(option->flags, OF_DUPLICATES_ALLOWED) || !encountered_bit(&used, i)))
+                complete_candidate(&completion, "-", &alias, 1);
+        }
+        if(length == 1)
+            complete_names(&completion, "--", "", 0, &parser->name_trie, options, sizeof(Option), parser->option_count, &used, 0);
+    } else {
+        if(sub_context != NULL) {
+            const OptionSubParser* subparser = sub_context->sub_options;
+            complete_names(&completion, "", word, length, &subparser->name_trie, (const struct OptionBase*)subparser->options,
+                           sizeof(SubOption), subparser->option_count, &used, sub_options_bit(parser));
+        }
+        for(int i = 0; i < parser->subcommand_count && !completion.stopped; i++) {
+            const struct OptionBase* subcommand = &parser->subcommands[i].base;
+            if(subcommand->name_length >= length && memcmp(subcommand->name, word, length) == 0)
+                complete_candidate(&completion, "", subcommand->name, subcommand->name_length);
+        }
 
-    ParseResult* result = malloc(sizeof(ParseResult));
-    result->error = PE_NONE;
-    result->options_parsed = 0;
-    for(int i = 1; i < argc; i++) {
-        parse_string(parser, result, argv[i], 0, &i, argv, argc);
-        if(result->error != PE_NONE)
-            return result;
-    }
-    struct OptionBase* invalid = verify_required_options((struct OptionBase*)parser->options, sizeof(Option), parser->option_count);
-    if(invalid != NULL) {
-        result->error = PE_REQUIRED_MISSING;
-        snprintf(result->error_value, ERROR_BUFFER_SIZE, "%s", invalid->name);
-        return result;
+        // An empty word with nothing else to offer is completed with the options.
+        if(length == 0 && sub_context == NULL && parser->subcommand_count == 0)
+            complete_names(&completion, "--", "", 0, &parser->name_trie, options, sizeof(Option), parser->option_count, &used, 0);
     }
-    return result;
+
+    oparser_result_destroy(&used);
+    return completion.stopped ? -1 : completion.count;
 }
 
-static char* error_string = NULL;
+static bool write_completion_line(const char* candidate, int length, void* context) {
+    FILE* file = context;
+    return fwrite(candidate, 1, length, file) == (size_t)length && fputc('\n', file) != EOF;
+}
 
-char* oparser_get_error_string(ParseResult* result) {
-    if(result->error == PE_NONE)
-        return NULL;
+bool oparser_run_completion(const OptionParser* parser, char** argv, int argc, FILE* file) {
+    if(argc < 3 || strcmp(argv[1], OPARSER_COMPLETE_OPTION) != 0)
+        return false;
 
-    if(error_string == NULL)
-        error_string = malloc(512);
+    oparser_complete(parser, argv + 3, argc - 3, atoi(argv[2]), write_completion_line, file);
+    fflush(file);
+    return true;
+}
 
-    switch(result->error) {
-        case PE_INVALID_NAME:
-            sprintf(error_string, "Encountered invalid option: %s", result->error_value);
-            break;
-        case PE_INVALID_ALIAS:
-            sprintf(error_string, "Encountered invalid option alias: %s", result->error_value);
-            break;
-        case PE_INVALID_NAME_TOKEN:
-            sprintf(error_string, "Encountered invalid token in option: %s", result->error_value);
-            break;
-        case PE_INVALID_ALIAS_TOKEN:
-            sprintf(error_string, "Encountered invalid token in alias list: %s", result->error_value);
-            break;
-        case PE_DUPLICATE:
-            sprintf(error_string, "Encountered an invalid duplicate option: %s", result->error_value);
-            break;
-        case PE_REQUIRED_MISSING:
-            sprintf(error_string, "Missing required option: %s", result->error_value);
-            break;
-        case PE_VALUE_INVALID:
-            sprintf(error_string, "Missing value after equals sign for option: %s", result->error_value);
-            break;
-        case PE_VALUE_MISSING:
-            sprintf(error_string, "Expected value for option: %s", result->error_value);
+bool oparser_write_completion_script(const char* program, CompletionShell shell, FILE* file) {
+    // Shell functions are named after the program, so anything that can't be part of a name is replaced.
+    char function[256];
+    int length = 0;
+    for(; program[length] != '\0' && length < (int)sizeof(function) - 1; length++)
+        function[length] = isalnum((unsigned char)program[length]) ? program[length] : '_';
+    function[length] = '\0';
+
+    switch(shell) {
+        case CS_BASH:
+            fprintf(file,
+                    "_%s_complete() {\n"
+                    "    local IFS=$'\\n'\n"
+                    "    COMPREPLY=($(\"${COMP_WORDS[0]}\" " OPARSER_COMPLETE_OPTION " \"$COMP_CWORD\" \"${COMP_WORDS[@]}\" 2>/dev/null))\n"
+                    "}\n"
+                    "complete -o default -F _%s_complete %s\n",
+                    function, function, program);
             break;
-        case PE_VALUE_GIVEN:
-            sprintf(error_string, "Cannot set option: %s", result->error_value);
+        case CS_ZSH:
+            fprintf(file,
+                    "#compdef %s\n"
+                    "_%s() {\n"
+                    "    local -a candidates\n"
+                    "    candidates=(\"${(@f)$(\"${words[1]}\" " OPARSER_COMPLETE_OPTION " $((CURRENT - 1)) \"${words[@]}\" 2>/dev/null)}\")\n"
+                    "    compadd -- ${candidates:#}\n"
+                    "}\n"
+                    "compdef _%s %s\n",
+                    program, function, function, program);
             break;
-        case PE_REMAINDER:
-            sprintf(error_string, "Cannot accept non-option value: %s", result->error_value);
+        case CS_FISH:
+            fprintf(file,
+                    "function __%s_complete\n"
+                    "    set -l words (commandline -opc) (commandline -ct)\n"
+                    "    $words[1] " OPARSER_COMPLETE_OPTION " (math (count $words) - 1) $words 2>/dev/null\n"
+                    "end\n"
+                    "complete -c %s -f -a '(__%s_complete)'\n",
+                    function, program, function);
             break;
         default:
-            sprintf(error_string, "Encountered unknown error: %d", result->error);
-            break;
+            return false;
     }
-    return error_string;
+    return !ferror(file);
 }
 
-void oparser_result_free(ParseResult* result) {
-    if(error_string != NULL) {
-        free(error_string);
-        error_string = NULL;
+const OptionValue* oparser_result_values(const ParseResult* result, const char* name, int* count) {
+    *count = 0;
+    const struct CollectedValues* collected = result->collected;
+    if(collected == NULL)
+        return NULL;
+
+    for(int i = 0; i < collected->group_count; i++) {
+        const ValueGroup* group = collected->groups + i;
+        const char* option_name = name;
+        if(group->parent_name != NULL) {
+            int parent_length = strlen(group->parent_name);
+            if(strncmp(name, group->parent_name, parent_length) != 0 || name[parent_length] != '.')
+                continue;
+            option_name = name + parent_length + 1;
+        }
+        if(strcmp(option_name, group->option->name) == 0) {
+            *count = group->count;
+            return collected->values + group->start;
+        }
     }
-    free(result);
+    return NULL;
 }
 
-static char* suboption_doc_string(SubOption* option, int doc_start) {
-    int size = 256;
-    int offset = 0;
-    char* buffer = malloc(256);
-    if(!buffer)
+char** oparser_result_remainder(ParseResult* result, int* count) {
+    *count = result->remainder_count;
+    return result->remainder;
+}
+
+char** oparser_remainder(OptionParser* parser, int* count) {
+    if(!check_flag(parser->flags, PF_ALLOW_REMAINDER))
         return NULL;
+    
+    *count = parser->remainder_count;
+    return parser->remainder;
+}
 
-    bool required = check_flag(option->base.flags, OF_REQUIRED);
+// Describes the layout of a snapshot. Every offset is from the start of the snapshot.
+typedef struct SnapshotHeader {
+    char magic[8];
+    uint32_t version;
 
-    offset += snprintf(buffer + offset, size - offset, "  ");
+    // The sizes of the structs in the snapshot, so snapshots from an incompatible build are rejected.
+    uint32_t pointer_size;
+    uint32_t parser_size;
+    uint32_t option_size;
+    uint32_t suboption_size;
+    uint32_t subparser_size;
 
-    if(check_flag(option->base.flags, OF_REQUIRED)) {
-        offset += snprintf(buffer + offset, size - offset, "[%s]", option->base.name);
-    } else {
-        offset += snprintf(buffer + offset, size - offset, "%s", option->base.name);
+    // The page size the snapshot was written with.
+    uint32_t page_size;
+
+    // The address that the pointers in the snapshot are valid at.
+    uint64_t base;
+
+    // The size of the whole snapshot.
+    uint64_t size;
+
+    // An image of the OptionParser.
+    uint64_t parser_offset;
+
+    // The offsets of every pointer in the snapshot, which are adjusted if it can't be mapped at base.
+    uint64_t relocation_offset;
+    uint64_t relocation_count;
+
+    // The page aligned section that holds the subparsers, which stays writable so their handlers can be set.
+    uint64_t writable_offset;
+} SnapshotHeader;
+
+typedef struct SnapshotWriter {
+    char* data;
+    size_t size;
+    size_t capacity;
+    uint64_t* relocations;
+    size_t relocation_count;
+    size_t relocation_capacity;
+    uint64_t base;
+    bool failed;
+} SnapshotWriter;
+
+static uint64_t snapshot_base() {
+    // An address that is usually free, so the snapshot can be mapped without touching any of its pages.
+    // 32 bit processes don't have the room, so their snapshots are always relocated.
+    return sizeof(void*) == 8 ? (uint64_t)0x200000000000ull : 0;
+}
+
+static size_t snapshot_reserve(SnapshotWriter* writer, size_t size, size_t alignment) {
+    size_t offset = (writer->size + alignment - 1) & ~(alignment - 1);
+    if(offset + size > writer->capacity) {
+        size_t capacity = writer->capacity == 0 ? 4096 : writer->capacity;
+        while(capacity < offset + size)
+            capacity *= 2;
+        char* data = realloc(writer->data, capacity);
+        if(!data) {
+            writer->failed = true;
+            return 0;
+        }
+        writer->data = data;
+        writer->capacity = capacity;
     }
+    memset(writer->data + writer->size, 0, offset + size - writer->size);
+    writer->size = offset + size;
+    return offset;
+}
 
-    offset += snprintf(buffer + offset, size - offset, "%-*s %s\n", doc_start - offset, "", option->base.doc_string);
-    return buffer;
+static void snapshot_pointer(SnapshotWriter* writer, size_t field, size_t target) {
+    if(writer->failed)
+        return;
+
+    if(writer->relocation_count == writer->relocation_capacity) {
+        size_t capacity = writer->relocation_capacity == 0 ? 64 : writer->relocation_capacity * 2;
+        uint64_t* relocations = realloc(writer->relocations, capacity * sizeof(uint64_t));
+        if(!relocations) {
+            writer->failed = true;
+            return;
+        }
+        writer->relocations = relocations;
+        writer->relocation_capacity = capacity;
+    }
+    writer->relocations[writer->relocation_count++] = field;
+
+    uintptr_t address = (uintptr_t)(writer->base + target);
+    memcpy(writer->data + field, &address, sizeof(uintptr_t));
 }
 
-static char* option_doc_string(Option* option, int doc_start) {
-    int size;
-    if(option->sub_options != NULL)
-        size = 256 + option->sub_options->option_count * 256;
-    else
-        size = 256;
-    int offset = 0;
+static void snapshot_string(SnapshotWriter* writer, size_t field, const char* string) {
+    if(string == NULL)
+        return;
+    size_t length = strlen(string) + 1;
+    size_t offset = snapshot_reserve(writer, length, 1);
+    if(writer->failed)
+        return;
+    memcpy(writer->data + offset, string, length);
+    snapshot_pointer(writer, field, offset);
+}
 
-    char* buffer = malloc(size);
-    if(!buffer)
-        return NULL;
-    bool required = check_flag(option->base.flags, OF_REQUIRED);
+static void snapshot_index(SnapshotWriter* writer, size_t field, const OptionNameIndex* index) {
+    if(index->capacity == 0)
+        return;
+    size_t offset = snapshot_reserve(writer, index->capacity * sizeof(int), _Alignof(int));
+    if(writer->failed)
+        return;
+    memcpy(writer->data + offset, index->slots, index->capacity * sizeof(int));
+    snapshot_pointer(writer, field + offsetof(OptionNameIndex, slots), offset);
+}
 
-    offset += snprintf(buffer + offset, size - offset, "  ");
+static void snapshot_trie(SnapshotWriter* writer, size_t field, const OptionNameTrie* trie) {
+    // Labels are ranges of the option names, so the nodes are copied as they are.
+    if(trie->count == 0)
+        return;
+    size_t offset = snapshot_reserve(writer, trie->count * sizeof(NameTrieNode), _Alignof(NameTrieNode));
+    if(writer->failed)
+        return;
+    memcpy(writer->data + offset, trie->nodes, trie->count * sizeof(NameTrieNode));
+    snapshot_pointer(writer, field + offsetof(OptionNameTrie, nodes), offset);
+}
 
-    if(!required)
-        offset += snprintf(buffer + offset, size - offset, "[");
+static void snapshot_base_fields(SnapshotWriter* writer, size_t offset, const struct OptionBase* option) {
+    snapshot_string(writer, offset + offsetof(struct OptionBase, name), option->name);
+    snapshot_string(writer, offset + offsetof(struct OptionBase, doc_string), option->doc_string);
+}
 
-    offset += snprintf(buffer + offset, size - offset, "--%s", option->base.name);
+static bool snapshot_build(OptionParser* parser, SnapshotWriter* writer) {
+    // Subcommand builders only exist inside of this process.
+    if(parser->subcommand_count > 0)
+        return false;
 
-    if(isascii(option->base.alias))
-        offset += snprintf(buffer + offset, size - offset, "|-%c", option->base.alias);
+    // Addresses only make sense inside of the process that bound them.
+    for(int i = 0; i < parser->option_count; i++) {
+        Option* option = parser->options + i;
+        if(option->base.binding == OB_ADDRESS)
+            return false;
+        for(int j = 0; option->sub_options != NULL && j < option->sub_options->option_count; j++) {
+            if(option->sub_options->options[j].base.binding == OB_ADDRESS)
+                return false;
+        }
+    }
 
-    if(!required)
-        offset += snprintf(buffer + offset, size - offset, "]");
+    const char* help = oparser_cached_help(parser);
+    if(!help)
+        return false;
 
-    offset += snprintf(buffer + offset, size - offset, "%-*s %s\n", doc_start - offset, "", option->base.doc_string);
+    size_t header_offset = snapshot_reserve(writer, sizeof(SnapshotHeader), _Alignof(max_align_t));
+    size_t parser_offset = snapshot_reserve(writer, sizeof(OptionParser), _Alignof(max_align_t));
+    size_t options_offset = snapshot_reserve(writer, parser->option_count * sizeof(Option), _Alignof(max_align_t));
+    if(writer->failed)
+        return false;
 
-    if(option->sub_options != NULL) {
-        for(int i = 0; i < option->sub_options->option_count; i++) {
-            char* sub_help = suboption_doc_string(option->sub_options->options + i, doc_start - 2);
-            if(!sub_help) {
-                free(buffer);
-                return NULL;
-            }
-            offset += snprintf(buffer + offset, size - offset, "  %s", sub_help);
-            free(sub_help);
+    // The parser keeps its indexes and flags, but nothing that belongs to this process.
+    OptionParser image;
+    memset(&image, 0, sizeof(OptionParser));
+    image.option_count = parser->option_count;
+    image.name_index.capacity = parser->name_index.capacity;
+    image.name_trie.count = parser->name_trie.count;
+    image.name_trie.capacity = parser->name_trie.count;
+    image.environment_count = parser->environment_count;
+    image.environment_capacity = parser->environment_count;
+    image.environment_index.capacity = parser->environment_index.capacity;
+    image.config_file_count = parser->config_file_count;
+    image.config_file_capacity = parser->config_file_count;
+    if(parser->option_capacity == 0) {
+        // Static tables don't keep an alias index, but a snapshot always uses one.
+        memset(image.alias_index, -1, sizeof(image.alias_index));
+        for(int i = parser->option_count - 1; i >= 0; i--) {
+            if(is_alias_char(parser->options[i].base.alias))
+                image.alias_index[parser->options[i].base.alias] = i;
         }
+    } else {
+        memcpy(image.alias_index, parser->alias_index, sizeof(image.alias_index));
     }
-    return buffer;
-}
+    image.flags = parser->flags;
+    image.schema_version = 1;
+    image.help_version = 1;
+    image.help_length = parser->help_length;
+    image.option_help_index = -1;
+    memcpy(writer->data + parser_offset, &image, sizeof(OptionParser));
+    if(parser->option_count > 0)
+        snapshot_pointer(writer, parser_offset + offsetof(OptionParser, options), options_offset);
+    snapshot_index(writer, parser_offset + offsetof(OptionParser, name_index), &parser->name_index);
+    snapshot_trie(writer, parser_offset + offsetof(OptionParser, name_trie), &parser->name_trie);
+    snapshot_string(writer, parser_offset + offsetof(OptionParser, help), help);
 
-char* oparser_help(OptionParser* parser) {
-    int size = 0;
-    int offset = 0;
-    int doc_start = 0;
     for(int i = 0; i < parser->option_count; i++) {
-        if(parser->options[i].base.name_length + 10 > doc_start)
-            doc_start = parser->options[i].base.name_length + 10;
+        Option option = parser->options[i];
+        option.sub_options = NULL;
+        option.parser = NULL;
+        option.help = NULL;
+        option.help_version = 0;
+        size_t offset = options_offset + i * sizeof(Option);
+        memcpy(writer->data + offset, &option, sizeof(Option));
+        snapshot_base_fields(writer, offset, &option.base);
+    }
 
-        size += 256;
-        if(parser->options[i].sub_options != NULL) {
-            OptionSubParser* subparser = parser->options[i].sub_options;
-            for(int j = 0; j < subparser->option_count; j++) {
-                size += 256;
-                if(subparser->options[j].base.name_length + 6 > doc_start)
-                    doc_start = subparser->options[j].base.name_length + 6;
-            }
+    if(parser->environment_count > 0) {
+        size_t environment_offset = snapshot_reserve(writer, parser->environment_count * sizeof(struct OptionEnvironment), _Alignof(max_align_t));
+        for(int i = 0; i < parser->environment_count && !writer->failed; i++) {
+            size_t offset = environment_offset + i * sizeof(struct OptionEnvironment);
+            memcpy(writer->data + offset, parser->environment + i, sizeof(struct OptionEnvironment));
+            snapshot_base_fields(writer, offset, &parser->environment[i].base);
         }
+        snapshot_pointer(writer, parser_offset + offsetof(OptionParser, environment), environment_offset);
+        snapshot_index(writer, parser_offset + offsetof(OptionParser, environment_index), &parser->environment_index);
     }
-    char* buffer = malloc(size);
-    if(!buffer)
-        return NULL;
+
+    if(parser->config_file_count > 0) {
+        size_t files_offset = snapshot_reserve(writer, parser->config_file_count * sizeof(char*), _Alignof(char*));
+        for(int i = 0; i < parser->config_file_count; i++)
+            snapshot_string(writer, files_offset + i * sizeof(char*), parser->config_files[i]);
+        snapshot_pointer(writer, parser_offset + offsetof(OptionParser, config_files), files_offset);
+    }
+
+    // Sub-options follow the options, with the subparsers themselves kept apart in the writable section.
+    int subparser_count = 0;
+    size_t* suboption_offsets = calloc(parser->option_count > 0 ? parser->option_count : 1, sizeof(size_t));
+    if(!suboption_offsets)
+        return false;
     for(int i = 0; i < parser->option_count; i++) {
-        char* option_string = option_doc_string(parser->options + i, doc_start);
-        if(!option_string) {
-            free(buffer);
-            return NULL;
+        OptionSubParser* subparser = parser->options[i].sub_options;
+        if(subparser == NULL)
+            continue;
+        subparser_count++;
+        size_t offset = snapshot_reserve(writer, subparser->option_count * sizeof(SubOption), _Alignof(max_align_t));
+        if(writer->failed)
+            break;
+        suboption_offsets[i] = offset;
+        for(int j = 0; j < subparser->option_count; j++) {
+            SubOption* suboption = subparser->options + j;
+            memcpy(writer->data + offset + j * sizeof(SubOption), suboption, sizeof(SubOption));
+            snapshot_base_fields(writer, offset + j * sizeof(SubOption), &suboption->base);
         }
-        offset += snprintf(buffer + offset, size - offset, "%s", option_string);
-        free(option_string);
     }
-    return buffer;
-}
 
-char* oparser_option_help(OptionParser* parser, char* option_name) {
-    int option_index = scan_for_name(option_name, (struct OptionBase*)parser->options, sizeof(Option), parser->option_count);
-    if(option_index == -1)
-        return NULL;
+    size_t writable_offset = snapshot_reserve(writer, 0, page_size());
+    size_t subparsers_offset = snapshot_reserve(writer, subparser_count * sizeof(OptionSubParser), page_size());
+    for(int i = 0, next = 0; i < parser->option_count && !writer->failed; i++) {
+        OptionSubParser* subparser = parser->options[i].sub_options;
+        if(subparser == NULL)
+            continue;
+        size_t offset = subparsers_offset + next++ * sizeof(OptionSubParser);
+
+        OptionSubParser image;
+        memset(&image, 0, sizeof(OptionSubParser));
+        image.option_count = subparser->option_count;
+        image.name_index.capacity = subparser->name_index.capacity;
+        image.name_trie.count = subparser->name_trie.count;
+        image.name_trie.capacity = subparser->name_trie.count;
+        image.flags = subparser->flags;
+        memcpy(writer->data + offset, &image, sizeof(OptionSubParser));
+        if(subparser->option_count > 0)
+            snapshot_pointer(writer, offset + offsetof(OptionSubParser, options), suboption_offsets[i]);
+        snapshot_index(writer, offset + offsetof(OptionSubParser, name_index), &subparser->name_index);
+        snapshot_trie(writer, offset + offsetof(OptionSubParser, name_trie), &subparser->name_trie);
+        snapshot_pointer(writer, options_offset + i * sizeof(Option) + offsetof(Option, sub_options), offset);
+    }
+    free(suboption_offsets);
 
-    int doc_start = parser->options[option_index].base.name_length + 10;
+    // The relocations come last, since they're only read if the snapshot has to be moved.
+    size_t relocation_count = writer->relocation_count;
+    size_t relocation_offset = snapshot_reserve(writer, relocation_count * sizeof(uint64_t), _Alignof(uint64_t));
+    if(writer->failed)
+        return false;
+    memcpy(writer->data + relocation_offset, writer->relocations, relocation_count * sizeof(uint64_t));
 
-    if(parser->options[option_index].sub_options != NULL) {
-        OptionSubParser* subparser = parser->options[option_index].sub_options;
-        for(int i = 0; i < subparser->option_count; i++) {
-            if(subparser->options[i].base.name_length + 6 > doc_start)
-                doc_start = subparser->options[i].base.name_length + 6;
-        }
+    SnapshotHeader header;
+    memset(&header, 0, sizeof(SnapshotHeader));
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = SNAPSHOT_VERSION;
+    header.pointer_size = sizeof(void*);
+    header.parser_size = sizeof(OptionParser);
+    header.option_size = sizeof(Option);
+    header.suboption_size = sizeof(SubOption);
+    header.subparser_size = sizeof(OptionSubParser);
+    header.page_size = page_size();
+    header.base = writer->base;
+    header.size = writer->size;
+    header.parser_offset = parser_offset;
+    header.relocation_offset = relocation_offset;
+    header.relocation_count = relocation_count;
+    header.writable_offset = writable_offset;
+    memcpy(writer->data + header_offset, &header, sizeof(SnapshotHeader));
+    return true;
+}
+
+bool oparser_save_snapshot(OptionParser* parser, const char* path) {
+    SnapshotWriter writer = { NULL, 0, 0, NULL, 0, 0, snapshot_base(), false };
+    bool success = snapshot_build(parser, &writer) && !writer.failed;
+    if(success) {
+        FILE* file = fopen(path, "wb");
+        success = file != NULL && fwrite(writer.data, 1, writer.size, file) == writer.size;
+        if(file != NULL && fclose(file) != 0)
+            success = false;
     }
+    free(writer.data);
+    free(writer.relocations);
+    return success;
+}
 
-    return option_doc_string(parser->options + option_index, doc_start);
+static bool snapshot_header_is_valid(const SnapshotHeader* header, size_t size) {
+    return memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic)) == 0
+        && header->version == SNAPSHOT_VERSION
+        && header->pointer_size == sizeof(void*)
+        && header->parser_size == sizeof(OptionParser)
+        && header->option_size == sizeof(Option)
+        && header->suboption_size == sizeof(SubOption)
+        && header->subparser_size == sizeof(OptionSubParser)
+        && header->size == size
+        // The offsets are checked against what's left of the file, so that a corrupted header can't wrap around.
+        && size >= sizeof(OptionParser)
+        && header->parser_offset <= size - sizeof(OptionParser)
+        && header->writable_offset <= size
+        && header->relocation_offset <= size
+        && header->relocation_count <= (size - header->relocation_offset) / sizeof(uint64_t);
 }
 
-char* oparser_suboption_help(OptionParser* parser, char* option_name, char* suboption_name) {
-    int option_index = scan_for_name(option_name, (struct OptionBase*)parser->options, sizeof(Option), parser->option_count);
-    if(option_index == -1)
+static bool snapshot_relocate(char* data, const SnapshotHeader* header) {
+    uintptr_t delta = (uintptr_t)data - (uintptr_t)header->base;
+    const char* relocations = data + header->relocation_offset;
+    for(uint64_t i = 0; i < header->relocation_count; i++) {
+        uint64_t field;
+        memcpy(&field, relocations + i * sizeof(uint64_t), sizeof(uint64_t));
+        if(field > header->size - sizeof(uintptr_t))
+            return false;
+
+        uintptr_t address;
+        memcpy(&address, data + field, sizeof(uintptr_t));
+        address += delta;
+        memcpy(data + field, &address, sizeof(uintptr_t));
+    }
+    return true;
+}
+
+static char* snapshot_map(const char* path, size_t* size) {
+#ifdef _WIN32
+    // Without mmap, the snapshot is read into memory and always relocated.
+    FILE* file = fopen(path, "rb");
+    if(!file)
+        return NULL;
+    char* data = NULL;
+    long length = -1;
+    if(fseek(file, 0, SEEK_END) == 0 && (length = ftell(file)) >= (long)sizeof(SnapshotHeader)) {
+        rewind(file);
+        data = malloc(length);
+        if(data != NULL && fread(data, 1, length, file) != (size_t)length) {
+            free(data);
+            data = NULL;
+        }
+    }
+    fclose(file);
+    if(!data)
         return NULL;
 
-    Option* option = parser->options + option_index;
-    if(option->sub_options == NULL)
+    SnapshotHeader header;
+    memcpy(&header, data, sizeof(SnapshotHeader));
+    if(!snapshot_header_is_valid(&header, length) || !snapshot_relocate(data, &header)) {
+        free(data);
+        return NULL;
+    }
+    *size = length;
+    return data;
+#else
+    int descriptor = open(path, O_RDONLY);
+    if(descriptor == -1)
         return NULL;
 
-    option_index = scan_for_name(suboption_name, (struct OptionBase*)option->sub_options->options, sizeof(SubOption), option->sub_options->option_count);
-    if(option_index == -1)
+    struct stat info;
+    if(fstat(descriptor, &info) == -1 || info.st_size < (off_t)sizeof(SnapshotHeader)) {
+        close(descriptor);
         return NULL;
+    }
 
-    return suboption_doc_string(option->sub_options->options + option_index, option->sub_options->options[option_index].base.name_length + 4);
-}
+    // Asks for the address the snapshot was written for. If it's free, nothing has to be touched,
+    // and only the header and the pages the parser actually uses are ever read.
+    void* base = (void*)(uintptr_t)snapshot_base();
+    char* data = mmap(base, info.st_size, PROT_READ, MAP_PRIVATE, descriptor, 0);
+    if(data == MAP_FAILED) {
+        close(descriptor);
+        return NULL;
+    }
 
-char* oparser_option_docstring(OptionParser* parser, char* option_name) {
-    int option_index = scan_for_name(option_name, (struct OptionBase*)parser->options, sizeof(Option), parser->option_count);
-    if(option_index == -1)
+    SnapshotHeader header;
+    memcpy(&header, data, sizeof(SnapshotHeader));
+    if(!snapshot_header_is_valid(&header, info.st_size) || header.writable_offset % page_size() != 0) {
+        munmap(data, info.st_size);
+        close(descriptor);
         return NULL;
+    }
 
-    return parser->options[option_index].base.doc_string;
+    if((uintptr_t)data != (uintptr_t)header.base) {
+        // Otherwise the mapping is moved, which means fixing up every pointer.
+        munmap(data, info.st_size);
+        data = mmap(NULL, info.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, descriptor, 0);
+        if(data == MAP_FAILED) {
+            close(descriptor);
+            return NULL;
+        }
+        if(!snapshot_relocate(data, &header)) {
+            munmap(data, info.st_size);
+            close(descriptor);
+            return NULL;
+        }
+        mprotect(data, header.writable_offset, PROT_READ);
+    } else if(header.writable_offset < header.size) {
+        mprotect(data + header.writable_offset, header.size - header.writable_offset, PROT_READ | PROT_WRITE);
+    }
+    close(descriptor);
+    *size = info.st_size;
+    return data;
+#endif
 }
 
-char* oparser_suboption_docstring(OptionParser* parser, char* option_name, char* suboption_name) {
-    int option_index = scan_for_name(option_name, (struct OptionBase*)parser->options, sizeof(Option), parser->option_count);
-    if(option_index == -1)
-        return NULL;
-
-    OptionSubParser* subparser = parser->options[option_index].sub_options;
-    if(subparser == NULL)
+OptionParser* oparser_load_snapshot(const char* path, OptionHandler handler, void* data) {
+    size_t size;
+    char* snapshot = snapshot_map(path, &size);
+    if(!snapshot)
         return NULL;
 
-    option_index = scan_for_name(suboption_name, (struct OptionBase*)subparser->options, sizeof(SubOption), subparser->option_count);
-    if(option_index == -1)
+    OptionParser* parser = malloc(sizeof(OptionParser));
+    if(!parser) {
+        snapshot_unmap(snapshot, size);
         return NULL;
+    }
 
-    return subparser->options[option_index].base.doc_string;
+    SnapshotHeader header;
+    memcpy(&header, snapshot, sizeof(SnapshotHeader));
+    memcpy(parser, snapshot + header.parser_offset, sizeof(OptionParser));
+    parser->handler = handler;
+    parser->data = data;
+    parser->snapshot = snapshot;
+    parser->snapshot_size = size;
+    return parser;
 }
 
-char** oparser_remainder(OptionParser* parser, int* count) {
-    if(!check_flag(parser->flags, PF_ALLOW_REMAINDER))
-        return NULL;
-    
-    *count = parser->remainder_count;
-    return parser->remainder;
-}
\ No newline at end of file
+bool oparser_set_subparser_handler(OptionParser* parser, int alias, OptionHandler handler, void* data) {
+    if(!is_alias_char(alias))
+        return false;
+
+    int option_index = find_alias(parser, alias);
+    if(option_index == -1 || parser->options[option_index].sub_options == NULL)
+        return false;
+
+    OptionSubParser* subparser = parser->options[option_index].sub_options;
+    subparser->handler = handler;
+    subparser->data = data;
+    return true;
+}
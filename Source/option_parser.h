@@ -2,6 +2,8 @@
 #define OPTIONS_PARSER_OPTION_PARSER_H
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
 
 // Define Option Types
 
@@ -11,12 +13,82 @@
 
 typedef void (*OptionHandler)(char*, int, char*, void*);
 
+// Receives a piece of help text that isn't null terminated.
+// Returns false to stop writing, for example if the output could not be written.
+typedef bool (*OptionHelpWriter)(const char*, int, void*);
+
+// Receives a completion candidate that isn't null terminated.
+// Returns false to stop completing, for example if the candidate could not be written.
+typedef bool (*OptionCompletionWriter)(const char*, int, void*);
+
+// Determines how the value of an option is validated and converted by the parser.
+typedef enum OptionType {
+    // The value is passed along as text.
+    OT_STRING,
+
+    // A decimal integer with an optional sign.
+    OT_INT,
+
+    // A decimal number with an optional fraction and exponent.
+    OT_DOUBLE,
+
+    // One of true/false, yes/no, on/off or 1/0, ignoring case. The value is optional and defaults to true.
+    OT_BOOL,
+
+    // A number of bytes with an optional k, M, G or T suffix, each 1024 times the last. The suffix may be followed by B or iB.
+    OT_SIZE,
+
+    // One or more numbers with ns, us, ms, s, m or h units, such as 1h30m or 1.5s. A single number without a unit is in seconds.
+    OT_DURATION
+} OptionType;
+
+// A view of an option value that isn't necessarily null terminated.
+typedef struct OptionValue {
+    // The first character of the value.
+    const char* text;
+
+    // The number of characters in the value.
+    int length;
+
+    // The type of the option, which determines which of the converted values is set.
+    OptionType type;
+
+    union {
+        // Set for OT_INT.
+        long long integer;
+
+        // Set for OT_DOUBLE.
+        double number;
+
+        // Set for OT_BOOL.
+        bool boolean;
+
+        // Set for OT_SIZE, in bytes.
+        unsigned long long size;
+
+        // Set for OT_DURATION, in nanoseconds.
+        long long duration;
+    };
+} OptionValue;
+
+// Builds the parser of a subcommand the first time it's used. Receives the name of the subcommand and the data it was registered with.
+// Returns the parser, which is then owned by the parent parser, or NULL if it couldn't be built.
+typedef struct OptionParser* (*SubcommandBuilder)(const char*, void*);
+
+// A handler that receives option values as views into the parsed text instead of strings.
+// The value is NULL if the option wasn't given one, except for OT_BOOL options which are then given a value of true.
+typedef void (*OptionValueHandler)(char*, int, const OptionValue*, void*);
+
+// A handler that receives every value of an option with OF_COLLECT_VALUES at once, along with the number of values.
+// Invoked after a successful parse. The values are in the order they were given, and are owned by the ParseResult.
+typedef void (*OptionListHandler)(char*, int, const OptionValue*, int, void*);
+
 // Defines flags that modify Option behaviour.
 typedef enum OptionFlags {
     // default behaviour.
     OF_NONE = 0,
 
-    // Determines if the option has been encountered. Should not be used by user.
+    // Reserved. Encountered options are now tracked by the ParseResult instead of the option flags.
     ___OF_ENCOUNTERED = 1,
 
     // Determines if the option is required.
@@ -29,7 +101,12 @@ typedef enum OptionFlags {
     OF_VALUE_NOT_ALLOWED = 8,
 
     // Determines if the option is allowed to appear multiple times.
-    OF_DUPLICATES_ALLOWED = 16
+    OF_DUPLICATES_ALLOWED = 16,
+
+    // Collects the values of the option into one list in the parse result, instead of invoking the handler for each of them.
+    // The list is given to the list handler once the parse has finished, and can be read with 'oparser_result_values'.
+    // Meant to be combined with OF_DUPLICATES_ALLOWED.
+    OF_COLLECT_VALUES = 32
 } OptionFlags;
 
 // Defines flags that modify Parser behaviour.
@@ -46,10 +123,35 @@ typedef enum ParserFlags {
     // Determines if the string after a single dash is processed as an option name or as a set of flags.
     PF_TREAT_DASH_AS_FULL_OPTION = 4,
 
-    // Allows standalone flags to be set (e.g. -f=flag_value)
-    PF_SETTABLE_FLAGS = 8
+    // Allows standalone flags to be set (e.g. -f=flag_value), which is also how a value is given to the alias of an option with OF_VALUE_REQUIRED.
+    PF_SETTABLE_FLAGS = 8,
+
+    // Replaces arguments of the form @path with the arguments contained in the file at path.
+    // The arguments in the file are separated by whitespace, and can be quoted with single or double quotes.
+    PF_RESPONSE_FILES = 16,
+
+    // Allows options and sub-options to be given by any prefix of their name that only one of them starts with (e.g. --verb for --verbose).
+    // An exact name or alias always wins over a prefix.
+    PF_ALLOW_ABBREVIATIONS = 32,
+
+    // Keeps parsing after an error and collects every error in the result, instead of stopping at the first one.
+    // Handlers aren't invoked and bound options aren't stored, so the parse only checks the arguments.
+    PF_COLLECT_ERRORS = 64
 } ParserFlags;
 
+// The argument that 'oparser_run_completion' and the scripts from 'oparser_write_completion_script' use to ask a program for completions.
+#define OPARSER_COMPLETE_OPTION "--__complete"
+
+// The shells that 'oparser_write_completion_script' can write scripts for.
+typedef enum CompletionShell {
+    CS_BASH,
+    CS_ZSH,
+    CS_FISH
+} CompletionShell;
+
+// The maximum number of response files that can be nested inside of each other.
+#define OPARSER_RESPONSE_FILE_DEPTH 8
+
 
 // Defines the possible error states of the OptionParser.
 typedef enum ParseError {
@@ -85,9 +187,64 @@ typedef enum ParseError {
 
     // There was a non-option value.
     PE_REMAINDER,
+
+    // There wasn't enough memory to track the state of the parse.
+    PE_OUT_OF_MEMORY,
+
+    // A response file couldn't be read.
+    PE_RESPONSE_FILE,
+
+    // Response files were nested deeper than OPARSER_RESPONSE_FILE_DEPTH.
+    PE_RESPONSE_FILE_NESTING,
+
+    // A quote in a command string or a response file was never closed.
+    PE_UNMATCHED_QUOTE,
+
+    // The value of a typed option couldn't be converted to its type.
+    PE_VALUE_CONVERSION,
+
+    // An abbreviated option name was the prefix of more than one option.
+    PE_AMBIGUOUS_NAME,
+
+    // The builder of a subcommand didn't return a parser.
+    PE_SUBCOMMAND_FAILED,
+
+    // A config file exists but couldn't be read.
+    PE_CONFIG_FILE,
+
+    // A line of a config file wasn't a comment, a [section] or a key with an optional value.
+    PE_CONFIG_SYNTAX,
 } ParseError;
 
+// The number of non-option values a ParseResult can hold before allocating memory.
+#define OPARSER_RESULT_INLINE_REMAINDER 16
+
+// The number of encountered words a ParseResult can hold before allocating memory.
+// Each word tracks 32 options or sub-options.
+#define OPARSER_RESULT_INLINE_WORDS 64
+
+// An error collected by a parser with PF_COLLECT_ERRORS.
+typedef struct ParseErrorEntry {
+    // The error that was encountered.
+    ParseError error;
+
+    // The index of the argument that caused the error, or -1 if it wasn't caused by one, like a missing required option.
+    // Arguments read from a response file report the index of the response file argument.
+    int argument;
+
+    // Where the part of the argument that caused the error starts, relative to the start of the argument.
+    int start;
+
+    // The length of the part of the argument that caused the error.
+    int length;
+
+    // A string related to the error, like error_value. Stored in the result until it's reused.
+    const char* value;
+} ParseErrorEntry;
+
 // Contains the result of the parser.
+// Also holds all of the state of a single parse, so that a parser can be shared between threads.
+// Points into its own storage, so it must not be copied once it has been initialized.
 typedef struct ParseResult {
     // The error that was encountered, or PE_NONE if the parse was successful.
     ParseError error;
@@ -95,10 +252,172 @@ typedef struct ParseResult {
     // Contains a string related to the error that can be used to generate an error message.
     char error_value[256];
 
-    // Determines how many options were successfully parsed.
+    // Holds the message returned by 'oparser_get_error_string'. Only written when the message is requested.
+    char error_string[320];
+
+    // The options an invalid name was looked up in, if the error is PE_INVALID_NAME.
+    // Lets similar names be suggested when the message is formatted, so the parser must still exist at that point.
+    const struct OptionBase* error_options;
+
+    // The size of each element of error_options.
+    int error_option_size;
+
+    // The number of options in error_options.
+    int error_option_count;
+
+    // Where the invalid name starts in error_value.
+    int error_name_start;
+
+    // The length of the invalid name in error_value.
+    int error_name_length;
+
+    // Determines how many options were successfully parsed. Every option counts once, whether it was given by name or by alias,
+    // with or without a value, or taken from the environment or a config file. Sub-options aren't counted.
     int options_parsed;
+
+    // The non-option values used to start the program, if the parser has PF_ALLOW_REMAINDER.
+    char** remainder;
+
+    // The number of non-option values.
+    int remainder_count;
+
+    // The number of non-option values that can be held before reallocating memory.
+    int remainder_capacity;
+
+    // A bitset that determines which options have been encountered.
+    // The bits of the options are followed by the bits of the sub-options currently being parsed.
+    unsigned int* encountered;
+
+    // The number of words that encountered can hold before reallocating memory.
+    int encountered_capacity;
+
+    // If set, handler calls are recorded here instead of being invoked. Used by 'oparser_parse_batch'.
+    struct HandlerLog* handler_log;
+
+    // The response files read by the parse. Arguments from these files point directly into them,
+    // so they stay in memory until the result is reused or destroyed.
+    struct MappedFile* mapped_files;
+
+    // The number of response files read by the parse.
+    int mapped_file_count;
+
+    // The number of response files that can be tracked before reallocating memory.
+    int mapped_file_capacity;
+
+    // Holds arguments that had to be unescaped or null terminated. Reused by the next parse.
+    struct ScratchBlock* scratch;
+
+    // The base address that values of options bound with an offset are stored relative to.
+    // If NULL, the data object of the parser or subparser is used instead.
+    void* target;
+
+    // The parser of the innermost subcommand that was reached, or NULL if there wasn't one.
+    // The arguments after a subcommand are parsed by its parser.
+    const struct OptionParser* subcommand;
+
+    // The name of the innermost subcommand that was reached, or NULL if there wasn't one.
+    const char* subcommand_name;
+
+    // The parser that 'oparser_feed' passes tokens to. Switches over to a subcommand once one is reached.
+    const struct OptionParser* push_parser;
+
+    // The option whose sub-options 'oparser_feed' is parsing, or NULL if there isn't one.
+    const struct Option* push_option;
+
+    // The environment variables that options fall back to, in the same NAME=value form as environ.
+    // If NULL, the environment of the process is used. Lets command lines be checked against another environment.
+    char** environment;
+
+    // The errors collected by a parser with PF_COLLECT_ERRORS, in the order they were encountered.
+    // The first one is also stored in error and error_value.
+    ParseErrorEntry* errors;
+
+    // The number of collected errors.
+    int error_count;
+
+    // The number of errors that can be collected before reallocating memory.
+    int error_capacity;
+
+    // Determines if errors are collected instead of ending the parse. Taken from the flags of the parser when a parse starts.
+    bool collect_errors;
+
+    // Determines if @path arguments are replaced with the contents of the file. Taken from the flags of the top-level parser
+    // when a parse starts, so that it doesn't change once a subcommand is reached.
+    bool expand_response_files;
+
+    // The part of the argument being parsed that caused the current error, which collected errors point at.
+    // NULL if the error is about the whole argument.
+    const char* error_span;
+
+    // The length of error_span.
+    int error_span_length;
+
+    // The index of the argument being parsed, which collected errors refer to.
+    // Counts from 1 for program arguments, and from 0 for the words of a command string and the tokens given to 'oparser_feed'.
+    int argument;
+
+    // The values of options with OF_COLLECT_VALUES. Kept by the result so that later parses can reuse the memory.
+    struct CollectedValues* collected;
+
+    // The initial storage of remainder. Lets small parses finish without allocating memory.
+    char* remainder_buffer[OPARSER_RESULT_INLINE_REMAINDER];
+
+    // The initial storage of encountered.
+    unsigned int encountered_buffer[OPARSER_RESULT_INLINE_WORDS];
 } ParseResult;
 
+// A set of program arguments to be parsed by 'oparser_parse_batch'.
+typedef struct ParseBatchItem {
+    // The program arguments.
+    char** argv;
+
+    // The number of program arguments.
+    int argc;
+} ParseBatchItem;
+
+// Determines when handlers are invoked during a batch parse.
+typedef enum BatchDispatch {
+    // Handlers are invoked on the worker threads as options are parsed, so they must be thread safe.
+    BD_WORKER,
+
+    // Handler calls are recorded by the worker threads, then invoked on the calling thread
+    // in input order once every item has been parsed.
+    BD_DEFERRED
+} BatchDispatch;
+
+// Supplies the memory owned by an OptionParser and its subparsers.
+// The callbacks follow the contracts of malloc, realloc and free.
+typedef struct OptionAllocator {
+    // Allocates a block of memory, or returns NULL if there isn't enough memory.
+    void* (*allocate)(size_t size, void* context);
+
+    // Resizes a block of memory, or returns NULL if there isn't enough memory.
+    void* (*reallocate)(void* pointer, size_t size, void* context);
+
+    // Releases a block of memory.
+    void (*release)(void* pointer, void* context);
+
+    // Passed to each callback.
+    void* context;
+
+    // If non-zero, the parser is placed in an arena of at least this many bytes that is obtained from the callbacks.
+    // Options, subparsers and indexes are then carved out of the arena, and the whole arena is released at once by 'oparser_free'.
+    // If the arena fills up, another one is chained onto it.
+    size_t arena_size;
+} OptionAllocator;
+
+// Determines where the parser stores the value of an option.
+typedef enum OptionBinding {
+    // The value is passed to the handler.
+    OB_NONE,
+
+    // The value is stored at a fixed address.
+    OB_ADDRESS,
+
+    // The value is stored at an offset from the target of the ParseResult, or from the parser data if there is no target.
+    OB_OFFSET
+} OptionBinding;
+
 // The base type for an Option. 
 struct OptionBase {
     // The name of the option.
@@ -117,8 +436,47 @@ struct OptionBase {
 
     // The flags that determine the option behaviour.
     OptionFlags flags;
+
+    // The hash of the option name.
+    // Memoized so the name index can be grown without rehashing every name.
+    unsigned int name_hash;
+
+    // The type the option value is converted to.
+    OptionType type;
+
+    // Determines if the value is stored by the parser instead of being passed to a handler.
+    OptionBinding binding;
+
+    // Where the value is stored, depending on binding.
+    union {
+        void* address;
+        size_t offset;
+    } destination;
 };
 
+// Maps option names to their position in an option array.
+// Uses open addressing with linear probing, and only matches names of the exact same length.
+typedef struct OptionNameIndex {
+    // The option index stored in each slot, or -1 if the slot is empty.
+    int* slots;
+
+    // The number of slots. Always zero or a power of two.
+    int capacity;
+} OptionNameIndex;
+
+// Maps option names and their prefixes to their position in an option array.
+// A radix tree whose edge labels are ranges of the option names, so it holds no pointers other than its nodes.
+typedef struct OptionNameTrie {
+    // The nodes of the trie. The first node is the root.
+    struct NameTrieNode* nodes;
+
+    // The number of nodes.
+    int count;
+
+    // The number of nodes that can be held before reallocating memory.
+    int capacity;
+} OptionNameTrie;
+
 // The options processed by OptionSubParser.
 typedef struct SubOption {
     struct OptionBase base;
@@ -135,6 +493,12 @@ typedef struct OptionSubParser {
     // The number of additional options that can be held before reallocating memory.
     int option_capacity;
 
+    // Used to find additional options by name.
+    OptionNameIndex name_index;
+
+    // Used to find additional options by an abbreviated name.
+    OptionNameTrie name_trie;
+
     // The flags that determine parser behaviour.
     ParserFlags flags;
 
@@ -143,6 +507,15 @@ typedef struct OptionSubParser {
 
     // The function that is invoked on a successful option parse.
     OptionHandler handler;
+
+    // If set, invoked instead of handler with a view of the option value.
+    OptionValueHandler value_handler;
+
+    // If set, invoked with the values of each option that has OF_COLLECT_VALUES once the parse has finished.
+    OptionListHandler list_handler;
+
+    // The parser that owns the memory of the subparser.
+    struct OptionParser* parent;
 } OptionSubParser;
 
 // The option type processed by OptionParser.
@@ -152,6 +525,15 @@ typedef struct Option {
 
     // A special parser used to configure additional values related to this option.
     OptionSubParser* sub_options;
+
+    // The parser that contains the option.
+    struct OptionParser* parser;
+
+    // The rendered help for the option, or NULL if it hasn't been rendered yet.
+    char* help;
+
+    // The schema_version of the parser when help was rendered.
+    unsigned int help_version;
 } Option;
 
 // Parses options from the command line.
@@ -165,16 +547,25 @@ typedef struct OptionParser {
     // The number of options that can be held before reallocating memory.
     int option_capacity;
 
+    // Used to find options by name.
+    OptionNameIndex name_index;
+
+    // Used to find options by an abbreviated name.
+    OptionNameTrie name_trie;
+
+    // Maps each alias character to the index of the option that uses it, or -1 if no option does.
+    int alias_index[256];
+
     // The flags that determine parser behaviour.
     ParserFlags flags;
 
     // If flags has PF_ALLOW_REMAINDER, contains the non-option values used to start the program.
     int remainder_count;
 
-    // If flags has PF_ALLOW_REMAINDER, contains the number of non-option values that can be held before reallocating memory.
+    // If flags has PF_ALLOW_REMAINDER, contains the size in bytes of remainder, which holds the values followed by their strings.
     int remainder_capacity;
 
-    // If flags has PF_ALLOW_REMAINDER, the non-option values used to start the program.
+    // If flags has PF_ALLOW_REMAINDER, the non-option values used to start the program. Owned by the parser.
     char** remainder;
 
     // A data object that is passed to the OptionHandler.
@@ -182,28 +573,201 @@ typedef struct OptionParser {
 
     // The function that is invoked on a successful option parse.
     OptionHandler handler;
+
+    // If set, invoked instead of handler with a view of the option value.
+    OptionValueHandler value_handler;
+
+    // If set, invoked with the values of each option that has OF_COLLECT_VALUES once the parse has finished.
+    OptionListHandler list_handler;
+
+    // Supplies all of the memory owned by the parser.
+    OptionAllocator allocator;
+
+    // If allocator has an arena_size, the most recent arena block.
+    struct ArenaBlock* arena;
+
+    // Incremented whenever an option or sub-option is added, which makes any cached help out of date.
+    unsigned int schema_version;
+
+    // The rendered help for all options, or NULL if it hasn't been rendered yet.
+    char* help;
+
+    // The length of help.
+    int help_length;
+
+    // The schema_version when help was rendered.
+    unsigned int help_version;
+
+    // The most recently rendered option help of a static parser, whose options can't hold their own.
+    char* option_help;
+
+    // The index of the option that option_help belongs to.
+    int option_help_index;
+
+    // If the parser was loaded from a snapshot, the memory the snapshot was mapped or read into.
+    char* snapshot;
+
+    // The size of snapshot.
+    size_t snapshot_size;
+
+    // The subcommands of the parser, whose parsers are only built once they are reached.
+    struct Subcommand* subcommands;
+
+    // The number of subcommands.
+    int subcommand_count;
+
+    // The number of subcommands that can be held before reallocating memory.
+    int subcommand_capacity;
+
+    // Used to find subcommands by name.
+    OptionNameIndex subcommand_index;
+
+    // The environment variables that options fall back to.
+    struct OptionEnvironment* environment;
+
+    // The number of environment variables.
+    int environment_count;
+
+    // The number of environment variables that can be held before reallocating memory.
+    int environment_capacity;
+
+    // Used to find options by environment variable name.
+    OptionNameIndex environment_index;
+
+    // The paths of the config files that options fall back to, from lowest to highest precedence.
+    char** config_files;
+
+    // The number of config files.
+    int config_file_count;
+
+    // The number of config files that can be held before reallocating memory.
+    int config_file_capacity;
 } OptionParser;
 
+// Declares an option in a static table. The name must be a string literal.
+#define OPARSER_OPTION(option_name, option_alias, option_flags, option_doc) \
+    OPARSER_BOUND_OPTION(option_name, option_alias, OT_STRING, option_flags, option_doc, OB_NONE, 0)
+
+// Declares an option with a typed value in a static table. See 'oparser_add_typed_option'.
+#define OPARSER_TYPED_OPTION(option_name, option_alias, option_type, option_flags, option_doc) \
+    OPARSER_BOUND_OPTION(option_name, option_alias, option_type, option_flags, option_doc, OB_NONE, 0)
+
+// Declares an option in a static table that is bound to an offset. See 'oparser_bind_option_offset'.
+#define OPARSER_OFFSET_OPTION(option_name, option_alias, option_type, option_flags, option_doc, option_offset) \
+    OPARSER_BOUND_OPTION(option_name, option_alias, option_type, option_flags, option_doc, OB_OFFSET, option_offset)
+
+// Declares an option in a static table that has sub-options.
+// @arg subparser: An OptionSubParser declared with OPARSER_STATIC_SUBPARSER.
+#define OPARSER_SUBPARSER_OPTION(option_name, option_alias, option_flags, option_doc, subparser) \
+    { .base = OPARSER_OPTION_BASE(option_name, option_alias, OT_STRING, option_flags, option_doc, OB_NONE, 0), .sub_options = (OptionSubParser*)&(subparser) }
+
+#define OPARSER_BOUND_OPTION(option_name, option_alias, option_type, option_flags, option_doc, option_binding, option_offset) \
+    { .base = OPARSER_OPTION_BASE(option_name, option_alias, option_type, option_flags, option_doc, option_binding, option_offset) }
+
+// Declares a sub-option in a static table. The name must be a string literal.
+#define OPARSER_SUBOPTION(option_name, option_alias, option_flags, option_doc) \
+    { .base = OPARSER_OPTION_BASE(option_name, option_alias, OT_STRING, option_flags, option_doc, OB_NONE, 0) }
+
+// Declares a sub-option with a typed value in a static table.
+#define OPARSER_TYPED_SUBOPTION(option_name, option_alias, option_type, option_flags, option_doc) \
+    { .base = OPARSER_OPTION_BASE(option_name, option_alias, option_type, option_flags, option_doc, OB_NONE, 0) }
+
+// Declares a sub-option in a static table that is bound to an offset.
+#define OPARSER_OFFSET_SUBOPTION(option_name, option_alias, option_type, option_flags, option_doc, option_offset) \
+    { .base = OPARSER_OPTION_BASE(option_name, option_alias, option_type, option_flags, option_doc, OB_OFFSET, option_offset) }
+
+// Fills in an OptionBase with everything that 'oparser_add_option' would compute, apart from the name hash.
+// Typed options other than OT_BOOL require a value, the same as 'oparser_add_typed_option'.
+#define OPARSER_OPTION_BASE(option_name, option_alias, option_type, option_flags, option_doc, option_binding, option_offset) \
+    { \
+        .name = (option_name), \
+        .doc_string = (option_doc), \
+        .name_length = sizeof(option_name) - 1, \
+        .alias = (option_alias), \
+        .flags = (OptionFlags)((option_flags) | ((option_type) != OT_STRING && (option_type) != OT_BOOL ? OF_VALUE_REQUIRED : 0)), \
+        .type = (option_type), \
+        .binding = (option_binding), \
+        .destination = { .offset = (option_offset) } \
+    }
+
+// Declares a subparser over a static table of SubOptions.
+// @arg table: An array of SubOptions declared with the OPARSER_*SUBOPTION macros. May be const.
+#define OPARSER_STATIC_SUBPARSER(table, parser_handler, parser_flags, parser_data) \
+    { \
+        .options = (SubOption*)(table), \
+        .option_count = sizeof(table) / sizeof((table)[0]), \
+        .option_capacity = 0, \
+        .flags = (parser_flags), \
+        .data = (parser_data), \
+        .handler = (parser_handler) \
+    }
+
+// Declares a parser over a static table of Options, so that no work is done at startup.
+// Static parsers can't have options added to them. Names and aliases are found by searching the table directly.
+// Help can still be requested, in which case the parser must not be const, and 'oparser_free' releases the help.
+// @arg table: An array of Options declared with the OPARSER_*OPTION macros. May be const.
+#define OPARSER_STATIC_PARSER(table, parser_handler, parser_flags, parser_data) \
+    { \
+        .options = (Option*)(table), \
+        .option_count = sizeof(table) / sizeof((table)[0]), \
+        .option_capacity = 0, \
+        .flags = (parser_flags), \
+        .data = (parser_data), \
+        .handler = (parser_handler) \
+    }
+
 // Initializes a new option parser.
-// @arg handler: The function to invoke when an option is parsed.
+// @arg handler: The function to invoke when an option is parsed. May be NULL if every option is bound.
 // @arg flags: The PF_* flags used to determine parser behaviour.
 // @arg data: A data object that is passed to handler on a successful parse.
 // @return: A new OptionParser if successful, NULL if there isn't enough memory.
 OptionParser* oparser_init(OptionHandler handler, ParserFlags flags, void* data);
 
+// Initializes a new option parser that gets all of its memory from an allocator.
+// @arg handler: The function to invoke when an option is parsed.
+// @arg flags: The PF_* flags used to determine parser behaviour.
+// @arg data: A data object that is passed to handler on a successful parse.
+// @arg allocator: The allocator used for the parser, its subparsers and its help strings. Copied by the parser. If NULL, malloc is used.
+// @return: A new OptionParser if successful, NULL if there isn't enough memory.
+OptionParser* oparser_init_with_allocator(OptionHandler handler, ParserFlags flags, void* data, const OptionAllocator* allocator);
+
 // Deallocates the memory used by an OptionParser.
 // @arg parser: The parser to free.
 void oparser_free(OptionParser* parser);
 
+// Sets a handler that receives option values as views instead of strings.
+// Values are then passed straight from the parsed text without being copied, even when it isn't null terminated.
+// @arg parser: The parser to set the handler of.
+// @arg handler: The handler to invoke instead of the OptionHandler, or NULL to use the OptionHandler again.
+void oparser_set_value_handler(OptionParser* parser, OptionValueHandler handler);
+
+// Sets a handler that receives all values of an option with OF_COLLECT_VALUES in one call, once the parse has finished.
+// @arg parser: The parser to set the handler of.
+// @arg handler: The handler to invoke with the values, or NULL to only collect them into the result.
+void oparser_set_list_handler(OptionParser* parser, OptionListHandler handler);
+
 // Adds an option to an OptionParser.
 // @arg parser: The parser to add the option to.
 // @arg option_name: The name of the option.
-// @arg alias: The alias of the option. If this is an ascii value, it can used as an additional means to parse the option.
+// @arg alias: The alias of the option. If this is a character value, it can used as an additional means to parse the option.
 // @arg flags: The OF_* flags that determine the option behaviour.
 // @arg doc_string: The documentation related to this option.
-// @return: A new Option is successful, NULL if flags had conflicting values or there isn't enough memory.
+// @return: A new Option is successful, NULL if flags had conflicting values, the name or alias is already in use, or there isn't enough memory.
 Option* oparser_add_option(OptionParser* parser, char* option_name, int alias, OptionFlags flags, char* doc_string);
 
+// Adds a subcommand, such as the commit in "git commit", whose arguments are parsed by a parser of its own.
+// The first non-option value that names a subcommand switches the parse over to the subcommand's parser,
+// after checking that the required options of the current parser were given. Subcommands can have subcommands of their own.
+// The builder isn't invoked until a parse reaches the subcommand, so unused subcommands cost nothing to set up.
+// If several threads reach an unbuilt subcommand at once, the builder may be invoked more than once, in which case only one of the parsers is kept.
+// @arg parser: The parser to add the subcommand to.
+// @arg name: The name of the subcommand.
+// @arg builder: The function that builds the parser of the subcommand.
+// @arg data: A data object that is passed to builder.
+// @arg doc_string: The documentation related to this subcommand.
+// @return: True if successful, false if the name is already in use, the parser is static or there isn't enough memory.
+bool oparser_add_subcommand(OptionParser* parser, char* name, SubcommandBuilder builder, void* data, char* doc_string);
+
 // Adds a subparser to an option that can be used to process additional values related to the option.
 // @arg option: The option to add the subparser to.
 // @arg handler: The function to invoke when an option is parsed.
@@ -212,28 +776,210 @@ Option* oparser_add_option(OptionParser* parser, char* option_name, int alias, O
 // @return: A new OptionSubParser if successful, NULL if there isn't enough memory.
 OptionSubParser* osubparser_init(Option* option, OptionHandler handler, ParserFlags flags, void* data);
 
+// Sets a handler that receives sub-option values as views instead of strings.
+// @arg parser: The subparser to set the handler of.
+// @arg handler: The handler to invoke instead of the OptionHandler, or NULL to use the OptionHandler again.
+void osubparser_set_value_handler(OptionSubParser* parser, OptionValueHandler handler);
+
+// Sets a handler that receives all values of a sub-option with OF_COLLECT_VALUES in one call, once the parse has finished.
+// @arg parser: The subparser to set the handler of.
+// @arg handler: The handler to invoke with the values, or NULL to only collect them into the result.
+void osubparser_set_list_handler(OptionSubParser* parser, OptionListHandler handler);
+
+// Adds an option with a value that is validated and converted by the parser.
+// Values of every type except OT_BOOL are required. OptionValueHandlers receive the converted value,
+// while OptionHandlers still receive the text once it has been validated.
+// @arg parser: The parser to add the option to.
+// @arg option_name: The name of the option.
+// @arg alias: The alias of the option. If this is a character value, it can used as an additional means to parse the option.
+// @arg type: The OT_* type of the option value.
+// @arg flags: The OF_* flags that determine the option behaviour.
+// @arg doc_string: The documentation related to this option.
+// @return: A new Option is successful, NULL if flags had conflicting values, the name or alias is already in use, or there isn't enough memory.
+Option* oparser_add_typed_option(OptionParser* parser, char* option_name, int alias, OptionType type, OptionFlags flags, char* doc_string);
+
+// Adds an OT_INT option. See 'oparser_add_typed_option'.
+Option* oparser_add_int_option(OptionParser* parser, char* option_name, int alias, OptionFlags flags, char* doc_string);
+
+// Adds an OT_DOUBLE option. See 'oparser_add_typed_option'.
+Option* oparser_add_double_option(OptionParser* parser, char* option_name, int alias, OptionFlags flags, char* doc_string);
+
+// Adds an OT_BOOL option. See 'oparser_add_typed_option'.
+Option* oparser_add_bool_option(OptionParser* parser, char* option_name, int alias, OptionFlags flags, char* doc_string);
+
+// Adds an OT_SIZE option. See 'oparser_add_typed_option'.
+Option* oparser_add_size_option(OptionParser* parser, char* option_name, int alias, OptionFlags flags, char* doc_string);
+
+// Adds an OT_DURATION option. See 'oparser_add_typed_option'.
+Option* oparser_add_duration_option(OptionParser* parser, char* option_name, int alias, OptionFlags flags, char* doc_string);
+
+// Binds an option to an address, so that the parser stores its value there instead of invoking a handler.
+// The value is stored as a char* for OT_STRING, a long long for OT_INT and OT_DURATION, a double for OT_DOUBLE,
+// a bool for OT_BOOL and an unsigned long long for OT_SIZE. An OT_STRING option without a value leaves the destination untouched.
+// String values point into the arguments, or into the ParseResult if they had to be copied.
+// @arg option: The option to bind.
+// @arg address: Where the value is stored.
+void oparser_bind_option(Option* option, void* address);
+
+// Binds an option to an offset, so that the parser stores its value relative to the target of the ParseResult instead of invoking a handler.
+// Without a target, the value is stored relative to the data object of the parser. See 'oparser_bind_option' for how values are stored.
+// @arg option: The option to bind.
+// @arg offset: The offset of the value from the target, usually from offsetof.
+void oparser_bind_option_offset(Option* option, size_t offset);
+
+// Lets an option be set by an environment variable when it isn't given in the arguments.
+// Once the arguments have been parsed, the environment is walked once, and the variables of options that weren't given
+// are passed to the handler as if they were values in the arguments. The options then count as given for OF_REQUIRED.
+// Empty variables are ignored, and options that don't allow a value are given without one.
+// @arg option: The option to set from the environment.
+// @arg variable: The name of the environment variable.
+// @return: True if successful, false if the variable is already used by another option, the option is in a static table or there isn't enough memory.
+bool oparser_set_option_environment(Option* option, char* variable);
+
+// Adds a config file that options fall back to when they aren't given in the arguments or the environment.
+// Each line of the file is a key=value pair, where the key is the name of an option, or a key without a value.
+// A [name] line starts a section that sets the option with that name, and the keys that follow are its sub-options.
+// Lines starting with # or ; are comments, whitespace around keys and values is ignored, and values may be quoted.
+// Files are mapped and read in one pass when a parse finishes, and values are passed to handlers straight from the mapping.
+// Files added later take precedence over files added earlier, and files that don't exist are skipped.
+// @arg parser: The parser to add the config file to.
+// @arg path: The path of the config file. Not copied, so it must stay valid as long as the parser.
+// @return: True if successful, false if the parser is static or there isn't enough memory.
+bool oparser_add_config_file(OptionParser* parser, char* path);
+
 // Adds an option to a subparser.
 // @arg parser: The subparser to add an option to.
 // @arg option_name: The name of the option.
 // @arg alias: The alias of the option. Ignored by the parser, but passed to the handler.
 // @arg flags: The OF_* flags that determine the option behaviour.
 // @arg doc_string: The documentation related to this option.
-// @return: A new SubOption if successful, NULL if flags had conflicting values or there isn't enough memory.
+// @return: A new SubOption if successful, NULL if flags had conflicting values, the name is already in use, or there isn't enough memory.
 SubOption* osubparser_add_option(OptionSubParser* parser, char* option_name, int alias, OptionFlags flags, char* doc_string);
 
+// Adds a sub-option with a value that is validated and converted by the parser. See 'oparser_add_typed_option'.
+// @arg parser: The subparser to add an option to.
+// @arg option_name: The name of the option.
+// @arg alias: The alias of the option. Ignored by the parser, but passed to the handler.
+// @arg type: The OT_* type of the option value.
+// @arg flags: The OF_* flags that determine the option behaviour.
+// @arg doc_string: The documentation related to this option.
+// @return: A new SubOption if successful, NULL if flags had conflicting values, the name is already in use, or there isn't enough memory.
+SubOption* osubparser_add_typed_option(OptionSubParser* parser, char* option_name, int alias, OptionType type, OptionFlags flags, char* doc_string);
+
+// Binds a sub-option to an address. See 'oparser_bind_option'.
+// @arg option: The sub-option to bind.
+// @arg address: Where the value is stored.
+void osubparser_bind_option(SubOption* option, void* address);
+
+// Binds a sub-option to an offset from the target of the ParseResult, or from the data object of the subparser. See 'oparser_bind_option_offset'.
+// @arg option: The sub-option to bind.
+// @arg offset: The offset of the value from the target, usually from offsetof.
+void osubparser_bind_option_offset(SubOption* option, size_t offset);
+
 // Parses the values used to start the program.
+// The non-option values are copied into the parser so they can be retrieved with 'oparser_remainder'.
 // @arg parser: The parser used to parse the program arguments.
 // @arg argv: The program arguments.
 // @arg argc: The number of program arguments.
-// @return: The result of the parse. Must be freed by the caller with 'oparser_result_free'.
+// @return: The result of the parse if successful, NULL if there isn't enough memory. Must be freed by the caller with 'oparser_result_free'.
 ParseResult* oparser_parse(OptionParser* parser, char** argv, int argc);
 
+// Parses the values used to start the program without modifying the parser.
+// All of the state of the parse is kept in the result, so one parser can be used by multiple threads at once,
+// provided that the handlers are thread safe.
+// @arg parser: The parser used to parse the program arguments.
+// @arg argv: The program arguments.
+// @arg argc: The number of program arguments.
+// @return: The result of the parse if successful, NULL if there isn't enough memory. Must be freed by the caller with 'oparser_result_free'.
+ParseResult* oparser_parse_reentrant(const OptionParser* parser, char** argv, int argc);
+
+// Initializes a ParseResult owned by the caller, such as one on the stack.
+// @arg result: The result to initialize.
+void oparser_result_init(ParseResult* result);
+
+// Parses the values used to start the program into a ParseResult owned by the caller.
+// Doesn't modify the parser, and the result can be reused for any number of parses.
+// A successful parse doesn't allocate any memory unless the parser has more options than the result can track
+// or there are more non-option values than the result can hold. Memory allocated for one parse is reused by the next.
+// @arg parser: The parser used to parse the program arguments.
+// @arg result: A result initialized with 'oparser_result_init'.
+// @arg argv: The program arguments.
+// @arg argc: The number of program arguments.
+// @return: The error encountered by the parse, or PE_NONE if the parse was successful.
+ParseError oparser_parse_into(const OptionParser* parser, ParseResult* result, char** argv, int argc);
+
+// Parses a command string, splitting it into arguments using the quoting rules of a POSIX shell.
+// Unlike argv, the command doesn't start with the program name. Value handlers are given views directly into the command,
+// and arguments are only copied when they contain quotes or escapes, or need to be null terminated for an OptionHandler.
+// @arg parser: The parser used to parse the command.
+// @arg result: A result initialized with 'oparser_result_init'. Values in the result may point into the command.
+// @arg command: The command to parse. Doesn't need to be null terminated.
+// @arg length: The number of characters in the command.
+// @return: The error encountered by the parse, or PE_NONE if the parse was successful.
+ParseError oparser_parse_command(const OptionParser* parser, ParseResult* result, const char* command, int length);
+
+// Starts a parse whose tokens are given one at a time with 'oparser_feed', such as when they arrive over a socket.
+// The result keeps track of where the parse is between tokens, including whose sub-options are being parsed,
+// so tokens are handled as soon as they arrive and never buffered. Like a command string, the tokens don't start with the program name.
+// @arg parser: The parser used to parse the tokens.
+// @arg result: A result initialized with 'oparser_result_init'. Holds the state of the parse until 'oparser_finish'.
+// @return: The error encountered by the parse, or PE_NONE if it was started successfully.
+ParseError oparser_begin(const OptionParser* parser, ParseResult* result);
+
+// Parses the next token of a parse started with 'oparser_begin'.
+// The token doesn't need to be null terminated or to outlive the call. Anything kept by the result, such as the remainder, is copied,
+// and value handlers are given views into the token that are only valid during the call. Once there is an error, further tokens are ignored.
+// @arg result: The result the parse was started with.
+// @arg token: The token to parse.
+// @arg length: The number of characters in the token.
+// @return: The error encountered by the parse so far, or PE_NONE if there wasn't one.
+ParseError oparser_feed(ParseResult* result, const char* token, int length);
+
+// Finishes a parse started with 'oparser_begin', filling in options from the environment and config files
+// and checking that the required options and sub-options were given.
+// @arg result: The result the parse was started with.
+// @return: The error encountered by the parse, or PE_NONE if the parse was successful.
+ParseError oparser_finish(ParseResult* result);
+
+// Parses many sets of program arguments with the same parser, spread across multiple threads.
+// Each item is parsed as if by 'oparser_parse_into', and results[i] receives the result of items[i].
+// @arg parser: The parser used to parse the program arguments. Shared by every thread.
+// @arg items: The sets of program arguments to parse.
+// @arg results: An array of count results initialized with 'oparser_result_init'.
+// @arg count: The number of items to parse.
+// @arg thread_count: The number of threads to parse with, including the calling thread.
+// @arg dispatch: Determines which thread invokes the handlers.
+// @return: true if every item was parsed successfully, otherwise false.
+bool oparser_parse_batch(const OptionParser* parser, const ParseBatchItem* items, ParseResult* results, int count, int thread_count, BatchDispatch dispatch);
+
+// Releases any memory held by a ParseResult owned by the caller. The result can be reused afterwards.
+// @arg result: The result to release.
+void oparser_result_destroy(ParseResult* result);
+
 // Gets an error string from a ParseResult. Returns NULL if there is no error.
-// The string returned from this function should not be deallocated.
+// The string is stored in the result, so it should not be deallocated and is only valid as long as the result.
 // @arg result: The result from a parse.
 // @return: A string that contains the encountered error, or NULL if there was no error.
 char* oparser_get_error_string(ParseResult* result);
 
+// Writes the error message of a ParseResult into a buffer. Behaves like snprintf.
+// The message for an invalid name suggests the closest option names, which are only searched for here.
+// Doesn't allocate any memory, so it can be called from multiple threads at once.
+// @arg result: The result from a parse.
+// @arg buffer: The buffer to write the message to. Can be NULL if size is 0.
+// @arg size: The size of the buffer, including the null terminator.
+// @return: The length of the full message, or 0 if there was no error. If this is greater than or equal to size, the message was truncated.
+int oparser_format_error(const ParseResult* result, char* buffer, int size);
+
+// Writes the message of an error collected by a parser with PF_COLLECT_ERRORS into a buffer. Behaves like snprintf.
+// Unlike 'oparser_format_error', similar names aren't suggested for invalid names.
+// @arg result: The result from a parse.
+// @arg index: The index of the error in result->errors.
+// @arg buffer: The buffer to write the message to. Can be NULL if size is 0.
+// @arg size: The size of the buffer, including the null terminator.
+// @return: The length of the full message, or 0 if there is no error at index.
+int oparser_format_error_entry(const ParseResult* result, int index, char* buffer, int size);
+
 // Frees the result of a parse.
 // @arg result: The result to free.
 void oparser_result_free(ParseResult* result);
@@ -243,6 +989,38 @@ void oparser_result_free(ParseResult* result);
 // @return: A help string that must be freed by the caller if successful, or NULL if there wasn't enough memory.
 char* oparser_help(OptionParser* parser);
 
+// Gets the help string for all options, only rendering it again if the options have changed since the last call.
+// @arg parser: The parser to get the documentation of.
+// @return: A help string owned by the parser that stays valid until an option or sub-option is added or the parser is freed,
+//          or NULL if there wasn't enough memory.
+const char* oparser_cached_help(OptionParser* parser);
+
+// Gets the help string for a specific option, only rendering it again if the options have changed since the last call.
+// @arg parser: The parser that contains the option.
+// @arg option_name: The name of the option to get the documentation of.
+// @return: A help string owned by the parser that stays valid until an option or sub-option is added or the parser is freed,
+//          or NULL if the option didn't exist or there wasn't enough memory.
+const char* oparser_cached_option_help(OptionParser* parser, char* option_name);
+
+// Writes the help string for all options to a callback piece by piece, without building the whole string.
+// @arg parser: The parser to get the documentation of.
+// @arg writer: The function that receives the help text.
+// @arg context: A data object that is passed to writer.
+// @return: The number of characters written, or -1 if the writer stopped early.
+int oparser_write_help(OptionParser* parser, OptionHelpWriter writer, void* context);
+
+// Writes the help string for all options to a file, without building the whole string.
+// @arg parser: The parser to get the documentation of.
+// @arg file: The file to write to, such as stdout.
+// @return: The number of characters written, or -1 if the file couldn't be written to.
+int oparser_print_help(OptionParser* parser, FILE* file);
+
+// Frees a help string returned by the parser.
+// Only needed if the parser was created with an allocator, otherwise the string can be passed to free.
+// @arg parser: The parser that created the help string.
+// @arg help: The help string to free.
+void oparser_free_help(OptionParser* parser, char* help);
+
 // Gets a nicely formatted help string for a specific option. Must be free by the caller.
 // @arg parser: The parser that contains the option.
 // @arg option_name: The name of the option to get the documentation of.
@@ -270,7 +1048,80 @@ char* oparser_option_docstring(OptionParser* parser, char* option_name);
 // @return: The docstring used to create the sub-option, or NULL if either option didn't exist.
 char* oparser_suboption_docstring(OptionParser* parser, char* option_name, char* suboption_name);
 
+// Saves a parser to a snapshot file that can be loaded by 'oparser_load_snapshot' much faster than the parser can be built.
+// The snapshot holds the options, sub-options, name indexes, environment variables, config files and help, but not handlers, data objects, subcommands or options bound to an address.
+// Snapshots can only be loaded by a build of the library with the same struct layouts.
+// @arg parser: The parser to save.
+// @arg path: The path of the file to write the snapshot to.
+// @return: True if successful, false if an option is bound to an address, the parser has subcommands, the file couldn't be written or there isn't enough memory.
+bool oparser_save_snapshot(OptionParser* parser, const char* path);
+
+// Loads a parser from a snapshot file made by 'oparser_save_snapshot'.
+// The snapshot is mapped read-only, usually at the address it was written for, in which case none of it has to be fixed up.
+// The loaded parser behaves like a static parser: options can't be added to it, and it is released with 'oparser_free'.
+// Only load snapshots from trusted sources, as only the header is checked.
+// @arg path: The path of the snapshot file.
+// @arg handler: The function to invoke when an option is parsed.
+// @arg data: A data object that is passed to handler on a successful parse.
+// @return: The loaded parser, or NULL if the file couldn't be read or wasn't a compatible snapshot.
+OptionParser* oparser_load_snapshot(const char* path, OptionHandler handler, void* data);
+
+// Sets the handler of the subparser that belongs to the option with an alias.
+// Handlers can't be saved in a snapshot, so this is how they are set again after loading one.
+// @arg parser: The parser that contains the option.
+// @arg alias: The alias of the option with the subparser.
+// @arg handler: The function to invoke when a sub-option is parsed.
+// @arg data: A data object that is passed to handler on a successful parse.
+// @return: True if successful, false if no option had the alias or the option doesn't have a subparser.
+bool oparser_set_subparser_handler(OptionParser* parser, int alias, OptionHandler handler, void* data);
+
+// Finds the ways the word at the cursor can be completed, given the words before it.
+// Options are completed by name or alias, sub-options and subcommands by name, and values aren't completed.
+// Options that were already given aren't offered again unless they have OF_DUPLICATES_ALLOWED.
+// The words before the cursor are only matched against the options, so no handlers are invoked, but subcommands that are reached are built.
+// @arg parser: The parser to complete the words for.
+// @arg argv: The words of the command line, starting with the program name.
+// @arg argc: The number of words. May be equal to cursor if the word being completed is empty.
+// @arg cursor: The index of the word being completed.
+// @arg writer: The function that receives each candidate.
+// @arg context: A data object that is passed to writer.
+// @return: The number of candidates, or -1 if the writer stopped early or there isn't enough memory.
+int oparser_complete(const OptionParser* parser, char** argv, int argc, int cursor, OptionCompletionWriter writer, void* context);
+
+// Handles the hidden completion mode used by completion scripts, where a program is started with the arguments
+// OPARSER_COMPLETE_OPTION, the index of the word being completed, and then the words of the command line.
+// Should be called before parsing, and the program should exit if it returns true.
+// @arg parser: The parser to complete the words for.
+// @arg argv: The program arguments.
+// @arg argc: The number of program arguments.
+// @arg file: The file the candidates are written to, one per line, such as stdout.
+// @return: True if the program was started in completion mode and the candidates were written, otherwise false.
+bool oparser_run_completion(const OptionParser* parser, char** argv, int argc, FILE* file);
+
+// Writes a script that makes a shell complete the command line of a program by starting it in completion mode.
+// The program must call 'oparser_run_completion' before it parses its arguments.
+// @arg program: The name the program is started with.
+// @arg shell: The shell to write the script for.
+// @arg file: The file to write the script to.
+// @return: True if successful, false if the file couldn't be written to.
+bool oparser_write_completion_script(const char* program, CompletionShell shell, FILE* file);
+
+// Gets the non-option values found by a parse.
+// @arg result: The result from a parse.
+// @arg count: A pointer to an integer value that will be set to the number of non-option program arguments.
+// @return: An array of non-option program arguments, or NULL if there weren't any.
+char** oparser_result_remainder(ParseResult* result, int* count);
+
+// Gets the values collected for an option with OF_COLLECT_VALUES, in the order they were given.
+// The values point into the parsed arguments where possible, and are valid until the result is reused or destroyed.
+// @arg result: The result from a parse.
+// @arg name: The name of the option, or the name of the option and sub-option separated by a dot (e.g. sub.tree).
+// @arg count: A pointer to an integer value that will be set to the number of values.
+// @return: An array of the values, or NULL if none were collected for the option.
+const OptionValue* oparser_result_values(const ParseResult* result, const char* name, int* count);
+
 // Gets the non-option values used to start the program.
+// Only updated by 'oparser_parse'.
 // @arg parser: The parser used to parse the program arguments.
 // @arg count: A pointer to an integer value that will be set to the number of non-option program arguments.
 // @return: An array of non-option program arguments if successful, NULL if the parser was created without the PF_ALLOW_REMAINDER flag.
@@ -1,9 +1,38 @@
 #include <check.h>
+#include <stdatomic.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include "../Source/option_parser.h"
 
+#ifdef OPTIONS_TEST_COUNT_ALLOCATIONS
+
+// The test executable is linked with --wrap for each allocation function,
+// so every allocation made by the library passes through these.
+static int allocation_count = 0;
+
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t count, size_t size);
+void* __real_realloc(void* pointer, size_t size);
+
+void* __wrap_malloc(size_t size) {
+    allocation_count++;
+    return __real_malloc(size);
+}
+
+void* __wrap_calloc(size_t count, size_t size) {
+    allocation_count++;
+    return __real_calloc(count, size);
+}
+
+void* __wrap_realloc(void* pointer, size_t size) {
+    allocation_count++;
+    return __real_realloc(pointer, size);
+}
+
+#endif
+
 typedef struct Message {
     char* message;
 } Message;
@@ -299,6 +328,1681 @@ START_TEST(test_parser_suboption_docstring) {
 }
 END_TEST
 
+START_TEST(test_parser_exact_name) {
+    reset_message();
+    char* args[] = { NULL, "--timeout" };
+    ParseResult* result = oparser_parse(simple_parser, args, 2);
+    ck_assert(result->error == PE_INVALID_NAME);
+    oparser_result_free(result);
+
+    args[1] = "--tim";
+    result = oparser_parse(simple_parser, args, 2);
+    ck_assert(result->error == PE_INVALID_NAME);
+    oparser_result_free(result);
+}
+END_TEST
+
+START_TEST(test_parser_duplicate_name) {
+    ck_assert(oparser_add_option(simple_parser, "name", 'x', OF_NONE, "A duplicate name") == NULL);
+    ck_assert(strcmp(oparser_option_docstring(simple_parser, "name"), "Sets the name") == 0);
+}
+END_TEST
+
+START_TEST(test_parser_duplicate_alias) {
+    ck_assert(oparser_add_option(simple_parser, "nickname", 'n', OF_NONE, "A duplicate alias") == NULL);
+    ck_assert(oparser_option_docstring(simple_parser, "nickname") == NULL);
+    ck_assert(oparser_add_option(simple_parser, "nickname", 1000, OF_NONE, "A non-character alias") != NULL);
+    ck_assert(oparser_add_option(simple_parser, "othername", 1000, OF_NONE, "A non-character alias") != NULL);
+}
+END_TEST
+
+START_TEST(test_parser_options_parsed) {
+    OptionParser* parser = oparser_init(simple_handler, PF_SETTABLE_FLAGS, simple_message);
+    oparser_add_option(parser, "name", 'n', OF_VALUE_REQUIRED, "Sets the name");
+    oparser_add_option(parser, "time", 't', OF_NONE, "Gets the time");
+    oparser_add_option(parser, "any", 'a', OF_NONE, "Gets or sets any value");
+    oparser_add_option(parser, "echo", 'e', OF_VALUE_REQUIRED, "Echos the value");
+
+    // Names and aliases count once each, with or without a value.
+    char* args[] = { NULL, "--name=tree", "-ta", "-e=oak" };
+    ParseResult result;
+    oparser_result_init(&result);
+    ck_assert(oparser_parse_into(parser, &result, args, 4) == PE_NONE);
+    ck_assert(result.options_parsed == 4);
+
+    // A value required by an alias can only be given after an equals sign.
+    char* missing[] = { NULL, "-n" };
+    ck_assert(oparser_parse_into(parser, &result, missing, 2) == PE_VALUE_MISSING);
+    ck_assert(result.options_parsed == 0);
+    char* grouped[] = { NULL, "-tn=oak" };
+    ck_assert(oparser_parse_into(parser, &result, grouped, 2) == PE_VALUE_MISSING);
+    ck_assert(result.options_parsed == 1);
+
+    oparser_result_destroy(&result);
+    oparser_free(parser);
+}
+END_TEST
+
+START_TEST(test_parser_alias_group) {
+    reset_message();
+    char* args[] = { NULL, "-ta" };
+    ParseResult* result = oparser_parse(simple_parser, args, 2);
+    ck_assert(result->error == PE_NONE);
+    ck_assert(result->options_parsed == 2);
+    ck_assert(strcmp(simple_message->message, "any") == 0);
+    oparser_result_free(result);
+}
+END_TEST
+
+START_TEST(test_parser_reentrant) {
+    char* args[] = { NULL, "--required", "first", "--sub", "animal=cow", "second" };
+    ParseResult* first = oparser_parse_reentrant(advance_parser, args, 6);
+    ParseResult* second = oparser_parse_reentrant(advance_parser, args, 6);
+    ck_assert(first->error == PE_NONE);
+    ck_assert(second->error == PE_NONE);
+
+    int count;
+    char** remainder = oparser_result_remainder(first, &count);
+    ck_assert(count == 2);
+    ck_assert(strcmp(remainder[1], "second") == 0);
+    oparser_remainder(advance_parser, &count);
+    ck_assert(count == 0);
+
+    for(int i = 0; i < advance_parser->option_count; i++)
+        ck_assert((advance_parser->options[i].base.flags & ___OF_ENCOUNTERED) == 0);
+
+    oparser_result_free(first);
+    oparser_result_free(second);
+}
+END_TEST
+
+START_TEST(test_parser_state_reset_after_error) {
+    char* args[] = { NULL, "--any", "--nonoption" };
+    ParseResult* result = oparser_parse(simple_parser, args, 3);
+    ck_assert(result->error == PE_INVALID_NAME);
+    oparser_result_free(result);
+
+    result = oparser_parse(simple_parser, args, 2);
+    ck_assert(result->error == PE_NONE);
+    oparser_result_free(result);
+}
+END_TEST
+
+START_TEST(test_parser_format_error) {
+    char* args[] = { NULL, "--nonoption" };
+    ParseResult* first = oparser_parse(simple_parser, args, 2);
+    args[1] = "-p";
+    ParseResult* second = oparser_parse(simple_parser, args, 2);
+
+    char buffer[64];
+    int length = oparser_format_error(first, buffer, sizeof(buffer));
+    ck_assert(length == strlen("Encountered invalid option: nonoption"));
+    ck_assert(strcmp(buffer, "Encountered invalid option: nonoption") == 0);
+    ck_assert(oparser_format_error(second, buffer, 12) == strlen("Encountered invalid option alias: p"));
+    ck_assert(strcmp(buffer, "Encountered") == 0);
+    ck_assert(oparser_format_error(second, NULL, 0) == strlen("Encountered invalid option alias: p"));
+
+    char* first_string = oparser_get_error_string(first);
+    char* second_string = oparser_get_error_string(second);
+    ck_assert(strcmp(first_string, "Encountered invalid option: nonoption") == 0);
+    ck_assert(strcmp(second_string, "Encountered invalid option alias: p") == 0);
+
+    oparser_result_free(first);
+    oparser_result_free(second);
+}
+END_TEST
+
+START_TEST(test_parser_parse_into) {
+    char* args[] = { NULL, "--required", "first", "--sub", "animal=cow", "tree", "second" };
+    ParseResult result;
+    oparser_result_init(&result);
+
+#ifdef OPTIONS_TEST_COUNT_ALLOCATIONS
+    int allocations = allocation_count;
+#endif
+    ParseError error = oparser_parse_into(advance_parser, &result, args, 7);
+#ifdef OPTIONS_TEST_COUNT_ALLOCATIONS
+    ck_assert_msg(allocation_count == allocations, "A successful parse allocated memory");
+#endif
+
+    ck_assert(error == PE_NONE);
+    int count;
+    char** remainder = oparser_result_remainder(&result, &count);
+    ck_assert(count == 2);
+    ck_assert(strcmp(remainder[0], "first") == 0);
+
+    args[1] = "--nonoption";
+    ck_assert(oparser_parse_into(advance_parser, &result, args, 2) == PE_INVALID_NAME);
+    ck_assert(strcmp(oparser_get_error_string(&result), "Encountered invalid option: nonoption") == 0);
+    oparser_result_destroy(&result);
+}
+END_TEST
+
+START_TEST(test_parser_parse_into_large) {
+    // Enough options and values to outgrow the storage inside of the result.
+    static char names[3000][8];
+    char* args[44] = { NULL, "--o2999", "--o0" };
+    OptionParser* parser = oparser_init(simple_handler, PF_ALLOW_REMAINDER, NULL);
+    for(int i = 0; i < 3000; i++) {
+        sprintf(names[i], "o%d", i);
+        oparser_add_option(parser, names[i], 1000 + i, OF_NONE, names[i]);
+    }
+    for(int i = 3; i < 44; i++)
+        args[i] = "value";
+
+    ParseResult result;
+    oparser_result_init(&result);
+    ck_assert(oparser_parse_into(parser, &result, args, 44) == PE_NONE);
+    ck_assert(result.remainder_count == 41);
+
+    args[2] = "--o2999";
+    ck_assert(oparser_parse_into(parser, &result, args, 3) == PE_DUPLICATE);
+
+    oparser_result_destroy(&result);
+    oparser_free(parser);
+}
+END_TEST
+
+typedef struct BatchRecord {
+    char* values[256];
+    int count;
+    atomic_int calls;
+} BatchRecord;
+
+void batch_handler(char* name, int alias, char* value, void* data) {
+    BatchRecord* record = (BatchRecord*)data;
+    if(value != NULL)
+        record->values[record->count++] = value;
+}
+
+void batch_worker_handler(char* name, int alias, char* value, void* data) {
+    BatchRecord* record = (BatchRecord*)data;
+    atomic_fetch_add(&record->calls, 1);
+}
+
+START_TEST(test_parser_parse_batch_deferred) {
+    static BatchRecord record;
+    static char values[256][16];
+    static char* args[256][2];
+    static ParseBatchItem items[256];
+    static ParseResult results[256];
+
+    record.count = 0;
+    OptionParser* parser = oparser_init(batch_handler, PF_NONE, &record);
+    oparser_add_option(parser, "name", 'n', OF_VALUE_REQUIRED, "Sets the name");
+    for(int i = 0; i < 256; i++) {
+        sprintf(values[i], "--name=%d", i);
+        args[i][0] = NULL;
+        args[i][1] = i == 100 ? "--nonoption" : values[i];
+        items[i].argv = args[i];
+        items[i].argc = 2;
+        oparser_result_init(results + i);
+    }
+
+    ck_assert(!oparser_parse_batch(parser, items, results, 256, 4, BD_DEFERRED));
+    ck_assert(results[100].error == PE_INVALID_NAME);
+    ck_assert(record.count == 255);
+    for(int i = 0, j = 0; i < 256; i++) {
+        if(i == 100)
+            continue;
+        ck_assert(results[i].error == PE_NONE);
+        ck_assert(strcmp(record.values[j++], values[i] + 7) == 0);
+    }
+
+    for(int i = 0; i < 256; i++)
+        oparser_result_destroy(results + i);
+    oparser_free(parser);
+}
+END_TEST
+
+START_TEST(test_parser_parse_batch_worker) {
+    static BatchRecord record;
+    static ParseBatchItem items[1000];
+    static ParseResult results[1000];
+    char* args[] = { NULL, "--time", "--any=value", "--name=batch" };
+
+    atomic_init(&record.calls, 0);
+    OptionParser* parser = oparser_init(batch_worker_handler, PF_NONE, &record);
+    oparser_add_option(parser, "name", 'n', OF_VALUE_REQUIRED, "Sets the name");
+    oparser_add_option(parser, "time", 't', OF_VALUE_NOT_ALLOWED, "Gets the time");
+    oparser_add_option(parser, "any", 'a', OF_NONE, "Gets or sets any value");
+    for(int i = 0; i < 1000; i++) {
+        items[i].argv = args;
+        items[i].argc = 4;
+        oparser_result_init(results + i);
+    }
+
+    ck_assert(oparser_parse_batch(parser, items, results, 1000, 8, BD_WORKER));
+    ck_assert(atomic_load(&record.calls) == 3000);
+
+    for(int i = 0; i < 1000; i++)
+        oparser_result_destroy(results + i);
+    oparser_free(parser);
+}
+END_TEST
+
+static void write_file(const char* path, const char* contents) {
+    FILE* file = fopen(path, "wb");
+    ck_assert(file != NULL);
+    fputs(contents, file);
+    fclose(file);
+}
+
+START_TEST(test_parser_response_file) {
+    write_file("response_test.rsp", "--name=\"hello world\"\n  --time 'a b' c\\ d \"e\\\"f\"\n--sub tree");
+    OptionParser* parser = oparser_init(simple_handler, PF_ALLOW_REMAINDER | PF_RESPONSE_FILES, simple_message);
+    oparser_add_option(parser, "name", 'n', OF_VALUE_REQUIRED, "Sets the name");
+    oparser_add_option(parser, "time", 't', OF_VALUE_NOT_ALLOWED, "Gets the time");
+    Option* option = oparser_add_option(parser, "sub", 's', OF_NONE, "An option with suboptions");
+    OptionSubParser* subparser = osubparser_init(option, advance_subhandler, PF_NONE, simple_message);
+    osubparser_add_option(subparser, "tree", 't', OF_NONE, "Sets the name of a tree");
+
+    reset_message();
+    char* args[] = { NULL, "first", "@response_test.rsp", "last" };
+    ParseResult result;
+    oparser_result_init(&result);
+    ck_assert(oparser_parse_into(parser, &result, args, 4) == PE_NONE);
+    ck_assert(result.options_parsed == 3);
+    ck_assert(strcmp(simple_message->message, "tree") == 0);
+
+    int count;
+    char** remainder = oparser_result_remainder(&result, &count);
+    ck_assert(count == 5);
+    ck_assert(strcmp(remainder[0], "first") == 0);
+    ck_assert(strcmp(remainder[1], "a b") == 0);
+    ck_assert(strcmp(remainder[2], "c d") == 0);
+    ck_assert(strcmp(remainder[3], "e\"f") == 0);
+    ck_assert(strcmp(remainder[4], "last") == 0);
+
+    oparser_result_destroy(&result);
+    oparser_free(parser);
+    remove("response_test.rsp");
+}
+END_TEST
+
+START_TEST(test_parser_response_file_full_page) {
+    // A token that ends on the last byte of a page can't be terminated in place.
+    char contents[4097];
+    memset(contents, ' ', 4092);
+    strcpy(contents + 4092, "last");
+    write_file("response_test.rsp", contents);
+
+    OptionParser* parser = oparser_init(simple_handler, PF_ALLOW_REMAINDER | PF_RESPONSE_FILES, simple_message);
+    char* args[] = { NULL, "@response_test.rsp" };
+    ParseResult result;
+    oparser_result_init(&result);
+    ck_assert(oparser_parse_into(parser, &result, args, 2) == PE_NONE);
+    ck_assert(result.remainder_count == 1);
+    ck_assert(strcmp(result.remainder[0], "last") == 0);
+
+    oparser_result_destroy(&result);
+    oparser_free(parser);
+    remove("response_test.rsp");
+}
+END_TEST
+
+START_TEST(test_parser_response_file_remainder) {
+    // The remainder kept by the parser must outlive the result, and with it the mapped response file.
+    write_file("response_test.rsp", "middle 'a b'");
+    OptionParser* parser = oparser_init(simple_handler, PF_ALLOW_REMAINDER | PF_RESPONSE_FILES, simple_message);
+    oparser_add_option(parser, "time", 't', OF_VALUE_NOT_ALLOWED, "Gets the time");
+
+    char* args[] = { "prog", "-t", "first", "@response_test.rsp", "last" };
+    for(int i = 0; i < 2; i++) {
+        ParseResult* result = oparser_parse(parser, args, 5);
+        ck_assert(result != NULL);
+        ck_assert(result->error == PE_NONE);
+        oparser_result_free(result);
+
+        int count;
+        char** remainder = oparser_remainder(parser, &count);
+        ck_assert(count == 4);
+        ck_assert(strcmp(remainder[0], "first") == 0);
+        ck_assert(strcmp(remainder[1], "middle") == 0);
+        ck_assert(strcmp(remainder[2], "a b") == 0);
+        ck_assert(strcmp(remainder[3], "last") == 0);
+    }
+
+    oparser_free(parser);
+    remove("response_test.rsp");
+}
+END_TEST
+
+START_TEST(test_parser_response_file_errors) {
+    write_file("response_test.rsp", "--time @response_test.rsp");
+    OptionParser* parser = oparser_init(simple_handler, PF_RESPONSE_FILES, simple_message);
+    oparser_add_option(parser, "time", 't', OF_DUPLICATES_ALLOWED, "Gets the time");
+
+    char* args[] = { NULL, "@response_test.rsp" };
+    ParseResult result;
+    oparser_result_init(&result);
+    ck_assert(oparser_parse_into(parser, &result, args, 2) == PE_RESPONSE_FILE_NESTING);
+
+    args[1] = "@missing_response_test.rsp";
+    ck_assert(oparser_parse_into(parser, &result, args, 2) == PE_RESPONSE_FILE);
+    ck_assert(strcmp(oparser_get_error_string(&result), "Couldn't read response file: missing_response_test.rsp") == 0);
+
+    // An open quote would otherwise take the rest of the file.
+    write_file("response_test.rsp", "--time \"unterminated more\n--time");
+    args[1] = "@response_test.rsp";
+    ck_assert(oparser_parse_into(parser, &result, args, 2) == PE_UNMATCHED_QUOTE);
+    ck_assert(strcmp(oparser_get_error_string(&result), "Missing closing quote in: response_test.rsp") == 0);
+
+    oparser_result_destroy(&result);
+    oparser_free(parser);
+    remove("response_test.rsp");
+}
+END_TEST
+
+typedef struct ValueLog {
+    char values[4][32];
+    int count;
+} ValueLog;
+
+void value_view_handler(char* name, int alias, const OptionValue* value, void* data) {
+    ValueLog* log = (ValueLog*)data;
+    if(value == NULL)
+        snprintf(log->values[log->count++], 32, "%s", name);
+    else
+        snprintf(log->values[log->count++], 32, "%s=%.*s", name, value->length, value->text);
+}
+
+START_TEST(test_parser_parse_command) {
+    ValueLog log = { .count = 0 };
+    OptionParser* parser = oparser_init(simple_handler, PF_ALLOW_REMAINDER, &log);
+    oparser_set_value_handler(parser, value_view_handler);
+    oparser_add_option(parser, "name", 'n', OF_VALUE_REQUIRED | OF_DUPLICATES_ALLOWED, "Sets the name");
+    oparser_add_option(parser, "time", 't', OF_VALUE_NOT_ALLOWED, "Gets the time");
+
+    // The command isn't null terminated, so the final value can only be passed as a view.
+    const char command[] = "first --name=\"hello world\" -t 'a b'\\ c --name=lastXXX";
+    ParseResult result;
+    oparser_result_init(&result);
+    ck_assert(oparser_parse_command(parser, &result, command, sizeof(command) - 4) == PE_NONE);
+    ck_assert(result.options_parsed == 3);
+    ck_assert(log.count == 3);
+    ck_assert(strcmp(log.values[0], "name=hello world") == 0);
+    ck_assert(strcmp(log.values[1], "time") == 0);
+    ck_assert(strcmp(log.values[2], "name=last") == 0);
+
+    int count;
+    char** remainder = oparser_result_remainder(&result, &count);
+    ck_assert(count == 2);
+    ck_assert(strcmp(remainder[0], "first") == 0);
+    ck_assert(strcmp(remainder[1], "a b c") == 0);
+
+#ifdef OPTIONS_TEST_COUNT_ALLOCATIONS
+    // Once the scratch arena exists, plain commands parse without allocating.
+    const char plain[] = "--name=value -t";
+    log.count = 0;
+    int allocations = allocation_count;
+    ck_assert(oparser_parse_command(parser, &result, plain, sizeof(plain) - 1) == PE_NONE);
+    ck_assert(allocation_count == allocations);
+    ck_assert(strcmp(log.values[0], "name=value") == 0);
+#endif
+
+    oparser_result_destroy(&result);
+    oparser_free(parser);
+}
+END_TEST
+
+START_TEST(test_parser_parse_command_quotes) {
+    OptionParser* parser = oparser_init(simple_handler, PF_ALLOW_REMAINDER, simple_message);
+    oparser_add_option(parser, "name", 'n', OF_VALUE_REQUIRED, "Sets the name");
+
+    const char command[] = "'it''s' \"a \\$b \\q\" \"\" --name";
+    ParseResult result;
+    oparser_result_init(&result);
+    ck_assert(oparser_parse_command(parser, &result, command, sizeof(command) - 1) == PE_VALUE_MISSING);
+
+    const char valid[] = "'it''s' \"a \\$b \\q\" \"\"";
+    ck_assert(oparser_parse_command(parser, &result, valid, sizeof(valid) - 1) == PE_NONE);
+    int count;
+    char** remainder = oparser_result_remainder(&result, &count);
+    ck_assert(count == 3);
+    ck_assert(strcmp(remainder[0], "its") == 0);
+    ck_assert(strcmp(remainder[1], "a $b \\q") == 0);
+    ck_assert(strcmp(remainder[2], "") == 0);
+
+    const char unmatched[] = "--name=\"open";
+    ck_assert(oparser_parse_command(parser, &result, unmatched, sizeof(unmatched) - 1) == PE_UNMATCHED_QUOTE);
+    ck_assert(strcmp(result.error_value, "--name=\"open") == 0);
+
+    oparser_result_destroy(&result);
+    oparser_free(parser);
+}
+END_TEST
+
+typedef struct AllocatorStats {
+    int allocations;
+    int releases;
+    int live;
+} AllocatorStats;
+
+static void* counting_allocate(size_t size, void* context) {
+    AllocatorStats* stats = (AllocatorStats*)context;
+    stats->allocations++;
+    stats->live++;
+    return malloc(size);
+}
+
+static void* counting_reallocate(void* pointer, size_t size, void* context) {
+    AllocatorStats* stats = (AllocatorStats*)context;
+    stats->allocations++;
+    if(pointer == NULL)
+        stats->live++;
+    return realloc(pointer, size);
+}
+
+static void counting_release(void* pointer, void* context) {
+    AllocatorStats* stats = (AllocatorStats*)context;
+    if(pointer != NULL) {
+        stats->releases++;
+        stats->live--;
+    }
+    free(pointer);
+}
+
+static OptionParser* allocator_parser(AllocatorStats* stats, size_t arena_size) {
+    OptionAllocator allocator = { counting_allocate, counting_reallocate, counting_release, stats, arena_size };
+    OptionParser* parser = oparser_init_with_allocator(simple_handler, PF_ALLOW_REMAINDER, simple_message, &allocator);
+    char* names[] = { "name", "time", "any", "one", "two", "three", "four", "five", "six", "seven" };
+    for(int i = 0; i < 10; i++)
+        ck_assert(oparser_add_option(parser, names[i], i < 3 ? names[i][0] : 0, OF_NONE, "An option"));
+    Option* option = parser->options + 2;
+    OptionSubParser* subparser = osubparser_init(option, advance_subhandler, PF_NONE, simple_message);
+    ck_assert(subparser);
+    ck_assert(osubparser_add_option(subparser, "tree", 't', OF_NONE, "Sets the name of a tree"));
+    ck_assert(osubparser_add_option(subparser, "animal", 'a', OF_NONE, "Sets the name of an animal"));
+    return parser;
+}
+
+START_TEST(test_parser_allocator) {
+    AllocatorStats stats = { 0, 0, 0 };
+    OptionParser* parser = allocator_parser(&stats, 0);
+    ck_assert(stats.allocations > 0);
+
+    reset_message();
+    char* args[] = { NULL, "--any", "tree", "file" };
+    ParseResult* result = oparser_parse(parser, args, 4);
+    ck_assert(result->error == PE_NONE);
+    ck_assert(strcmp(simple_message->message, "tree") == 0);
+    oparser_result_free(result);
+
+    char* help = oparser_help(parser);
+    ck_assert(help);
+    ck_assert(strstr(help, "--seven") != NULL);
+    oparser_free_help(parser, help);
+
+    oparser_free(parser);
+    ck_assert(stats.live == 0);
+}
+END_TEST
+
+START_TEST(test_parser_arena) {
+    AllocatorStats stats = { 0, 0, 0 };
+    OptionParser* parser = allocator_parser(&stats, 16384);
+    // Everything fits in the first arena block.
+    ck_assert(stats.allocations == 1);
+
+    reset_message();
+    char* args[] = { NULL, "--any", "animal", "-t" };
+    ParseResult* result = oparser_parse(parser, args, 4);
+    ck_assert(result->error == PE_NONE);
+    ck_assert(strcmp(simple_message->message, "time") == 0);
+    oparser_result_free(result);
+
+    // Help strings come from the allocator rather than the arena, both the cached help and the caller's copy.
+    char* help = oparser_help(parser);
+    ck_assert(help);
+    ck_assert(stats.allocations == 3);
+    oparser_free_help(parser, help);
+    ck_assert(stats.releases == 1);
+
+    oparser_free(parser);
+    ck_assert(stats.live == 0);
+
+    // A small arena chains extra blocks instead of failing.
+    stats = (AllocatorStats){ 0, 0, 0 };
+    parser = allocator_parser(&stats, 64);
+    ck_assert(stats.allocations > 1);
+    char* names[] = { NULL, "--two", "--five" };
+    result = oparser_parse(parser, names, 3);
+    ck_assert(result->error == PE_NONE);
+    oparser_result_free(result);
+    oparser_free(parser);
+    ck_assert(stats.live == 0);
+}
+END_TEST
+
+typedef struct HelpCapture {
+    char text[4096];
+    int length;
+    int calls;
+} HelpCapture;
+
+static bool capture_writer(const char* text, int length, void* context) {
+    HelpCapture* capture = (HelpCapture*)context;
+    if(capture->length + length >= (int)sizeof(capture->text))
+        return false;
+    memcpy(capture->text + capture->length, text, length);
+    capture->length += length;
+    capture->text[capture->length] = '\0';
+    capture->calls++;
+    return true;
+}
+
+START_TEST(test_parser_help_streaming) {
+    char long_doc[1024];
+    memset(long_doc, 'x', sizeof(long_doc) - 1);
+    long_doc[sizeof(long_doc) - 1] = '\0';
+
+    OptionParser* parser = oparser_init(simple_handler, PF_NONE, simple_message);
+    oparser_add_option(parser, "name", 'n', OF_REQUIRED, "Sets the name");
+    Option* option = oparser_add_option(parser, "long", 'l', OF_NONE, long_doc);
+    OptionSubParser* subparser = osubparser_init(option, advance_subhandler, PF_NONE, simple_message);
+    osubparser_add_option(subparser, "tree", 't', OF_REQUIRED, long_doc);
+
+    // Long documentation is no longer cut off at a fixed size per option.
+    char* help = oparser_help(parser);
+    ck_assert(help);
+    ck_assert(strncmp(help, "  --name|-n    Sets the name\n", 29) == 0);
+    ck_assert(strstr(help, long_doc) != NULL);
+    ck_assert(strstr(strstr(help, long_doc) + 1, long_doc) != NULL);
+
+    HelpCapture capture = { .length = 0, .calls = 0 };
+    ck_assert(oparser_write_help(parser, capture_writer, &capture) == (int)strlen(help));
+    ck_assert(strcmp(capture.text, help) == 0);
+
+    HelpCapture small = { .length = 0, .calls = 0 };
+    small.length = sizeof(small.text) - 16;
+    ck_assert(oparser_write_help(parser, capture_writer, &small) == -1);
+
+    FILE* file = tmpfile();
+    ck_assert(oparser_print_help(parser, file) == (int)strlen(help));
+    ck_assert(ftell(file) == (long)strlen(help));
+    fclose(file);
+
+    free(help);
+    oparser_free(parser);
+}
+END_TEST
+
+START_TEST(test_parser_cached_help) {
+    OptionParser* parser = oparser_init(simple_handler, PF_NONE, simple_message);
+    oparser_add_option(parser, "name", 'n', OF_REQUIRED, "Sets the name");
+    Option* option = oparser_add_option(parser, "sub", 's', OF_NONE, "An option with suboptions");
+
+    const char* help = oparser_cached_help(parser);
+    ck_assert(help);
+    ck_assert(oparser_cached_help(parser) == help);
+    const char* option_help = oparser_cached_option_help(parser, "sub");
+    ck_assert(option_help);
+    ck_assert(oparser_cached_option_help(parser, "sub") == option_help);
+    ck_assert(oparser_cached_option_help(parser, "nonoption") == NULL);
+
+    // Copies of cached help match it exactly.
+    char* copy = oparser_help(parser);
+    ck_assert(strcmp(copy, help) == 0);
+    free(copy);
+
+    // Adding a sub-option changes both the option help and the full help.
+    OptionSubParser* subparser = osubparser_init(option, advance_subhandler, PF_NONE, simple_message);
+    osubparser_add_option(subparser, "a-very-long-tree-name", 't', OF_NONE, "Sets the name of a tree");
+    help = oparser_cached_help(parser);
+    ck_assert(strstr(help, "a-very-long-tree-name") != NULL);
+    option_help = oparser_cached_option_help(parser, "sub");
+    ck_assert(strstr(option_help, "a-very-long-tree-name") != NULL);
+
+    oparser_add_option(parser, "time", 't', OF_NONE, "Gets the time");
+    help = oparser_cached_help(parser);
+    ck_assert(strstr(help, "--time") != NULL);
+
+    copy = oparser_option_help(parser, "sub");
+    ck_assert(strcmp(copy, oparser_cached_option_help(parser, "sub")) == 0);
+    free(copy);
+
+    oparser_free(parser);
+}
+END_TEST
+
+typedef struct TypedValues {
+    long long integer;
+    double number;
+    bool boolean;
+    unsigned long long size;
+    long long duration;
+    int calls;
+} TypedValues;
+
+void typed_handler(char* name, int alias, const OptionValue* value, void* data) {
+    TypedValues* values = (TypedValues*)data;
+    values->calls++;
+    switch(value->type) {
+        case OT_INT:
+            values->integer = value->integer;
+            break;
+        case OT_DOUBLE:
+            values->number = value->number;
+            break;
+        case OT_BOOL:
+            values->boolean = value->boolean;
+            break;
+        case OT_SIZE:
+            values->size = value->size;
+            break;
+        case OT_DURATION:
+            values->duration = value->duration;
+            break;
+        default:
+            break;
+    }
+}
+
+static ParseError parse_typed(OptionParser* parser, char* argument) {
+    char* args[] = { NULL, argument };
+    ParseResult result;
+    oparser_result_init(&result);
+    ParseError error = oparser_parse_into(parser, &result, args, 2);
+    oparser_result_destroy(&result);
+    return error;
+}
+
+START_TEST(test_parser_typed_options) {
+    TypedValues values = { 0 };
+    OptionParser* parser = oparser_init(simple_handler, PF_NONE, &values);
+    oparser_set_value_handler(parser, typed_handler);
+    ck_assert(oparser_add_int_option(parser, "int", 'i', OF_NONE, "An integer"));
+    ck_assert(oparser_add_double_option(parser, "double", 'd', OF_NONE, "A number"));
+    ck_assert(oparser_add_bool_option(parser, "bool", 'b', OF_NONE, "A boolean"));
+    ck_assert(oparser_add_size_option(parser, "size", 's', OF_NONE, "A size"));
+    ck_assert(oparser_add_duration_option(parser, "duration", 't', OF_NONE, "A duration"));
+    ck_assert(oparser_add_int_option(parser, "flag", 'f', OF_VALUE_NOT_ALLOWED, "Can't be set") == NULL);
+
+    ck_assert(parse_typed(parser, "--int=-42") == PE_NONE && values.integer == -42);
+    ck_assert(parse_typed(parser, "--int=9223372036854775807") == PE_NONE && values.integer == 9223372036854775807LL);
+    ck_assert(parse_typed(parser, "--int=-9223372036854775808") == PE_NONE && values.integer == -9223372036854775807LL - 1);
+    ck_assert(parse_typed(parser, "--int=9223372036854775808") == PE_VALUE_CONVERSION);
+    ck_assert(parse_typed(parser, "--int=12a") == PE_VALUE_CONVERSION);
+    ck_assert(parse_typed(parser, "--int=-") == PE_VALUE_CONVERSION);
+    ck_assert(parse_typed(parser, "--int") == PE_VALUE_MISSING);
+
+    const char* numbers[] = { "1.5", "-0.1", "3e10", "2.5E-3", ".5", "7.", "123456789012345678901234567890", "1e-300", "0.30000000000000004" };
+    for(int i = 0; i < (int)(sizeof(numbers) / sizeof(numbers[0])); i++) {
+        char argument[64];
+        snprintf(argument, sizeof(argument), "--double=%s", numbers[i]);
+        ck_assert(parse_typed(parser, argument) == PE_NONE);
+        ck_assert(values.number == strtod(numbers[i], NULL));
+    }
+    ck_assert(parse_typed(parser, "--double=1.2.3") == PE_VALUE_CONVERSION);
+    ck_assert(parse_typed(parser, "--double=e5") == PE_VALUE_CONVERSION);
+    ck_assert(parse_typed(parser, "--double=1e") == PE_VALUE_CONVERSION);
+    ck_assert(parse_typed(parser, "--double=1e999") == PE_VALUE_CONVERSION);
+    ck_assert(parse_typed(parser, "--double=-1e400") == PE_VALUE_CONVERSION);
+    ck_assert(parse_typed(parser, "--double=0e999") == PE_NONE && values.number == 0);
+
+    ck_assert(parse_typed(parser, "--bool") == PE_NONE && values.boolean);
+    ck_assert(parse_typed(parser, "--bool=OFF") == PE_NONE && !values.boolean);
+    ck_assert(parse_typed(parser, "--bool=yes") == PE_NONE && values.boolean);
+    ck_assert(parse_typed(parser, "--bool=0") == PE_NONE && !values.boolean);
+    ck_assert(parse_typed(parser, "--bool=maybe") == PE_VALUE_CONVERSION);
+
+    ck_assert(parse_typed(parser, "--size=512") == PE_NONE && values.size == 512);
+    ck_assert(parse_typed(parser, "--size=4k") == PE_NONE && values.size == 4096);
+    ck_assert(parse_typed(parser, "--size=2MiB") == PE_NONE && values.size == 2 * 1024 * 1024);
+    ck_assert(parse_typed(parser, "--size=3GB") == PE_NONE && values.size == 3ull << 30);
+    ck_assert(parse_typed(parser, "--size=64B") == PE_NONE && values.size == 64);
+    ck_assert(parse_typed(parser, "--size=16777216T") == PE_VALUE_CONVERSION);
+    ck_assert(parse_typed(parser, "--size=4x") == PE_VALUE_CONVERSION);
+    ck_assert(parse_typed(parser, "--size=kB") == PE_VALUE_CONVERSION);
+
+    ck_assert(parse_typed(parser, "--duration=1h30m") == PE_NONE && values.duration == 5400000000000LL);
+    ck_assert(parse_typed(parser, "--duration=1.5s") == PE_NONE && values.duration == 1500000000LL);
+    ck_assert(parse_typed(parser, "--duration=250ms") == PE_NONE && values.duration == 250000000LL);
+    ck_assert(parse_typed(parser, "--duration=10") == PE_NONE && values.duration == 10000000000LL);
+    ck_assert(parse_typed(parser, "--duration=10s5") == PE_VALUE_CONVERSION);
+    ck_assert(parse_typed(parser, "--duration=5 days") == PE_VALUE_CONVERSION);
+
+    oparser_free(parser);
+}
+END_TEST
+
+START_TEST(test_parser_typed_errors) {
+    OptionParser* parser = oparser_init(simple_handler, PF_SETTABLE_FLAGS, simple_message);
+    oparser_add_int_option(parser, "name", 'n', OF_NONE, "A number");
+    oparser_add_duration_option(parser, "dur", 'd', OF_NONE, "A duration");
+    Option* option = oparser_add_option(parser, "sub", 's', OF_NONE, "An option with suboptions");
+    OptionSubParser* subparser = osubparser_init(option, advance_subhandler, PF_NONE, simple_message);
+    osubparser_add_typed_option(subparser, "tree", 't', OT_SIZE, OF_NONE, "The size of a tree");
+
+    // Plain handlers still receive the text once it has been validated.
+    reset_message();
+    char* args[] = { NULL, "-n=12", "--sub", "tree=1k" };
+    ParseResult result;
+    oparser_result_init(&result);
+    ck_assert(oparser_parse_into(parser, &result, args, 4) == PE_NONE);
+    ck_assert(strcmp(simple_message->message, "tree") == 0);
+    ck_assert(result.options_parsed == 2);
+
+    char* invalid[] = { NULL, "--sub", "tree=big" };
+    ck_assert(oparser_parse_into(parser, &result, invalid, 3) == PE_VALUE_CONVERSION);
+    char error[320];
+    oparser_format_error(&result, error, sizeof(error));
+    ck_assert(strcmp(error, "Invalid value for option: sub.tree=big") == 0);
+
+    char* invalid_alias[] = { NULL, "-n=twelve" };
+    ck_assert(oparser_parse_into(parser, &result, invalid_alias, 2) == PE_VALUE_CONVERSION);
+    ck_assert(result.options_parsed == 0);
+    ck_assert(strcmp(result.error_value, "name=twelve") == 0);
+
+    // The fraction alone can be enough to overflow.
+    char* overflow[] = { NULL, "--dur=9223372036.9s" };
+    ck_assert(oparser_parse_into(parser, &result, overflow, 2) == PE_VALUE_CONVERSION);
+    char* largest[] = { NULL, "--dur=9223372036.8s" };
+    ck_assert(oparser_parse_into(parser, &result, largest, 2) == PE_NONE);
+
+    oparser_result_destroy(&result);
+    oparser_free(parser);
+}
+END_TEST
+
+typedef struct BoundConfig {
+    char* name;
+    long long count;
+    bool verbose;
+    double ratio;
+    unsigned long long tree_size;
+} BoundConfig;
+
+START_TEST(test_parser_bound_options) {
+    BoundConfig defaults = { "none", 1, false, 0, 0 };
+    OptionParser* parser = oparser_init(NULL, PF_SETTABLE_FLAGS, &defaults);
+    oparser_bind_option_offset(oparser_add_option(parser, "name", 'n', OF_VALUE_REQUIRED, "Sets the name"), offsetof(BoundConfig, name));
+    oparser_bind_option_offset(oparser_add_int_option(parser, "count", 'c', OF_NONE, "Sets the count"), offsetof(BoundConfig, count));
+    oparser_bind_option_offset(oparser_add_bool_option(parser, "verbose", 'v', OF_NONE, "Prints more"), offsetof(BoundConfig, verbose));
+    Option* option = oparser_add_option(parser, "sub", 's', OF_NONE, "An option with suboptions");
+    OptionSubParser* subparser = osubparser_init(option, NULL, PF_NONE, &defaults);
+    osubparser_bind_option_offset(osubparser_add_typed_option(subparser, "tree", 't', OT_SIZE, OF_NONE, "The size of a tree"), offsetof(BoundConfig, tree_size));
+
+    double ratio = 0;
+    oparser_bind_option(oparser_add_double_option(parser, "ratio", 'r', OF_NONE, "Sets the ratio"), &ratio);
+
+    // Without a target, values are stored relative to the parser data.
+    char* args[] = { NULL, "--name=tree", "-v", "--ratio=0.5", "--sub", "tree=2k" };
+    ParseResult result;
+    oparser_result_init(&result);
+    ck_assert(oparser_parse_into(parser, &result, args, 6) == PE_NONE);
+    ck_assert(result.options_parsed == 4);
+    ck_assert(strcmp(defaults.name, "tree") == 0);
+    ck_assert(defaults.count == 1);
+    ck_assert(defaults.verbose);
+    ck_assert(defaults.tree_size == 2048);
+    ck_assert(ratio == 0.5);
+
+    // Each parse can fill its own struct through the result target.
+    BoundConfig config = { NULL, 0, true, 0, 0 };
+    result.target = &config;
+    char* more[] = { NULL, "-c=12", "--verbose=no" };
+    ck_assert(oparser_parse_into(parser, &result, more, 3) == PE_NONE);
+    ck_assert(config.count == 12);
+    ck_assert(!config.verbose);
+    ck_assert(config.name == NULL);
+    ck_assert(defaults.count == 1);
+
+    // Strings that had to be copied stay valid until the result is reused.
+    const char command[] = "--name=\"two words\" --count=3";
+    ck_assert(oparser_parse_command(parser, &result, command, sizeof(command) - 1) == PE_NONE);
+    ck_assert(strcmp(config.name, "two words") == 0);
+    ck_assert(config.count == 3);
+
+    oparser_result_destroy(&result);
+    oparser_free(parser);
+}
+END_TEST
+
+static const SubOption static_suboptions[] = {
+    OPARSER_SUBOPTION("tree", 't', OF_NONE, "Sets the name of a tree"),
+    OPARSER_OFFSET_SUBOPTION("size", 's', OT_SIZE, OF_NONE, "The size of a tree", offsetof(BoundConfig, tree_size))
+};
+
+static OptionSubParser static_subparser = OPARSER_STATIC_SUBPARSER(static_suboptions, advance_subhandler, PF_NONE, NULL);
+
+static const Option static_options[] = {
+    OPARSER_OPTION("name", 'n', OF_VALUE_REQUIRED, "Sets the name"),
+    OPARSER_OPTION("time", 't', OF_NONE, "Gets the time"),
+    OPARSER_OFFSET_OPTION("count", 'c', OT_INT, OF_NONE, "Sets the count", offsetof(BoundConfig, count)),
+    OPARSER_TYPED_OPTION("ratio", 0, OT_DOUBLE, OF_NONE, "Sets the ratio"),
+    OPARSER_SUBPARSER_OPTION("sub", 's', OF_NONE, "An option with suboptions", static_subparser)
+};
+
+START_TEST(test_parser_static_table) {
+    BoundConfig config = { NULL, 0, false, 0, 0 };
+    Message message = { NULL };
+    static_subparser.data = &message;
+    OptionParser parser = OPARSER_STATIC_PARSER(static_options, simple_handler, PF_ALLOW_REMAINDER, &message);
+
+    ck_assert(static_options[3].base.flags == OF_VALUE_REQUIRED);
+    ck_assert(oparser_add_option(&parser, "more", 'm', OF_NONE, "Can't be added") == NULL);
+    ck_assert(osubparser_init((Option*)&static_options[0], advance_subhandler, PF_NONE, NULL) == NULL);
+
+    char* args[] = { NULL, "-t", "--count=7", "file", "--sub", "size=1k", "tree" };
+    ParseResult result;
+    oparser_result_init(&result);
+    result.target = &config;
+    ck_assert(oparser_parse_into(&parser, &result, args, 7) == PE_NONE);
+    ck_assert(result.options_parsed == 3);
+    ck_assert(config.count == 7);
+    ck_assert(config.tree_size == 1024);
+    ck_assert(strcmp(message.message, "tree") == 0);
+    int count;
+    char** remainder = oparser_result_remainder(&result, &count);
+    ck_assert(count == 1 && strcmp(remainder[0], "file") == 0);
+
+    char* invalid[] = { NULL, "--ratio=fast" };
+    ck_assert(oparser_parse_into(&parser, &result, invalid, 2) == PE_VALUE_CONVERSION);
+    char* missing[] = { NULL, "-x" };
+    ck_assert(oparser_parse_into(&parser, &result, missing, 2) == PE_INVALID_ALIAS);
+
+    const char* help = oparser_cached_help(&parser);
+    ck_assert(help);
+    ck_assert(strstr(help, "[--sub|-s]") != NULL);
+    ck_assert(oparser_cached_help(&parser) == help);
+    const char* option_help = oparser_cached_option_help(&parser, "sub");
+    ck_assert(strstr(option_help, "tree") != NULL);
+    ck_assert(oparser_cached_option_help(&parser, "sub") == option_help);
+    ck_assert(oparser_cached_option_help(&parser, "name") != NULL);
+
+    oparser_result_destroy(&result);
+    oparser_free(&parser);
+}
+END_TEST
+
+static void alias_handler(char* name, int alias, char* value, void* data) {
+    *(int*)data = alias;
+}
+
+START_TEST(test_parser_abbreviations) {
+    int alias = 0;
+    OptionParser* parser = oparser_init(alias_handler, PF_ALLOW_ABBREVIATIONS, &alias);
+    oparser_add_option(parser, "time", 't', OF_NONE, "Gets the time");
+    oparser_add_option(parser, "timeout", 'o', OF_NONE, "Sets the timeout");
+    oparser_add_option(parser, "verbose", 'v', OF_NONE, "Prints more");
+    oparser_add_option(parser, "version", 'V', OF_NONE, "Prints the version");
+    Option* option = oparser_add_option(parser, "sub", 's', OF_NONE, "An option with suboptions");
+    OptionSubParser* subparser = osubparser_init(option, alias_handler, PF_ALLOW_ABBREVIATIONS, &alias);
+    osubparser_add_option(subparser, "tree", 'e', OF_NONE, "Sets the name of a tree");
+    osubparser_add_option(subparser, "trunk", 'k', OF_NONE, "Sets the trunk");
+    osubparser_add_option(subparser, "animal", 'a', OF_NONE, "Sets the name of an animal");
+
+    ParseResult result;
+    oparser_result_init(&result);
+    struct { char* arg; int alias; } matches[] = {
+        { "--verb", 'v' }, { "--vers", 'V' }, { "--time", 't' }, { "--timeout", 'o' }, { "--timeo", 'o' }, { "--s", 's' }
+    };
+    for(int i = 0; i < 6; i++) {
+        char* args[] = { NULL, matches[i].arg };
+        ck_assert(oparser_parse_into(parser, &result, args, 2) == PE_NONE);
+        ck_assert(alias == matches[i].alias);
+    }
+
+    char* ambiguous[] = { NULL, "--ver" };
+    ck_assert(oparser_parse_into(parser, &result, ambiguous, 2) == PE_AMBIGUOUS_NAME);
+    ck_assert(strcmp(result.error_value, "ver") == 0);
+    char* longer[] = { NULL, "--timeouts" };
+    ck_assert(oparser_parse_into(parser, &result, longer, 2) == PE_INVALID_NAME);
+
+    char* suboptions[] = { NULL, "--sub", "an", "tre" };
+    ck_assert(oparser_parse_into(parser, &result, suboptions, 4) == PE_NONE);
+    ck_assert(alias == 'e');
+    char* ambiguous_suboption[] = { NULL, "--sub", "tr" };
+    ck_assert(oparser_parse_into(parser, &result, ambiguous_suboption, 3) == PE_AMBIGUOUS_NAME);
+    ck_assert(strcmp(result.error_value, "sub.tr") == 0);
+
+    // Static tables are searched directly.
+    OptionParser table = OPARSER_STATIC_PARSER(static_options, alias_handler, PF_ALLOW_ABBREVIATIONS, &alias);
+    char* table_args[] = { NULL, "--ti" };
+    ck_assert(oparser_parse_into(&table, &result, table_args, 2) == PE_NONE);
+    ck_assert(alias == 't');
+
+    // Abbreviations are only matched when asked for.
+    parser->flags = PF_NONE;
+    char* abbreviated[] = { NULL, "--verb" };
+    ck_assert(oparser_parse_into(parser, &result, abbreviated, 2) == PE_INVALID_NAME);
+
+    oparser_result_destroy(&result);
+    oparser_free(parser);
+}
+END_TEST
+
+typedef struct SubcommandState {
+    int builds;
+    int alias;
+} SubcommandState;
+
+static OptionParser* build_commit(const char* name, void* data) {
+    SubcommandState* state = data;
+    state->builds++;
+    OptionParser* parser = oparser_init(alias_handler, PF_ALLOW_REMAINDER, &state->alias);
+    oparser_add_option(parser, "message", 'm', OF_VALUE_REQUIRED, "Sets the message");
+    oparser_add_option(parser, "amend", 'a', OF_NONE, "Amends the last commit");
+    return parser;
+}
+
+static OptionParser* build_remote(const char* name, void* data) {
+    SubcommandState* state = data;
+    state->builds++;
+    OptionParser* parser = oparser_init(alias_handler, PF_NONE, &state->alias);
+    oparser_add_subcommand(parser, "add", build_commit, data, "Adds a remote");
+    return parser;
+}
+
+static OptionParser* build_nothing(const char* name, void* data) {
+    return NULL;
+}
+
+START_TEST(test_parser_subcommands) {
+    SubcommandState state = { 0, 0 };
+    OptionParser* parser = oparser_init(alias_handler, PF_NONE, &state.alias);
+    oparser_add_option(parser, "root", 'r', OF_REQUIRED, "Sets the root");
+    oparser_add_option(parser, "verbose", 'v', OF_NONE, "Prints more");
+    ck_assert(oparser_add_subcommand(parser, "commit", build_commit, &state, "Records changes"));
+    ck_assert(oparser_add_subcommand(parser, "remote", build_remote, &state, "Manages remotes"));
+    ck_assert(oparser_add_subcommand(parser, "push", build_nothing, NULL, "Can't be built"));
+    ck_assert(!oparser_add_subcommand(parser, "commit", build_commit, &state, "Already added"));
+    ck_assert(state.builds == 0);
+
+    ParseResult result;
+    oparser_result_init(&result);
+    char* args[] = { NULL, "-rv", "commit", "--message=hi", "file", "-a" };
+    for(int i = 0; i < 2; i++) {
+        ck_assert(oparser_parse_into(parser, &result, args, 6) == PE_NONE);
+        ck_assert(state.builds == 1);
+        ck_assert(state.alias == 'a');
+        ck_assert(result.options_parsed == 4);
+        ck_assert(strcmp(result.subcommand_name, "commit") == 0);
+        int count;
+        char** remainder = oparser_result_remainder(&result, &count);
+        ck_assert(count == 1 && strcmp(remainder[0], "file") == 0);
+    }
+
+    char* nested[] = { NULL, "-r", "remote", "add", "--message=origin" };
+    ck_assert(oparser_parse_into(parser, &result, nested, 5) == PE_NONE);
+    ck_assert(state.builds == 3);
+    ck_assert(state.alias == 'm');
+    ck_assert(strcmp(result.subcommand_name, "add") == 0);
+
+    char* parent_option[] = { NULL, "-r", "commit", "-v" };
+    ck_assert(oparser_parse_into(parser, &result, parent_option, 4) == PE_INVALID_ALIAS);
+    char* missing[] = { NULL, "commit", "-r" };
+    ck_assert(oparser_parse_into(parser, &result, missing, 3) == PE_REQUIRED_MISSING);
+    ck_assert(strcmp(result.error_value, "root") == 0);
+    char* failed[] = { NULL, "-r", "push" };
+    ck_assert(oparser_parse_into(parser, &result, failed, 3) == PE_SUBCOMMAND_FAILED);
+    ck_assert(strcmp(result.error_value, "push") == 0);
+    char* unknown[] = { NULL, "-r", "pull" };
+    ck_assert(oparser_parse_into(parser, &result, unknown, 3) == PE_REMAINDER);
+    char* none[] = { NULL, "-r" };
+    ck_assert(oparser_parse_into(parser, &result, none, 2) == PE_NONE);
+    ck_assert(result.subcommand == NULL);
+
+    oparser_result_destroy(&result);
+    oparser_free(parser);
+}
+END_TEST
+
+START_TEST(test_parser_environment) {
+    BoundConfig config = { NULL, 0, false, 0, 0 };
+    OptionParser* parser = oparser_init(NULL, PF_NONE, &config);
+    Option* option = oparser_add_option(parser, "name", 'n', OF_REQUIRED, "Sets the name");
+    oparser_bind_option_offset(option, offsetof(BoundConfig, name));
+    ck_assert(oparser_set_option_environment(option, "APP_NAME"));
+    option = oparser_add_int_option(parser, "count", 'c', OF_NONE, "Sets the count");
+    oparser_bind_option_offset(option, offsetof(BoundConfig, count));
+    ck_assert(oparser_set_option_environment(option, "APP_COUNT"));
+    ck_assert(!oparser_set_option_environment(option, "APP_NAME"));
+    option = oparser_add_option(parser, "verbose", 'v', OF_VALUE_NOT_ALLOWED, "Prints more");
+    oparser_bind_option_offset(option, offsetof(BoundConfig, verbose));
+    option->base.type = OT_BOOL;
+    ck_assert(oparser_set_option_environment(option, "APP_VERBOSE"));
+
+    char* environment[] = { "HOME=/root", "APP_COUNT=12", "APP_NAME=env", "APP_VERBOSE=", "APP_NAMES=other", NULL };
+    ParseResult result;
+    oparser_result_init(&result);
+    result.environment = environment;
+
+    char* args[] = { NULL, "--name=arg" };
+    ck_assert(oparser_parse_into(parser, &result, args, 2) == PE_NONE);
+    ck_assert(strcmp(config.name, "arg") == 0);
+    ck_assert(config.count == 12);
+    ck_assert(!config.verbose);
+    ck_assert(result.options_parsed == 2);
+
+    // The environment satisfies required options.
+    char* none[] = { NULL };
+    environment[3] = "APP_VERBOSE=1";
+    ck_assert(oparser_parse_into(parser, &result, none, 1) == PE_NONE);
+    ck_assert(strcmp(config.name, "env") == 0);
+    ck_assert(config.verbose);
+
+    environment[1] = "APP_COUNT=many";
+    ck_assert(oparser_parse_into(parser, &result, none, 1) == PE_VALUE_CONVERSION);
+    environment[2] = "APP_NAME=";
+    ck_assert(oparser_parse_into(parser, &result, args, 2) == PE_VALUE_CONVERSION);
+    environment[1] = NULL;
+    ck_assert(oparser_parse_into(parser, &result, none, 1) == PE_REQUIRED_MISSING);
+
+    // Without an environment of its own, the result uses the environment of the process.
+    ck_assert(oparser_set_option_environment(parser->options, "PATH"));
+    result.environment = NULL;
+    config.name = NULL;
+    ck_assert(oparser_parse_into(parser, &result, none, 1) == PE_NONE);
+    ck_assert(config.name != NULL && strcmp(config.name, getenv("PATH")) == 0);
+
+    oparser_result_destroy(&result);
+    oparser_free(parser);
+}
+END_TEST
+
+START_TEST(test_parser_config_files) {
+    BoundConfig config = { NULL, 0, false, 0, 0 };
+    Message message = { NULL };
+    OptionParser* parser = oparser_init(NULL, PF_NONE, &config);
+    Option* option = oparser_add_option(parser, "name", 'n', OF_VALUE_REQUIRED, "Sets the name");
+    oparser_bind_option_offset(option, offsetof(BoundConfig, name));
+    oparser_set_option_environment(option, "APP_NAME");
+    oparser_bind_option_offset(oparser_add_int_option(parser, "count", 'c', OF_NONE, "Sets the count"), offsetof(BoundConfig, count));
+    oparser_bind_option_offset(oparser_add_bool_option(parser, "verbose", 'v', OF_NONE, "Prints more"), offsetof(BoundConfig, verbose));
+    option = oparser_add_option(parser, "sub", 's', OF_NONE, "An option with suboptions");
+    OptionSubParser* subparser = osubparser_init(option, advance_subhandler, PF_NONE, &message);
+    osubparser_add_option(subparser, "tree", 't', OF_VALUE_REQUIRED | OF_REQUIRED, "Sets the name of a tree");
+    osubparser_add_option(subparser, "animal", 'a', OF_VALUE_NOT_ALLOWED, "Sets the name of an animal");
+
+    write_file("parser_test_base.conf", "# Base settings\nname = \"from file\"\ncount = 3\n  verbose=yes  \n\n[ sub ]\n  tree = oak\n; comment\nanimal\n");
+    write_file("parser_test_override.conf", "count = 7");
+    ck_assert(oparser_add_config_file(parser, "parser_test_base.conf"));
+    ck_assert(oparser_add_config_file(parser, "parser_test_override.conf"));
+    ck_assert(oparser_add_config_file(parser, "parser_test_missing.conf"));
+
+    ParseResult result;
+    oparser_result_init(&result);
+    char* environment[] = { "APP_NAME=env", NULL };
+    char* empty[] = { NULL };
+    result.environment = empty;
+
+    // Later files take precedence over earlier ones.
+    char* none[] = { NULL };
+    ck_assert(oparser_parse_into(parser, &result, none, 1) == PE_NONE);
+    ck_assert(strcmp(config.name, "from file") == 0);
+    ck_assert(config.count == 7);
+    ck_assert(config.verbose);
+    ck_assert(strcmp(message.message, "animal") == 0);
+    ck_assert(result.options_parsed == 4);
+
+    // The environment takes precedence over the files, and the arguments over both.
+    result.environment = environment;
+    char* args[] = { NULL, "--count=1", "--sub", "tree=elm" };
+    ck_assert(oparser_parse_into(parser, &result, args, 4) == PE_NONE);
+    ck_assert(strcmp(config.name, "env") == 0);
+    ck_assert(config.count == 1);
+    ck_assert(strcmp(message.message, "tree") == 0);
+
+    OptionParser* strict = oparser_init(NULL, PF_NONE, &config);
+    oparser_bind_option_offset(oparser_add_int_option(strict, "count", 'c', OF_NONE, "Sets the count"), offsetof(BoundConfig, count));
+    option = oparser_add_option(strict, "sub", 's', OF_NONE, "An option with suboptions");
+    subparser = osubparser_init(option, advance_subhandler, PF_NONE, &message);
+    osubparser_add_option(subparser, "tree", 't', OF_VALUE_REQUIRED | OF_REQUIRED, "Sets the name of a tree");
+    oparser_add_config_file(strict, "parser_test_bad.conf");
+    struct { const char* contents; ParseError error; const char* value; } errors[] = {
+        { "count = 1\nsize = 2", PE_INVALID_NAME, "parser_test_bad.conf:2: size" },
+        { "= 2", PE_CONFIG_SYNTAX, "parser_test_bad.conf:1: = 2" },
+        { "[count]", PE_CONFIG_SYNTAX, "parser_test_bad.conf:1: [count]" },
+        { "count = 1\ncount = 2", PE_DUPLICATE, "parser_test_bad.conf:2: count" },
+        { "count = many", PE_VALUE_CONVERSION, "count=many" },
+        { "[sub]\n", PE_REQUIRED_MISSING, "sub.tree" },
+        { "[sub]\ntree", PE_VALUE_MISSING, "parser_test_bad.conf:2: tree" },
+        { "count =", PE_VALUE_INVALID, "parser_test_bad.conf:1: count" },
+        { "[sub]\ntree= ", PE_VALUE_INVALID, "parser_test_bad.conf:2: tree" }
+    };
+    for(int i = 0; i < (int)(sizeof(errors) / sizeof(errors[0])); i++) {
+        write_file("parser_test_bad.conf", errors[i].contents);
+        ck_assert(oparser_parse_into(strict, &result, none, 1) == errors[i].error);
+        ck_assert(strcmp(result.error_value, errors[i].value) == 0);
+    }
+    write_file("parser_test_bad.conf", "[sub]\ntree = \"\"");
+    ck_assert(oparser_parse_into(strict, &result, none, 1) == PE_NONE);
+
+    oparser_result_destroy(&result);
+    oparser_free(strict);
+    oparser_free(parser);
+    remove("parser_test_base.conf");
+    remove("parser_test_override.conf");
+    remove("parser_test_bad.conf");
+}
+END_TEST
+
+START_TEST(test_parser_push) {
+    Message message = { NULL };
+    OptionParser* parser = oparser_init(simple_handler, PF_ALLOW_REMAINDER | PF_RESPONSE_FILES, &message);
+    oparser_add_option(parser, "time", 't', OF_NONE, "Gets the time");
+    Option* option = oparser_add_option(parser, "sub", 's', OF_NONE, "An option with suboptions");
+    OptionSubParser* subparser = osubparser_init(option, advance_subhandler, PF_NONE, &message);
+    osubparser_add_option(subparser, "tree", 't', OF_VALUE_REQUIRED | OF_REQUIRED, "Sets the name of a tree");
+    osubparser_add_option(subparser, "animal", 'a', OF_NONE, "Sets the name of an animal");
+
+    // Tokens are slices of a buffer that is overwritten as soon as they have been fed.
+    char buffer[32];
+    ParseResult result;
+    oparser_result_init(&result);
+    ck_assert(oparser_begin(parser, &result) == PE_NONE);
+    const char* tokens[] = { "--time", "--sub", "animal", "tree=oak", "file" };
+    for(int i = 0; i < 5; i++) {
+        snprintf(buffer, sizeof(buffer), "%s#####", tokens[i]);
+        ck_assert(oparser_feed(&result, buffer, strlen(tokens[i])) == PE_NONE);
+        memset(buffer, 'x', sizeof(buffer));
+        if(i == 3)
+            ck_assert(strcmp(message.message, "tree") == 0);
+    }
+    ck_assert(oparser_finish(&result) == PE_NONE);
+    ck_assert(result.options_parsed == 2);
+    int count;
+    char** remainder = oparser_result_remainder(&result, &count);
+    ck_assert(count == 1 && strcmp(remainder[0], "file") == 0);
+
+    // Sub-options can continue in a response file, and are checked when the parse finishes.
+    write_file("response_test.rsp", "animal");
+    ck_assert(oparser_begin(parser, &result) == PE_NONE);
+    ck_assert(oparser_feed(&result, "--sub", 5) == PE_NONE);
+    ck_assert(oparser_feed(&result, "@response_test.rsp", 18) == PE_NONE);
+    ck_assert(strcmp(message.message, "animal") == 0);
+    ck_assert(oparser_finish(&result) == PE_REQUIRED_MISSING);
+    ck_assert(strcmp(result.error_value, "sub.tree") == 0);
+
+    // Errors stick until the next parse begins.
+    ck_assert(oparser_begin(parser, &result) == PE_NONE);
+    ck_assert(oparser_feed(&result, "--nope", 6) == PE_INVALID_NAME);
+    ck_assert(oparser_feed(&result, "--time", 6) == PE_INVALID_NAME);
+    ck_assert(oparser_finish(&result) == PE_INVALID_NAME);
+    ck_assert(result.options_parsed == 0);
+
+    // Response files are expanded by the flags of the top-level parser, even after a subcommand, like 'oparser_parse_into'.
+    SubcommandState state = { 0, 0 };
+    OptionParser* commands = oparser_init(alias_handler, PF_RESPONSE_FILES, &state.alias);
+    oparser_add_subcommand(commands, "commit", build_commit, &state, "Records changes");
+    write_file("response_test.rsp", "-a file");
+    char* args[] = { NULL, "commit", "@response_test.rsp" };
+    ck_assert(oparser_parse_into(commands, &result, args, 3) == PE_NONE);
+    ck_assert(state.alias == 'a' && result.remainder_count == 1);
+    state.alias = 0;
+    ck_assert(oparser_begin(commands, &result) == PE_NONE);
+    ck_assert(oparser_feed(&result, "commit", 6) == PE_NONE);
+    ck_assert(oparser_feed(&result, "@response_test.rsp", 18) == PE_NONE);
+    ck_assert(oparser_finish(&result) == PE_NONE);
+    ck_assert(state.alias == 'a' && result.remainder_count == 1);
+    ck_assert(strcmp(result.remainder[0], "file") == 0);
+
+    oparser_result_destroy(&result);
+    oparser_free(commands);
+    oparser_free(parser);
+    remove("response_test.rsp");
+}
+END_TEST
+
+typedef struct Candidates {
+    char text[512];
+    int length;
+} Candidates;
+
+static bool collect_candidate(const char* candidate, int length, void* data) {
+    Candidates* candidates = data;
+    if(candidates->length + length + 2 > (int)sizeof(candidates->text))
+        return false;
+    memcpy(candidates->text + candidates->length, candidate, length);
+    candidates->length += length;
+    candidates->text[candidates->length++] = '\n';
+    candidates->text[candidates->length] = '\0';
+    return true;
+}
+
+// Completes the last of the words, and returns the candidates separated by new lines with one in front.
+static int complete_words(const OptionParser* parser, char** words, int count, Candidates* candidates) {
+    strcpy(candidates->text, "\n");
+    candidates->length = 1;
+    return oparser_complete(parser, words, count, count - 1, collect_candidate, candidates);
+}
+
+static bool has_candidate(Candidates* candidates, const char* candidate) {
+    char line[64];
+    snprintf(line, sizeof(line), "\n%s\n", candidate);
+    return strstr(candidates->text, line) != NULL;
+}
+
+START_TEST(test_parser_completion) {
+    Message message = { NULL };
+    OptionParser* parser = oparser_init(simple_handler, PF_ALLOW_REMAINDER, &message);
+    oparser_add_option(parser, "verbose", 'v', OF_NONE, "Prints more");
+    oparser_add_option(parser, "version", 'V', OF_NONE, "Prints the version");
+    oparser_add_option(parser, "verify", 0, OF_NONE, "Checks the output");
+    oparser_add_option(parser, "echo", 'e', OF_VALUE_REQUIRED | OF_DUPLICATES_ALLOWED, "Prints a value");
+    Option* option = oparser_add_option(parser, "sub", 's', OF_NONE, "An option with suboptions");
+    OptionSubParser* subparser = osubparser_init(option, advance_subhandler, PF_NONE, &message);
+    osubparser_add_option(subparser, "tree", 't', OF_VALUE_REQUIRED, "Sets the name of a tree");
+    osubparser_add_option(subparser, "trunk", 0, OF_NONE, "Sets the trunk");
+    osubparser_add_option(subparser, "animal", 'a', OF_NONE, "Sets the name of an animal");
+
+    Candidates candidates;
+    char* prefix[] = { "prog", "--ver" };
+    ck_assert(complete_words(parser, prefix, 2, &candidates) == 3);
+    ck_assert(has_candidate(&candidates, "--verbose") && has_candidate(&candidates, "--version") && has_candidate(&candidates, "--verify"));
+
+    // Options that were already given aren't offered again, unless they can be duplicated.
+    char* used[] = { "prog", "-v", "--echo=a", "--ver" };
+    ck_assert(complete_words(parser, used, 4, &candidates) == 2);
+    ck_assert(!has_candidate(&candidates, "--verbose"));
+    char* duplicate[] = { "prog", "--echo", "a", "--e" };
+    ck_assert(complete_words(parser, duplicate, 4, &candidates) == 1);
+    ck_assert(has_candidate(&candidates, "--echo"));
+
+    // After an option with sub-options, the unused sub-options are offered.
+    char* sub[] = { "prog", "--sub", "tree=oak", "t" };
+    ck_assert(complete_words(parser, sub, 4, &candidates) == 1);
+    ck_assert(has_candidate(&candidates, "trunk"));
+    char* lone_dash[] = { "prog", "--sub", "-" };
+    ck_assert(complete_words(parser, lone_dash, 3, &candidates) == 7);
+    ck_assert(!has_candidate(&candidates, "-s") && !has_candidate(&candidates, "--sub"));
+    ck_assert(has_candidate(&candidates, "-v") && has_candidate(&candidates, "--verify"));
+
+    // Values aren't completed.
+    char* value[] = { "prog", "--echo=v" };
+    ck_assert(complete_words(parser, value, 2, &candidates) == 0);
+    char* empty[] = { "prog", "" };
+    ck_assert(complete_words(parser, empty, 2, &candidates) == 5);
+
+    // Subcommands are offered by name, and are built once the cursor moves past them.
+    SubcommandState state = { 0, 0 };
+    OptionParser* commands = oparser_init(alias_handler, PF_NONE, &state.alias);
+    oparser_add_subcommand(commands, "commit", build_commit, &state, "Records changes");
+    oparser_add_subcommand(commands, "config", build_nothing, NULL, "Can't be built");
+    char* names[] = { "prog", "co" };
+    ck_assert(complete_words(commands, names, 2, &candidates) == 2);
+    ck_assert(state.builds == 0);
+    char* nested[] = { "prog", "commit", "-m", "text", "--" };
+    ck_assert(complete_words(commands, nested, 5, &candidates) == 1);
+    ck_assert(has_candidate(&candidates, "--amend"));
+    ck_assert(state.builds == 1);
+    char* broken[] = { "prog", "config", "--" };
+    ck_assert(complete_words(commands, broken, 3, &candidates) == 0);
+
+    // Static tables don't have a trie, so they are searched directly.
+    OptionParser table = OPARSER_STATIC_PARSER(static_options, simple_handler, PF_NONE, &message);
+    char* static_words[] = { "prog", "--ti" };
+    ck_assert(complete_words(&table, static_words, 2, &candidates) == 1);
+    ck_assert(has_candidate(&candidates, "--time"));
+
+    // The hidden mode used by the scripts writes one candidate per line.
+    FILE* file = tmpfile();
+    char* plain[] = { "prog", "--verbose" };
+    ck_assert(!oparser_run_completion(parser, plain, 2, file));
+    char* hidden[] = { "prog", OPARSER_COMPLETE_OPTION, "1", "prog", "--ech" };
+    ck_assert(oparser_run_completion(parser, hidden, 5, file));
+    char output[64] = { 0 };
+    rewind(file);
+    fread(output, 1, sizeof(output) - 1, file);
+    ck_assert(strcmp(output, "--echo\n") == 0);
+    fclose(file);
+
+    static const CompletionShell shells[] = { CS_BASH, CS_ZSH, CS_FISH };
+    for(int i = 0; i < 3; i++) {
+        file = tmpfile();
+        ck_assert(oparser_write_completion_script("my-tool", shells[i], file));
+        char script[512] = { 0 };
+        rewind(file);
+        fread(script, 1, sizeof(script) - 1, file);
+        ck_assert(strstr(script, OPARSER_COMPLETE_OPTION) != NULL);
+        ck_assert(strstr(script, "_my_tool") != NULL && strstr(script, " my-tool") != NULL);
+        fclose(file);
+    }
+
+    oparser_free(commands);
+    oparser_free(parser);
+}
+END_TEST
+
+START_TEST(test_parser_suggestions) {
+    Message message = { NULL };
+    OptionParser* parser = oparser_init(simple_handler, PF_NONE, &message);
+    oparser_add_option(parser, "timeout", 't', OF_VALUE_REQUIRED, "Sets the timeout");
+    oparser_add_option(parser, "time", 0, OF_NONE, "Gets the time");
+    oparser_add_option(parser, "verbose", 'v', OF_NONE, "Prints more");
+    oparser_add_option(parser, "version", 'V', OF_NONE, "Prints the version");
+    Option* option = oparser_add_option(parser, "sub", 's', OF_NONE, "An option with suboptions");
+    OptionSubParser* subparser = osubparser_init(option, advance_subhandler, PF_NONE, &message);
+    osubparser_add_option(subparser, "tree", 0, OF_VALUE_REQUIRED, "Sets the name of a tree");
+
+    ParseResult result;
+    oparser_result_init(&result);
+    char* close[] = { "program", "--timout=5" };
+    ck_assert(oparser_parse_into(parser, &result, close, 2) == PE_INVALID_NAME);
+    ck_assert(strcmp(result.error_value, "timout=5") == 0);
+    ck_assert(strcmp(oparser_get_error_string(&result), "Encountered invalid option: timout=5 (did you mean timeout?)") == 0);
+
+    // The closest names come first.
+    char* several[] = { "program", "--timeot" };
+    ck_assert(oparser_parse_into(parser, &result, several, 2) == PE_INVALID_NAME);
+    const char* expected = "Encountered invalid option: timeot (did you mean timeout, time?)";
+    ck_assert(strcmp(oparser_get_error_string(&result), expected) == 0);
+    char buffer[40];
+    ck_assert(oparser_format_error(&result, buffer, sizeof(buffer)) == (int)strlen(expected));
+    ck_assert(strncmp(buffer, expected, sizeof(buffer) - 1) == 0);
+    ck_assert(oparser_format_error(&result, NULL, 0) == (int)strlen(expected));
+
+    char* distant[] = { "program", "--xyz" };
+    ck_assert(oparser_parse_into(parser, &result, distant, 2) == PE_INVALID_NAME);
+    ck_assert(strcmp(oparser_get_error_string(&result), "Encountered invalid option: xyz") == 0);
+
+    // Names in config files are suggested from the options of their section.
+    write_file("parser_test.conf", "[sub]\ntre = oak\n");
+    oparser_add_config_file(parser, "parser_test.conf");
+    char* none[] = { "program" };
+    ck_assert(oparser_parse_into(parser, &result, none, 1) == PE_INVALID_NAME);
+    ck_assert(strcmp(oparser_get_error_string(&result), "Encountered invalid option: parser_test.conf:2: tre (did you mean tree?)") == 0);
+
+    oparser_result_destroy(&result);
+    oparser_free(parser);
+    remove("parser_test.conf");
+}
+END_TEST
+
+START_TEST(test_parser_collect_errors) {
+    Message message = { NULL };
+    OptionParser* parser = oparser_init(simple_handler, PF_COLLECT_ERRORS | PF_RESPONSE_FILES, &message);
+    oparser_add_option(parser, "time", 't', OF_VALUE_NOT_ALLOWED, "Gets the time");
+    oparser_add_typed_option(parser, "count", 'c', OT_INT, OF_NONE, "Sets the count");
+    oparser_add_option(parser, "output", 'o', OF_REQUIRED, "Writes the output");
+    Option* option = oparser_add_option(parser, "sub", 's', OF_NONE, "An option with suboptions");
+    OptionSubParser* subparser = osubparser_init(option, advance_subhandler, PF_NONE, &message);
+    osubparser_add_option(subparser, "tree", 't', OF_VALUE_REQUIRED | OF_REQUIRED, "Sets the name of a tree");
+    osubparser_add_option(subparser, "animal", 'a', OF_NONE, "Sets the name of an animal");
+
+    char* argv[] = { "program", "--tme", "--time=5", "-X", "--count=count", "file", "@missing_test.rsp", "-oo", "--sub", "animal", "animal" };
+    ParseResult result;
+    oparser_result_init(&result);
+    ck_assert(oparser_parse_into(parser, &result, argv, 11) == PE_INVALID_NAME);
+    ck_assert(message.message == NULL);
+    ck_assert(result.error_count == 9);
+
+    static const struct {
+        ParseError error;
+        int argument;
+        int start;
+        int length;
+    } expected[] = {
+        { PE_INVALID_NAME, 1, 2, 3 },
+        { PE_VALUE_GIVEN, 2, 2, 4 },
+        { PE_INVALID_ALIAS, 3, 1, 1 },
+        { PE_VALUE_CONVERSION, 4, 8, 5 },
+        { PE_REMAINDER, 5, 0, 4 },
+        { PE_RESPONSE_FILE, 6, 1, 16 },
+        { PE_DUPLICATE, 7, 2, 1 },
+        { PE_DUPLICATE, 10, 0, 6 },
+        { PE_REQUIRED_MISSING, -1, 0, 0 }
+    };
+    for(int i = 0; i < 9; i++) {
+        ck_assert(result.errors[i].error == expected[i].error);
+        ck_assert(result.errors[i].argument == expected[i].argument);
+        ck_assert(result.errors[i].start == expected[i].start);
+        ck_assert(result.errors[i].length == expected[i].length);
+    }
+
+    // The result reports the first error, which still gets suggestions.
+    ck_assert(strcmp(oparser_get_error_string(&result), "Encountered invalid option: tme (did you mean time?)") == 0);
+    char buffer[64];
+    oparser_format_error_entry(&result, 3, buffer, sizeof(buffer));
+    ck_assert(strcmp(buffer, "Invalid value for option: count=count") == 0);
+    oparser_format_error_entry(&result, 8, buffer, sizeof(buffer));
+    ck_assert(strcmp(buffer, "Missing required option: sub.tree") == 0);
+    ck_assert(oparser_format_error_entry(&result, 9, buffer, sizeof(buffer)) == 0);
+
+    // A clean parse collects nothing.
+    char* valid[] = { "program", "--output", "--count=3" };
+    ck_assert(oparser_parse_into(parser, &result, valid, 3) == PE_NONE);
+    ck_assert(result.error_count == 0);
+
+    // Pushed tokens are counted from zero, and each one reports its own error.
+    ck_assert(oparser_begin(parser, &result) == PE_NONE);
+    ck_assert(oparser_feed(&result, "--tme", 5) == PE_INVALID_NAME);
+    ck_assert(oparser_feed(&result, "--time", 6) == PE_NONE);
+    ck_assert(oparser_feed(&result, "-X", 2) == PE_INVALID_ALIAS);
+    ck_assert(oparser_finish(&result) == PE_INVALID_NAME);
+    ck_assert(result.error_count == 3);
+    ck_assert(result.errors[1].argument == 2 && result.errors[1].error == PE_INVALID_ALIAS);
+    ck_assert(result.errors[2].argument == -1 && result.errors[2].error == PE_REQUIRED_MISSING);
+    ck_assert(strcmp(result.error_value, "tme") == 0);
+    ck_assert(message.message == NULL);
+
+    oparser_result_destroy(&result);
+    oparser_free(parser);
+}
+END_TEST
+
+// Starts with a Message so that it can also be given to simple_handler.
+typedef struct ValueLists {
+    Message message;
+    int calls;
+    char names[64];
+} ValueLists;
+
+static void record_list(char* name, int alias, const OptionValue* values, int count, void* data) {
+    ValueLists* lists = data;
+    lists->calls++;
+    snprintf(lists->names + strlen(lists->names), sizeof(lists->names) - strlen(lists->names), "%s=%d ", name, count);
+}
+
+START_TEST(test_parser_collected_values) {
+    ValueLists lists = { { NULL }, 0, "" };
+    OptionParser* parser = oparser_init(simple_handler, PF_NONE, &lists);
+    oparser_set_list_handler(parser, record_list);
+    oparser_add_option(parser, "echo", 'e', OF_DUPLICATES_ALLOWED | OF_VALUE_REQUIRED | OF_COLLECT_VALUES, "Echos a value");
+    oparser_add_option(parser, "include", 'I', OF_DUPLICATES_ALLOWED | OF_VALUE_REQUIRED | OF_COLLECT_VALUES, "Adds a directory");
+    oparser_add_option(parser, "time", 't', OF_NONE, "Gets the time");
+    oparser_add_typed_option(parser, "level", 'l', OT_INT, OF_DUPLICATES_ALLOWED | OF_COLLECT_VALUES, "Adds a level");
+    Option* option = oparser_add_option(parser, "sub", 's', OF_NONE, "An option with suboptions");
+    OptionSubParser* subparser = osubparser_init(option, advance_subhandler, PF_NONE, &lists.message);
+    osubparser_add_option(subparser, "tree", 't', OF_DUPLICATES_ALLOWED | OF_VALUE_REQUIRED | OF_COLLECT_VALUES, "Adds a tree");
+
+    char* argv[] = { "program", "--echo=a", "--include=x", "--echo=b", "--time", "--level=3", "--echo=c", "--sub", "tree=oak", "tree=ash", "--include=y", "--level=5" };
+    ParseResult result;
+    oparser_result_init(&result);
+    ck_assert(oparser_parse_into(parser, &result, argv, 12) == PE_NONE);
+    ck_assert(strcmp(lists.message.message, "time") == 0);
+
+    // The sub-option is only collected, since its subparser doesn't have a list handler.
+    ck_assert(lists.calls == 3);
+    ck_assert(strcmp(lists.names, "echo=3 include=2 level=2 ") == 0);
+
+    // Values point straight into the arguments, and keep the order they were given in.
+    int count;
+    const OptionValue* values = oparser_result_values(&result, "echo", &count);
+    ck_assert(count == 3);
+    ck_assert(values[0].text == argv[1] + 7 && values[1].text == argv[3] + 7 && values[2].text == argv[6] + 7);
+    ck_assert(values[2].length == 1);
+    values = oparser_result_values(&result, "level", &count);
+    ck_assert(count == 2 && values[0].integer == 3 && values[1].integer == 5);
+    values = oparser_result_values(&result, "sub.tree", &count);
+    ck_assert(count == 2 && strcmp(values[0].text, "oak") == 0 && strcmp(values[1].text, "ash") == 0);
+    ck_assert(oparser_result_values(&result, "tree", &count) == NULL && count == 0);
+    ck_assert(oparser_result_values(&result, "time", &count) == NULL);
+
+    // A reused result keeps its storage.
+#ifdef OPTIONS_TEST_COUNT_ALLOCATIONS
+    int allocations = allocation_count;
+#endif
+    ck_assert(oparser_parse_into(parser, &result, argv, 12) == PE_NONE);
+#ifdef OPTIONS_TEST_COUNT_ALLOCATIONS
+    ck_assert_msg(allocation_count == allocations, "A successful parse allocated memory");
+#endif
+
+    // Nothing is handed over if the parse fails.
+    lists.calls = 0;
+    char* invalid[] = { "program", "--echo=a", "--nope" };
+    ck_assert(oparser_parse_into(parser, &result, invalid, 3) == PE_INVALID_NAME);
+    ck_assert(lists.calls == 0);
+
+    // Pushed tokens may be overwritten after they've been fed, so their values are copied.
+    char buffer[16];
+    ck_assert(oparser_begin(parser, &result) == PE_NONE);
+    strcpy(buffer, "--echo=pushed");
+    ck_assert(oparser_feed(&result, buffer, strlen(buffer)) == PE_NONE);
+    memset(buffer, 'x', sizeof(buffer));
+    ck_assert(oparser_finish(&result) == PE_NONE);
+    values = oparser_result_values(&result, "echo", &count);
+    ck_assert(count == 1 && strcmp(values[0].text, "pushed") == 0);
+    ck_assert(lists.calls == 1);
+
+    oparser_result_destroy(&result);
+    oparser_free(parser);
+}
+END_TEST
+
+START_TEST(test_parser_snapshot) {
+    OptionParser* parser = oparser_init(simple_handler, PF_ALLOW_REMAINDER | PF_ALLOW_ABBREVIATIONS, simple_message);
+    oparser_add_option(parser, "name", 'n', OF_VALUE_REQUIRED, "Sets the name");
+    ck_assert(oparser_set_option_environment(oparser_add_option(parser, "time", 't', OF_NONE, "Gets the time"), "TEST_TIME"));
+    oparser_bind_option_offset(oparser_add_int_option(parser, "count", 'c', OF_NONE, "Sets the count"), offsetof(BoundConfig, count));
+    Option* option = oparser_add_option(parser, "sub", 's', OF_NONE, "An option with suboptions");
+    OptionSubParser* subparser = osubparser_init(option, advance_subhandler, PF_NONE, simple_message);
+    osubparser_add_option(subparser, "tree", 't', OF_REQUIRED, "Sets the name of a tree");
+    osubparser_add_option(subparser, "animal", 'a', OF_NONE, "Sets the name of an animal");
+    for(int i = 0; i < 40; i++) {
+        char* name = malloc(16);
+        snprintf(name, 16, "option-%d", i);
+        oparser_add_option(parser, name, 0, OF_NONE, "Filler");
+    }
+    ck_assert(oparser_save_snapshot(parser, "parser_test.snapshot"));
+    char* help = oparser_help(parser);
+
+    // The second snapshot can't use the same address as the first, so it has to be relocated.
+    OptionParser* loaded[2];
+    for(int i = 0; i < 2; i++) {
+        loaded[i] = oparser_load_snapshot("parser_test.snapshot", simple_handler, simple_message);
+        ck_assert(loaded[i] != NULL);
+    }
+
+    for(int i = 0; i < 2; i++) {
+        OptionParser* snapshot = loaded[i];
+        ck_assert(oparser_add_option(snapshot, "more", 'm', OF_NONE, "Can't be added") == NULL);
+        ck_assert(strcmp(oparser_cached_help(snapshot), help) == 0);
+        ck_assert(oparser_set_subparser_handler(snapshot, 's', advance_subhandler, simple_message));
+        ck_assert(!oparser_set_subparser_handler(snapshot, 'n', advance_subhandler, simple_message));
+
+        BoundConfig config = { NULL, 0, false, 0, 0 };
+        reset_message();
+        char* args[] = { NULL, "--option-39", "--count=5", "file", "-s", "tree" };
+        ParseResult result;
+        oparser_result_init(&result);
+        result.target = &config;
+        ck_assert(oparser_parse_into(snapshot, &result, args, 6) == PE_NONE);
+        ck_assert(config.count == 5);
+        ck_assert(strcmp(simple_message->message, "tree") == 0);
+
+        char* missing[] = { NULL, "--sub", "animal" };
+        ck_assert(oparser_parse_into(snapshot, &result, missing, 3) == PE_REQUIRED_MISSING);
+        ck_assert(strcmp(result.error_value, "sub.tree") == 0);
+        char* invalid[] = { NULL, "--option-40" };
+        ck_assert(oparser_parse_into(snapshot, &result, invalid, 2) == PE_INVALID_NAME);
+        char* abbreviated[] = { NULL, "--ti" };
+        reset_message();
+        ck_assert(oparser_parse_into(snapshot, &result, abbreviated, 2) == PE_NONE);
+        ck_assert(strcmp(simple_message->message, "time") == 0);
+        char* ambiguous[] = { NULL, "--opt" };
+        ck_assert(oparser_parse_into(snapshot, &result, ambiguous, 2) == PE_AMBIGUOUS_NAME);
+        char* environment[] = { "TEST_TIME=now", NULL };
+        result.environment = environment;
+        reset_message();
+        ck_assert(oparser_parse_into(snapshot, &result, abbreviated, 1) == PE_NONE);
+        ck_assert(strcmp(simple_message->message, "time") == 0);
+        oparser_result_destroy(&result);
+    }
+
+    oparser_free(loaded[0]);
+    oparser_free(loaded[1]);
+
+    // Options bound to an address can't be saved.
+    long long count;
+    oparser_bind_option(oparser_add_int_option(parser, "bound", 'b', OF_NONE, "Bound to an address"), &count);
+    ck_assert(!oparser_save_snapshot(parser, "parser_test.snapshot"));
+    ck_assert(oparser_load_snapshot("missing.snapshot", simple_handler, NULL) == NULL);
+
+    for(int i = 0; i < parser->option_count; i++) {
+        if(strncmp(parser->options[i].base.name, "option-", 7) == 0)
+            free(parser->options[i].base.name);
+    }
+    free(help);
+    oparser_free(parser);
+    remove("parser_test.snapshot");
+}
+END_TEST
+
+static const Option snapshot_options[] = {
+    OPARSER_OPTION("alpha", 'a', OF_NONE, "The first option"),
+    OPARSER_OPTION("beta", 'b', OF_NONE, "The second option"),
+    OPARSER_OPTION("gamma", 'c', OF_NONE, "The third option")
+};
+
+static void name_handler(char* name, int alias, char* value, void* data) {
+    ((Message*)data)->message = name;
+}
+
+START_TEST(test_parser_snapshot_static_table) {
+    // Static tables don't have an alias index, so the snapshot has to build one.
+    OptionParser table = OPARSER_STATIC_PARSER(snapshot_options, name_handler, PF_NONE, simple_message);
+    ck_assert(oparser_save_snapshot(&table, "parser_test.snapshot"));
+    OptionParser* snapshot = oparser_load_snapshot("parser_test.snapshot", name_handler, simple_message);
+    ck_assert(snapshot != NULL);
+
+    reset_message();
+    char* args[] = { NULL, "-c" };
+    ParseResult result;
+    oparser_result_init(&result);
+    ck_assert(oparser_parse_into(snapshot, &result, args, 2) == PE_NONE);
+    ck_assert(strcmp(simple_message->message, "gamma") == 0);
+    char* name[] = { NULL, "--beta" };
+    ck_assert(oparser_parse_into(snapshot, &result, name, 2) == PE_NONE);
+    ck_assert(strcmp(simple_message->message, "beta") == 0);
+    char* invalid[] = { NULL, "-z" };
+    ck_assert(oparser_parse_into(snapshot, &result, invalid, 2) == PE_INVALID_ALIAS);
+
+    // The relocations come last. While the first snapshot holds its address, the next one has to be relocated,
+    // so a relocation that points outside of the file must be rejected.
+    unsigned char corrupt[8];
+    memset(corrupt, 0xFF, sizeof(corrupt));
+    FILE* file = fopen("parser_test.snapshot", "r+b");
+    ck_assert(file != NULL);
+    ck_assert(fseek(file, -(long)sizeof(corrupt), SEEK_END) == 0);
+    ck_assert(fwrite(corrupt, 1, sizeof(corrupt), file) == sizeof(corrupt));
+    fclose(file);
+    ck_assert(oparser_load_snapshot("parser_test.snapshot", name_handler, simple_message) == NULL);
+
+    oparser_result_destroy(&result);
+    oparser_free(snapshot);
+    oparser_free(&table);
+    remove("parser_test.snapshot");
+}
+END_TEST
+
+START_TEST(test_parser_many_options) {
+    char names[500][8];
+    OptionParser* parser = oparser_init(simple_handler, PF_NONE, NULL);
+    for(int i = 0; i < 500; i++) {
+        sprintf(names[i], "opt%d", i);
+        ck_assert(oparser_add_option(parser, names[i], 1000 + i, OF_NONE, names[i]) != NULL);
+    }
+    for(int i = 0; i < 500; i++)
+        ck_assert(oparser_option_docstring(parser, names[i]) == names[i]);
+    ck_assert(oparser_option_docstring(parser, "opt500") == NULL);
+    oparser_free(parser);
+}
+END_TEST
+
 Suite* oparser_suite(void) {
     Suite* s;
     TCase* tests;
@@ -328,6 +2032,44 @@ Suite* oparser_suite(void) {
     tcase_add_test(tests, test_parser_suboption_help);
     tcase_add_test(tests, test_parser_option_docstring);
     tcase_add_test(tests, test_parser_suboption_docstring);
+    tcase_add_test(tests, test_parser_exact_name);
+    tcase_add_test(tests, test_parser_duplicate_name);
+    tcase_add_test(tests, test_parser_duplicate_alias);
+    tcase_add_test(tests, test_parser_options_parsed);
+    tcase_add_test(tests, test_parser_alias_group);
+    tcase_add_test(tests, test_parser_reentrant);
+    tcase_add_test(tests, test_parser_state_reset_after_error);
+    tcase_add_test(tests, test_parser_format_error);
+    tcase_add_test(tests, test_parser_parse_into);
+    tcase_add_test(tests, test_parser_parse_into_large);
+    tcase_add_test(tests, test_parser_parse_batch_deferred);
+    tcase_add_test(tests, test_parser_parse_batch_worker);
+    tcase_add_test(tests, test_parser_response_file);
+    tcase_add_test(tests, test_parser_response_file_full_page);
+    tcase_add_test(tests, test_parser_response_file_remainder);
+    tcase_add_test(tests, test_parser_response_file_errors);
+    tcase_add_test(tests, test_parser_many_options);
+    tcase_add_test(tests, test_parser_parse_command);
+    tcase_add_test(tests, test_parser_parse_command_quotes);
+    tcase_add_test(tests, test_parser_allocator);
+    tcase_add_test(tests, test_parser_arena);
+    tcase_add_test(tests, test_parser_help_streaming);
+    tcase_add_test(tests, test_parser_cached_help);
+    tcase_add_test(tests, test_parser_typed_options);
+    tcase_add_test(tests, test_parser_typed_errors);
+    tcase_add_test(tests, test_parser_bound_options);
+    tcase_add_test(tests, test_parser_static_table);
+    tcase_add_test(tests, test_parser_abbreviations);
+    tcase_add_test(tests, test_parser_subcommands);
+    tcase_add_test(tests, test_parser_environment);
+    tcase_add_test(tests, test_parser_config_files);
+    tcase_add_test(tests, test_parser_push);
+    tcase_add_test(tests, test_parser_completion);
+    tcase_add_test(tests, test_parser_suggestions);
+    tcase_add_test(tests, test_parser_collect_errors);
+    tcase_add_test(tests, test_parser_collected_values);
+    tcase_add_test(tests, test_parser_snapshot);
+    tcase_add_test(tests, test_parser_snapshot_static_table);
 
     suite_add_tcase(s, tests);
 